@@ -0,0 +1,287 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include "asynctrace.h"
+#include "machine.h"
+#include "instruction.h"
+#include "utilities.h"
+
+#define DEBUG 0
+
+// Times the writer yields on an empty ring before it starts sleeping.
+#define IDLE_SPINS 64
+
+// How long the idle writer sleeps between looks at the ring.
+#define IDLE_SLEEP_NS 100000
+
+// What a record asks the writer to do.
+typedef enum { RECORD_STEP, RECORD_LINE, RECORD_WRITES, RECORD_OUTPUT, RECORD_STOP } record_kind;
+
+// One entry of the ring. A step carries a traced instruction and the
+// state after it, a line only the instruction; writes carry memory
+// changed by untraced ones.
+typedef struct
+{
+    uint8_t kind;
+    uint8_t num_writes;
+    // Bytes used in output.
+    uint16_t len;
+    address_type pc;
+    address_type write_addr[ASYNC_TRACE_MAX_WRITES];
+    word_type write_value[ASYNC_TRACE_MAX_WRITES];
+    union
+    {
+        struct
+        {
+            bin_instr_t instr;
+            word_type regs[NUM_REGISTERS];
+            word_type hi;
+            word_type lo;
+        } step;
+        char output[ASYNC_TRACE_OUTPUT_SIZE];
+    };
+} trace_record;
+
+// Single producer, single consumer: only the interpreter advances head
+// and only the writer advances tail.
+static trace_record ring[ASYNC_TRACE_RING_SIZE];
+static _Atomic size_t ring_head = 0;
+static _Atomic size_t ring_tail = 0;
+
+// Memory as of the last record the writer handled.
+static word_type* shadow = NULL;
+
+// Where trace output really goes; stdout feeds the ring while running.
+static FILE* real_out = NULL;
+static FILE* ring_out = NULL;
+static pthread_t writer;
+static bool running = false;
+
+// Words the current instruction will write, reported by on_access.
+static address_type pending[ASYNC_TRACE_MAX_WRITES];
+static int num_pending = 0;
+
+static void (*chained_hook)(vm_access_kind kind, address_type addr) = NULL;
+
+// Pre-Condition: Called only by the interpreter.
+// Post-Condition: Returns the next free record, waiting for the writer if
+// the ring is full. It is not visible to the writer until publish.
+static trace_record* claim()
+{
+    size_t head = atomic_load_explicit(&ring_head, memory_order_relaxed);
+    while (head - atomic_load_explicit(&ring_tail, memory_order_acquire) == ASYNC_TRACE_RING_SIZE)
+    {
+        sched_yield();
+    }
+    return &ring[head & (ASYNC_TRACE_RING_SIZE - 1)];
+}
+
+static void publish()
+{
+    size_t head = atomic_load_explicit(&ring_head, memory_order_relaxed);
+    atomic_store_explicit(&ring_head, head + 1, memory_order_release);
+}
+
+// Pre-Condition: The instruction that reported the pending writes has run.
+// Post-Condition: Copies their addresses and new values into rec.
+static void take_writes(trace_record* rec)
+{
+    rec->num_writes = num_pending;
+    for (int i = 0; i < num_pending; i++)
+    {
+        rec->write_addr[i] = pending[i];
+        rec->write_value[i] = vm_memory->words[pending[i]];
+    }
+    num_pending = 0;
+}
+
+static void on_access(vm_access_kind kind, address_type addr)
+{
+    if (chained_hook != NULL) chained_hook(kind, addr);
+
+    if (kind == ACCESS_FETCH && num_pending > 0)
+    {
+        // The last instruction was not traced, but the writer's copy of
+        // memory must still see what it wrote.
+        trace_record* rec = claim();
+        rec->kind = RECORD_WRITES;
+        take_writes(rec);
+        publish();
+    }
+    else if (kind == ACCESS_WRITE)
+    {
+        if (num_pending == ASYNC_TRACE_MAX_WRITES)
+        {
+            bail_with_error("Instruction at PC %u writes more words than the trace can record!", PC);
+        }
+        pending[num_pending++] = addr;
+    }
+}
+
+static void on_trace(bin_instr_t instr, bool with_state)
+{
+    // Program output is unbuffered on its way into the ring, so it is
+    // already ahead of this record.
+    trace_record* rec = claim();
+    rec->kind = with_state ? RECORD_STEP : RECORD_LINE;
+    rec->pc = PC;
+    rec->step.instr = instr;
+    if (with_state)
+    {
+        memcpy(rec->step.regs, GPR, sizeof(rec->step.regs));
+        rec->step.hi = HI;
+        rec->step.lo = LO;
+    }
+    take_writes(rec);
+    publish();
+}
+
+// Pre-Condition: None.
+// Post-Condition: Queues size bytes written to stdout as output records.
+static ssize_t ring_write(void* cookie, const char* buf, size_t size)
+{
+    (void) cookie;
+    for (size_t done = 0; done < size; )
+    {
+        size_t len = size - done;
+        if (len > ASYNC_TRACE_OUTPUT_SIZE) len = ASYNC_TRACE_OUTPUT_SIZE;
+
+        trace_record* rec = claim();
+        rec->kind = RECORD_OUTPUT;
+        rec->num_writes = 0;
+        rec->len = len;
+        memcpy(rec->output, buf + done, len);
+        publish();
+        done += len;
+    }
+    return size;
+}
+
+// Pre-Condition: rec is the oldest record not yet handled.
+// Post-Condition: Updates the copy of memory and prints what rec calls
+// for. Returns false for the stop record.
+static bool handle(const trace_record* rec)
+{
+    for (int i = 0; i < rec->num_writes; i++)
+    {
+        shadow[rec->write_addr[i]] = rec->write_value[i];
+    }
+
+    switch (rec->kind)
+    {
+        case RECORD_STEP:
+        case RECORD_LINE:
+            // Only this thread formats instructions while the writer runs.
+            fprintf(real_out, "==>      %d: %s\n", rec->pc - 1,
+                    instruction_assembly_form(rec->pc - 1, rec->step.instr));
+            if (rec->kind == RECORD_STEP)
+            {
+                print_state_of(real_out, rec->pc, rec->step.regs, rec->step.hi, rec->step.lo, shadow);
+            }
+            return true;
+        case RECORD_OUTPUT:
+            fwrite(rec->output, 1, rec->len, real_out);
+            return true;
+        case RECORD_WRITES:
+            return true;
+        default:
+            return false;
+    }
+}
+
+static void* write_trace(void* arg)
+{
+    (void) arg;
+    int idle = 0;
+
+    while (true)
+    {
+        size_t tail = atomic_load_explicit(&ring_tail, memory_order_relaxed);
+        if (tail == atomic_load_explicit(&ring_head, memory_order_acquire))
+        {
+            // Caught up, so show what there is while waiting for more.
+            if (idle == 0) fflush(real_out);
+            if (idle < IDLE_SPINS)
+            {
+                idle++;
+                sched_yield();
+            }
+            else
+            {
+                struct timespec pause = { 0, IDLE_SLEEP_NS };
+                nanosleep(&pause, NULL);
+            }
+            continue;
+        }
+        idle = 0;
+
+        bool more = handle(&ring[tail & (ASYNC_TRACE_RING_SIZE - 1)]);
+        atomic_store_explicit(&ring_tail, tail + 1, memory_order_release);
+        if (!more) break;
+    }
+
+    fflush(real_out);
+    return NULL;
+}
+
+// Pre-Condition: async_trace_start has run. Registered with atexit, since
+// the program ends by exiting, and installed as vm_trace_finish.
+// Post-Condition: Waits for the writer to print everything queued and
+// points stdout back at the real output.
+static void async_trace_finish()
+{
+    if (!running) return;
+    running = false;
+
+    fflush(stdout);
+    trace_record* rec = claim();
+    rec->kind = RECORD_STOP;
+    rec->num_writes = 0;
+    publish();
+    pthread_join(writer, NULL);
+
+    stdout = real_out;
+    fclose(ring_out);
+    if (DEBUG) printf("DEBUG: async trace wrote %zu records\n", (size_t) ring_head);
+}
+
+void async_trace_start()
+{
+    shadow = malloc(sizeof(vm_memory->words));
+    if (shadow == NULL)
+    {
+        bail_with_error("Unable to allocate memory for the trace writer!");
+    }
+    memcpy(shadow, vm_memory->words, sizeof(vm_memory->words));
+
+    cookie_io_functions_t io = { NULL, ring_write, NULL, NULL };
+    ring_out = fopencookie(NULL, "w", io);
+    if (ring_out == NULL)
+    {
+        bail_with_error("Unable to open the trace ring as a stream!");
+    }
+    // Unbuffered, so output reaches the ring in order with the trace
+    // records and a prompt reaches the writer before input is read.
+    setvbuf(ring_out, NULL, _IONBF, 0);
+
+    fflush(stdout);
+    real_out = stdout;
+    if (pthread_create(&writer, NULL, write_trace, NULL) != 0)
+    {
+        bail_with_error("Unable to start the trace writer thread!");
+    }
+    stdout = ring_out;
+    running = true;
+    atexit(async_trace_finish);
+
+    chained_hook = vm_access_hook;
+    vm_access_hook = on_access;
+    vm_trace_hook = on_trace;
+    vm_trace_finish = async_trace_finish;
+}
@@ -0,0 +1,26 @@
+#ifndef _ASYNCTRACE_H
+#define _ASYNCTRACE_H
+
+// Records the ring holds before the interpreter waits for the writer.
+// Must be a power of two.
+#define ASYNC_TRACE_RING_SIZE 4096
+
+// Bytes of program output one record carries.
+#define ASYNC_TRACE_OUTPUT_SIZE 64
+
+// Most memory words one instruction writes.
+#define ASYNC_TRACE_MAX_WRITES 4
+
+// Pre-Condition: A program has been loaded, any other vm_access_hook has
+// been installed, and vm_run_program is about to run it with tracing on.
+// Post-Condition: Moves trace formatting to a writer thread. After each
+// traced instruction the interpreter only copies the instruction, the
+// registers and the words it wrote into a ring; the writer applies the
+// writes to its own copy of memory and prints what trace_instruction
+// would. Program output passes through the same ring, so standard output
+// is exactly what synchronous tracing writes. The ring is drained when
+// the process exits or before a fault is reported. Other messages on
+// standard error may show up ahead of trace output that precedes them.
+extern void async_trace_start();
+
+#endif
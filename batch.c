@@ -0,0 +1,934 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include "batch.h"
+#include "machine.h"
+#include "bof.h"
+#include "instruction.h"
+#include "utilities.h"
+
+#define DEBUG 0
+
+// One input's run. Lanes past the last input are dead from the start;
+// dead lanes keep executing with the others but their results are unused.
+typedef struct
+{
+    const char* name;
+    FILE* in;
+    FILE* out;
+    bool live;
+    vm_status status;
+    int exit_code;
+    char fault_message[256];
+    char* flight_record;
+} batch_lane;
+
+static batch_lane lanes[BATCH_LANES];
+static int num_live = 0;
+
+// Structure-of-arrays state: word a of lane l is lane_mem[a][l], so an
+// instruction whose addresses are the same in every lane touches one
+// contiguous row and its lane loop vectorizes.
+static word_type (*lane_mem)[BATCH_LANES] = NULL;
+static word_type lane_gpr[NUM_REGISTERS][BATCH_LANES];
+static word_type lane_hi[BATCH_LANES];
+static word_type lane_lo[BATCH_LANES];
+static address_type lane_pc;
+static bool lane_trace;
+
+// Bit r is set if GPR[r] is not the same in every lane.
+static unsigned int nonuniform_regs = 0;
+
+// Lanes that cannot run the current instruction in lockstep.
+static bool leaving[BATCH_LANES];
+static bool any_leaving = false;
+
+// Output of the part of the program that ran before any input was read.
+static FILE* prefix_out = NULL;
+static FILE* scalar_in = NULL;
+
+static int batch_read_char(void)
+{
+    return getc(scalar_in);
+}
+
+// Pre-Condition: None.
+// Post-Condition: Recomputes which registers differ between lanes.
+static void update_uniform(reg_num_type r)
+{
+    nonuniform_regs &= ~(1u << r);
+    for (int l = 1; l < BATCH_LANES; l++)
+    {
+        if (lane_gpr[r][l] != lane_gpr[r][0]) nonuniform_regs |= 1u << r;
+    }
+}
+
+// Pre-Condition: None.
+// Post-Condition: Marks every lane as leaving.
+static void split_all()
+{
+    for (int l = 0; l < BATCH_LANES; l++) leaving[l] = true;
+    any_leaving = true;
+}
+
+// Pre-Condition: None.
+// Post-Condition: Fills addr with GPR[r] + offset for each lane, marking
+// lanes whose address is outside memory as leaving.
+static void lane_address(reg_num_type r, int offset, int* addr)
+{
+    if ((nonuniform_regs & (1u << r)) == 0)
+    {
+        int a = lane_gpr[r][0] + offset;
+        for (int l = 0; l < BATCH_LANES; l++) addr[l] = a;
+        if (a < 0 || a >= MEMORY_SIZE_IN_WORDS) split_all();
+        return;
+    }
+
+    for (int l = 0; l < BATCH_LANES; l++)
+    {
+        addr[l] = lane_gpr[r][l] + offset;
+        if (addr[l] < 0 || addr[l] >= MEMORY_SIZE_IN_WORDS)
+        {
+            leaving[l] = true;
+            any_leaving = true;
+        }
+    }
+}
+
+// Pre-Condition: None.
+// Post-Condition: Returns true if the invariants hold in lane l once
+// register reg holds value.
+static bool lane_invariants_hold(int l, reg_num_type reg, word_type value)
+{
+    word_type gp = reg == GP ? value : lane_gpr[GP][l];
+    word_type sp = reg == SP ? value : lane_gpr[SP][l];
+    word_type fp = reg == FP ? value : lane_gpr[FP][l];
+    return 0 <= gp && gp < sp && sp <= fp && fp < MEMORY_SIZE_IN_WORDS;
+}
+
+// Pre-Condition: At least one lane is live.
+// Post-Condition: Returns the first live lane, which the others follow.
+static inline int first_live()
+{
+    int first = 0;
+    while (!lanes[first].live) first++;
+    return first;
+}
+
+// Pre-Condition: At least one lane is live.
+// Post-Condition: Marks lanes whose flag differs from the first live
+// lane's as leaving, so the rest can continue down the same path.
+static inline void split_divergent(const bool* flag)
+{
+    int first = first_live();
+    bool same = true;
+    for (int l = 0; l < BATCH_LANES; l++) same &= flag[l] == flag[first];
+    if (same) return;
+
+    for (int l = 0; l < BATCH_LANES; l++)
+    {
+        if (flag[l] != flag[first])
+        {
+            leaving[l] = true;
+            any_leaving = true;
+        }
+    }
+}
+
+// Pre-Condition: Lane l is live and lane_pc is the instruction it must
+// run next.
+// Post-Condition: Finishes lane l's run on the scalar engine.
+static void finish_scalar(int l)
+{
+    batch_lane* lane = &lanes[l];
+
+    for (int a = 0; a < MEMORY_SIZE_IN_WORDS; a++)
+    {
+        vm_memory->words[a] = lane_mem[a][l];
+    }
+    for (int r = 0; r < NUM_REGISTERS; r++)
+    {
+        GPR[r] = lane_gpr[r][l];
+    }
+    HI = lane_hi[l];
+    LO = lane_lo[l];
+    PC = lane_pc;
+    trace_program = lane_trace;
+
+    if (DEBUG) printf("DEBUG: lane %d leaves lockstep at PC %u\n", l, PC);
+
+    // The scalar engine writes to standard output, so point it at the lane.
+    fflush(lane->out);
+    fflush(stdout);
+    int saved_stdout = dup(STDOUT_FILENO);
+    dup2(fileno(lane->out), STDOUT_FILENO);
+    scalar_in = lane->in;
+
+    clear_flight_record();
+    lane->status = vm_run_for(ULLONG_MAX);
+    lane->exit_code = vm_exit_code;
+    if (lane->status == VM_FAULTED)
+    {
+        // Later lanes reuse the recorder, so keep this lane's record for
+        // when its fault is reported.
+        strcpy(lane->fault_message, vm_fault_message);
+        size_t record_len = 0;
+        FILE* record = open_memstream(&lane->flight_record, &record_len);
+        if (record != NULL)
+        {
+            print_flight_record(record);
+            fclose(record);
+        }
+    }
+
+    fflush(stdout);
+    dup2(saved_stdout, STDOUT_FILENO);
+    close(saved_stdout);
+
+    lane->live = false;
+    num_live--;
+}
+
+// Pre-Condition: Some lanes are marked leaving.
+// Post-Condition: Finishes the live ones on the scalar engine and gives
+// every leaving lane a copy of a live lane that is staying, so all lanes
+// agree again. Returns false if no live lane is left.
+static bool settle_leaving()
+{
+    int keep = -1;
+    for (int l = 0; l < BATCH_LANES; l++)
+    {
+        if (leaving[l] && lanes[l].live) finish_scalar(l);
+        else if (!leaving[l] && lanes[l].live && keep < 0) keep = l;
+    }
+
+    if (keep >= 0)
+    {
+        for (int l = 0; l < BATCH_LANES; l++)
+        {
+            if (!leaving[l]) continue;
+            for (int a = 0; a < MEMORY_SIZE_IN_WORDS; a++)
+            {
+                lane_mem[a][l] = lane_mem[a][keep];
+            }
+            for (int r = 0; r < NUM_REGISTERS; r++)
+            {
+                lane_gpr[r][l] = lane_gpr[r][keep];
+            }
+            lane_hi[l] = lane_hi[keep];
+            lane_lo[l] = lane_lo[keep];
+        }
+        for (int r = 0; r < NUM_REGISTERS; r++) update_uniform(r);
+    }
+
+    memset(leaving, 0, sizeof(leaving));
+    any_leaving = false;
+    return num_live > 0;
+}
+
+// Pre-Condition: Every addr is inside memory.
+// Post-Condition: Loads word addr[l] of each lane l into value. When every
+// lane uses the same address this is a single row copy.
+static inline void lane_load(const int* addr, bool uniform, uword_type* value)
+{
+    if (uniform)
+    {
+        memcpy(value, lane_mem[addr[0]], BATCH_LANES * sizeof(*value));
+        return;
+    }
+    for (int l = 0; l < BATCH_LANES; l++)
+    {
+        value[l] = lane_mem[addr[l]][l];
+    }
+}
+
+// Pre-Condition: Every addr is inside memory.
+// Post-Condition: Stores value[l] into word addr[l] of each lane l.
+static inline void lane_store(const int* addr, bool uniform, const uword_type* value)
+{
+    if (uniform)
+    {
+        memcpy(lane_mem[addr[0]], value, BATCH_LANES * sizeof(*value));
+        return;
+    }
+    for (int l = 0; l < BATCH_LANES; l++)
+    {
+        lane_mem[addr[l]][l] = value[l];
+    }
+}
+
+// Pre-Condition: None.
+// Post-Condition: Applies a two-operand computational instruction to every
+// lane. When every lane uses the same addresses this works row by row.
+static void lane_binop(func_type func, const int* dst, const int* top, const int* src, bool uniform)
+{
+    uword_type result[BATCH_LANES];
+    uword_type a[BATCH_LANES];
+    uword_type b[BATCH_LANES];
+
+    lane_load(top, uniform, a);
+    lane_load(src, uniform, b);
+
+    switch (func)
+    {
+        case ADD_F:
+            for (int l = 0; l < BATCH_LANES; l++) result[l] = a[l] + b[l];
+            break;
+        case SUB_F:
+            for (int l = 0; l < BATCH_LANES; l++) result[l] = a[l] - b[l];
+            break;
+        case AND_F:
+            for (int l = 0; l < BATCH_LANES; l++) result[l] = a[l] & b[l];
+            break;
+        case BOR_F:
+            for (int l = 0; l < BATCH_LANES; l++) result[l] = a[l] | b[l];
+            break;
+        case NOR_F:
+            for (int l = 0; l < BATCH_LANES; l++) result[l] = ~(a[l] | b[l]);
+            break;
+        default:
+            for (int l = 0; l < BATCH_LANES; l++) result[l] = a[l] ^ b[l];
+            break;
+    }
+
+    lane_store(dst, uniform, result);
+}
+
+// Pre-Condition: addr is inside memory in lane l.
+// Post-Condition: Prints the string at addr in lane l's memory to its
+// output and returns the number of characters printed.
+static int lane_print_str(int l, int addr)
+{
+    int printed = 0;
+    for (int a = addr; a < MEMORY_SIZE_IN_WORDS; a++)
+    {
+        char bytes[sizeof(word_type)];
+        memcpy(bytes, &lane_mem[a][l], sizeof(bytes));
+        for (int i = 0; i < (int) sizeof(bytes); i++)
+        {
+            if (bytes[i] == '\0') return printed;
+            fputc(bytes[i], lanes[l].out);
+            printed++;
+        }
+    }
+    return printed;
+}
+
+#define UNIFORM(r) ((nonuniform_regs & (1u << (r))) == 0)
+#define LANES for (int l = 0; l < BATCH_LANES; l++)
+
+// Pre-Condition: All lanes agree on lane_pc.
+// Post-Condition: Runs the instruction at lane_pc in every lane, or splits
+// off the lanes that cannot run it in lockstep, leaving lane_pc alone so
+// the rest retry it. Returns false once lockstep is over.
+static bool lane_step()
+{
+    address_type pc = lane_pc;
+    address_type next = pc + 1;
+    int dst[BATCH_LANES];
+    int top[BATCH_LANES];
+    int src[BATCH_LANES];
+    bool flag[BATCH_LANES];
+
+    // Tracing is only done by the scalar engine.
+    if (lane_trace || pc >= num_instrs)
+    {
+        split_all();
+        return settle_leaving();
+    }
+
+    // The program may have stored into its own text differently per lane.
+    int lead = first_live();
+    bin_instr_t instr;
+    memcpy(&instr, &lane_mem[pc][lead], sizeof(instr));
+    bool same = true;
+    LANES same &= lane_mem[pc][l] == lane_mem[pc][lead];
+    if (!same)
+    {
+        LANES flag[l] = lane_mem[pc][l] != lane_mem[pc][lead];
+        split_divergent(flag);
+        return settle_leaving();
+    }
+
+    switch (instruction_type(instr))
+    {
+        case comp_instr_type:
+        {
+            reg_num_type t = instr.comp.rt;
+            reg_num_type s = instr.comp.rs;
+            int ot = machine_types_formOffset(instr.comp.ot);
+            int os = machine_types_formOffset(instr.comp.os);
+            bool uniform = UNIFORM(t) && UNIFORM(s) && UNIFORM(SP);
+
+            switch (instr.comp.func)
+            {
+                case NOP_F:
+                    break;
+
+                case ADD_F:
+                case SUB_F:
+                case AND_F:
+                case BOR_F:
+                case NOR_F:
+                case XOR_F:
+                    lane_address(t, ot, dst);
+                    lane_address(SP, 0, top);
+                    lane_address(s, os, src);
+                    if (any_leaving) return settle_leaving();
+                    lane_binop(instr.comp.func, dst, top, src, uniform);
+                    break;
+
+                case CPW_F:
+                case NEG_F:
+                    lane_address(t, ot, dst);
+                    lane_address(s, os, src);
+                    if (any_leaving) return settle_leaving();
+                    if (instr.comp.func == CPW_F)
+                    {
+                        LANES lane_mem[dst[l]][l] = lane_mem[src[l]][l];
+                    }
+                    else
+                    {
+                        LANES lane_mem[dst[l]][l] = -lane_mem[src[l]][l];
+                    }
+                    break;
+
+                case LWR_F:
+                    lane_address(s, os, src);
+                    if (any_leaving) return settle_leaving();
+                    LANES flag[l] = !lane_invariants_hold(l, t, lane_mem[src[l]][l]);
+                    LANES if (flag[l]) { leaving[l] = true; any_leaving = true; }
+                    if (any_leaving) return settle_leaving();
+                    LANES lane_gpr[t][l] = lane_mem[src[l]][l];
+                    update_uniform(t);
+                    break;
+
+                case SWR_F:
+                case SCA_F:
+                    lane_address(t, ot, dst);
+                    if (any_leaving) return settle_leaving();
+                    if (instr.comp.func == SWR_F)
+                    {
+                        LANES lane_mem[dst[l]][l] = lane_gpr[s][l];
+                    }
+                    else
+                    {
+                        LANES lane_mem[dst[l]][l] = lane_gpr[s][l] + os;
+                    }
+                    break;
+
+                case LWI_F:
+                    lane_address(t, ot, dst);
+                    lane_address(s, os, src);
+                    if (any_leaving) return settle_leaving();
+                    LANES
+                    {
+                        word_type a = lane_mem[src[l]][l];
+                        if (a < 0 || a >= MEMORY_SIZE_IN_WORDS) { leaving[l] = true; any_leaving = true; }
+                    }
+                    if (any_leaving) return settle_leaving();
+                    LANES lane_mem[dst[l]][l] = lane_mem[lane_mem[src[l]][l]][l];
+                    break;
+
+                default:
+                    // Let the scalar engine report the invalid encoding.
+                    split_all();
+                    return settle_leaving();
+            }
+            break;
+        }
+
+        case other_comp_instr_type:
+        {
+            reg_num_type reg = instr.othc.reg;
+            int offset = machine_types_formOffset(instr.othc.offset);
+            word_type arg = machine_types_sgnExt(instr.othc.arg);
+
+            switch (instr.othc.func)
+            {
+                case LIT_F:
+                case CFHI_F:
+                case CFLO_F:
+                    lane_address(reg, offset, dst);
+                    if (any_leaving) return settle_leaving();
+                    if (instr.othc.func == LIT_F && UNIFORM(reg))
+                    {
+                        LANES lane_mem[dst[0]][l] = arg;
+                    }
+                    else if (instr.othc.func == LIT_F)
+                    {
+                        LANES lane_mem[dst[l]][l] = arg;
+                    }
+                    else if (instr.othc.func == CFHI_F)
+                    {
+                        LANES lane_mem[dst[l]][l] = lane_hi[l];
+                    }
+                    else
+                    {
+                        LANES lane_mem[dst[l]][l] = lane_lo[l];
+                    }
+                    break;
+
+                case ARI_F:
+                case SRI_F:
+                    if (instr.othc.func == SRI_F) arg = -arg;
+                    LANES flag[l] = !lane_invariants_hold(l, reg, lane_gpr[reg][l] + arg);
+                    LANES if (flag[l]) { leaving[l] = true; any_leaving = true; }
+                    if (any_leaving) return settle_leaving();
+                    LANES lane_gpr[reg][l] += arg;
+                    break;
+
+                case MUL_F:
+                case DIV_F:
+                    lane_address(SP, 0, top);
+                    lane_address(reg, offset, src);
+                    if (any_leaving) return settle_leaving();
+                    if (instr.othc.func == MUL_F)
+                    {
+                        LANES
+                        {
+                            // Same expression as the scalar engine, so results match.
+                            long long int res = lane_mem[top[l]][l] * lane_mem[src[l]][l];
+                            lane_lo[l] = res & 0xFFFFFFFF;
+                            lane_hi[l] = res >> 32;
+                        }
+                        break;
+                    }
+                    LANES if (lane_mem[src[l]][l] == 0) { leaving[l] = true; any_leaving = true; }
+                    if (any_leaving) return settle_leaving();
+                    LANES
+                    {
+                        lane_lo[l] = lane_mem[top[l]][l] / lane_mem[src[l]][l];
+                        lane_hi[l] = lane_mem[top[l]][l] % lane_mem[src[l]][l];
+                    }
+                    break;
+
+                case SLL_F:
+                case SRL_F:
+                    lane_address(reg, offset, dst);
+                    lane_address(SP, 0, top);
+                    if (any_leaving) return settle_leaving();
+                    if (instr.othc.func == SLL_F)
+                    {
+                        LANES lane_mem[dst[l]][l] = (uword_type) lane_mem[top[l]][l] << instr.othc.arg;
+                    }
+                    else
+                    {
+                        LANES lane_mem[dst[l]][l] = (uword_type) lane_mem[top[l]][l] >> instr.othc.arg;
+                    }
+                    break;
+
+                case JMP_F:
+                case CSI_F:
+                    lane_address(reg, offset, src);
+                    if (any_leaving) return settle_leaving();
+                    LANES flag[l] = lane_mem[src[l]][l] != lane_mem[src[lead]][lead];
+                    split_divergent(flag);
+                    if (any_leaving) return settle_leaving();
+                    next = lane_mem[src[lead]][lead];
+                    if (next >= MEMORY_SIZE_IN_WORDS)
+                    {
+                        split_all();
+                        return settle_leaving();
+                    }
+                    if (instr.othc.func == CSI_F)
+                    {
+                        LANES lane_gpr[RA][l] = pc + 1;
+                        update_uniform(RA);
+                    }
+                    break;
+
+                case JREL_F:
+                    next = pc + machine_types_formOffset(instr.othc.arg);
+                    if (next >= MEMORY_SIZE_IN_WORDS)
+                    {
+                        split_all();
+                        return settle_leaving();
+                    }
+                    break;
+
+                default:
+                    split_all();
+                    return settle_leaving();
+            }
+            break;
+        }
+
+        case immed_instr_type:
+        {
+            reg_num_type reg = instr.immed.reg;
+            int offset = machine_types_formOffset(instr.immed.offset);
+            uword_type immediate = instr.immed.immed & 0xffff;
+
+            uword_type value[BATCH_LANES];
+
+            lane_address(reg, offset, dst);
+            if (any_leaving) return settle_leaving();
+            lane_load(dst, UNIFORM(reg), value);
+
+            switch (instr.immed.op)
+            {
+                case ADDI_O:
+                {
+                    uword_type k = machine_types_sgnExt(immediate);
+                    LANES value[l] += k;
+                    lane_store(dst, UNIFORM(reg), value);
+                    break;
+                }
+
+                case ANDI_O:
+                case BORI_O:
+                case XORI_O:
+                {
+                    uword_type k = machine_types_zeroExt(immediate);
+                    if (instr.immed.op == ANDI_O)
+                    {
+                        LANES value[l] &= k;
+                    }
+                    else if (instr.immed.op == BORI_O)
+                    {
+                        LANES value[l] |= k;
+                    }
+                    else
+                    {
+                        LANES value[l] ^= k;
+                    }
+                    lane_store(dst, UNIFORM(reg), value);
+                    break;
+                }
+
+                case BEQ_O:
+                case BNE_O:
+                {
+                    uword_type stack_top[BATCH_LANES];
+                    lane_address(SP, 0, top);
+                    if (any_leaving) return settle_leaving();
+                    lane_load(top, UNIFORM(SP), stack_top);
+                    bool equal = instr.immed.op == BEQ_O;
+                    LANES flag[l] = (stack_top[l] == value[l]) == equal;
+                    goto branch;
+                }
+
+                case BGEZ_O:
+                    LANES flag[l] = (word_type) value[l] >= 0;
+                    goto branch;
+
+                case BGTZ_O:
+                    LANES flag[l] = (word_type) value[l] > 0;
+                    goto branch;
+
+                case BLEZ_O:
+                    LANES flag[l] = (word_type) value[l] <= 0;
+                    goto branch;
+
+                case BLTZ_O:
+                    LANES flag[l] = (word_type) value[l] < 0;
+                branch:
+                    split_divergent(flag);
+                    if (any_leaving) return settle_leaving();
+                    if (flag[lead]) next = pc + machine_types_formOffset(immediate);
+                    if (next >= MEMORY_SIZE_IN_WORDS)
+                    {
+                        split_all();
+                        return settle_leaving();
+                    }
+                    break;
+
+                default:
+                    split_all();
+                    return settle_leaving();
+            }
+            break;
+        }
+
+        case jump_instr_type:
+            switch (instr.jump.op)
+            {
+                case JMPA_O:
+                    next = machine_types_formAddress(pc, instr.jump.addr);
+                    break;
+
+                case CALL_O:
+                    LANES lane_gpr[RA][l] = pc + 1;
+                    update_uniform(RA);
+                    next = machine_types_formAddress(pc, instr.jump.addr);
+                    break;
+
+                case RTN_O:
+                    if (!UNIFORM(RA))
+                    {
+                        LANES flag[l] = lane_gpr[RA][l] != lane_gpr[RA][lead];
+                        split_divergent(flag);
+                        return settle_leaving();
+                    }
+                    next = lane_gpr[RA][lead];
+                    if (next >= MEMORY_SIZE_IN_WORDS)
+                    {
+                        split_all();
+                        return settle_leaving();
+                    }
+                    break;
+
+                default:
+                    split_all();
+                    return settle_leaving();
+            }
+            break;
+
+        case syscall_instr_type:
+        {
+            reg_num_type r = instr.syscall.reg;
+            int o = machine_types_formOffset(instr.syscall.offset);
+
+            if (instr.syscall.code == BREAKPOINT_SC)
+            {
+                split_all();
+                return settle_leaving();
+            }
+
+            switch (instruction_syscall_number(instr))
+            {
+                case exit_sc:
+                    LANES
+                    {
+                        if (!lanes[l].live) continue;
+                        lanes[l].status = VM_EXITED;
+                        lanes[l].exit_code = machine_types_sgnExt(instr.syscall.offset);
+                        lanes[l].live = false;
+                    }
+                    num_live = 0;
+                    return false;
+
+                case print_str_sc:
+                case print_char_sc:
+                    lane_address(r, o, src);
+                    lane_address(SP, 0, top);
+                    if (any_leaving) return settle_leaving();
+                    LANES
+                    {
+                        if (!lanes[l].live) continue;
+                        if (instruction_syscall_number(instr) == print_str_sc)
+                        {
+                            lane_mem[top[l]][l] = lane_print_str(l, src[l]);
+                        }
+                        else
+                        {
+                            lane_mem[top[l]][l] = fputc(lane_mem[src[l]][l], lanes[l].out);
+                        }
+                    }
+                    break;
+
+                case read_char_sc:
+                    lane_address(r, o, dst);
+                    if (any_leaving) return settle_leaving();
+                    LANES
+                    {
+                        lane_mem[dst[l]][l] = lanes[l].live ? getc(lanes[l].in) : EOF;
+                    }
+                    break;
+
+                case stop_tracing_sc:
+                    LANES
+                    {
+                        if (!lanes[l].live) continue;
+                        fprintf(lanes[l].out, "==>      %d: %s\n", pc, instruction_assembly_form(pc, instr));
+                    }
+                    break;
+
+                default:
+                    // Tracing (and invalid codes) are left to the scalar engine.
+                    split_all();
+                    return settle_leaving();
+            }
+            break;
+        }
+
+        default:
+            split_all();
+            return settle_leaving();
+    }
+
+    if (vm_coverage_hook != NULL) vm_coverage_hook(pc, pc, next);
+    lane_pc = next;
+    return true;
+}
+
+// Pre-Condition: start holds the state every lane begins in.
+// Post-Condition: Runs up to BATCH_LANES inputs from start in lockstep.
+static void run_lanes(const vm_context* start, int num_inputs, char* inputs[])
+{
+    for (int a = 0; a < MEMORY_SIZE_IN_WORDS; a++)
+    {
+        for (int l = 0; l < BATCH_LANES; l++)
+        {
+            lane_mem[a][l] = start->mem->words[a];
+        }
+    }
+    for (int r = 0; r < NUM_REGISTERS; r++)
+    {
+        for (int l = 0; l < BATCH_LANES; l++)
+        {
+            lane_gpr[r][l] = start->GPR[r];
+        }
+    }
+    for (int l = 0; l < BATCH_LANES; l++)
+    {
+        lane_hi[l] = start->HI;
+        lane_lo[l] = start->LO;
+    }
+    lane_pc = start->PC;
+    lane_trace = start->trace_program;
+    nonuniform_regs = 0;
+
+    num_live = 0;
+    for (int l = 0; l < BATCH_LANES; l++)
+    {
+        batch_lane* lane = &lanes[l];
+        memset(lane, 0, sizeof(*lane));
+        if (l >= num_inputs) continue;
+
+        lane->name = inputs[l];
+        lane->in = fopen(inputs[l], "r");
+        if (lane->in == NULL)
+        {
+            bail_with_error("Unable to open input file %s!", inputs[l]);
+        }
+        lane->out = tmpfile();
+        if (lane->out == NULL)
+        {
+            bail_with_error("Unable to create an output buffer for %s!", inputs[l]);
+        }
+        lane->live = true;
+        num_live++;
+    }
+
+    while (lane_step())
+    {
+    }
+}
+
+// Pre-Condition: from is open for reading and writing.
+// Post-Condition: Copies everything written to from onto standard output.
+static void copy_output(FILE* from)
+{
+    char buf[4096];
+    size_t n;
+
+    fflush(from);
+    rewind(from);
+    while ((n = fread(buf, 1, sizeof(buf), from)) > 0)
+    {
+        fwrite(buf, 1, n, stdout);
+    }
+}
+
+// Pre-Condition: A program has been loaded and has not run yet.
+// Post-Condition: Runs the program on the scalar engine, with output going
+// to prefix_out, until it would read input with tracing off. Until then
+// every lane would do exactly the same thing. Returns the status.
+static vm_status run_prefix()
+{
+    prefix_out = tmpfile();
+    if (prefix_out == NULL)
+    {
+        bail_with_error("Unable to create an output buffer!");
+    }
+
+    fflush(stdout);
+    int saved_stdout = dup(STDOUT_FILENO);
+    dup2(fileno(prefix_out), STDOUT_FILENO);
+
+    if (trace_program) print_state();
+    vm_status status = VM_YIELDED;
+    while (status == VM_YIELDED && trace_program && PC < num_instrs
+           && !(instruction_type(vm_memory->instrs[PC]) == syscall_instr_type
+                && instruction_syscall_number(vm_memory->instrs[PC]) == read_char_sc))
+    {
+        status = vm_run_for(1);
+    }
+
+    fflush(stdout);
+    dup2(saved_stdout, STDOUT_FILENO);
+    close(saved_stdout);
+    return status;
+}
+
+int batch_run(const char* bof_name, int num_inputs, char* inputs[])
+{
+    BOFFILE bof = bof_read_open(bof_name);
+    load_bof(bof);
+    bof_close(bof);
+
+    lane_mem = aligned_alloc(64, MEMORY_SIZE_IN_WORDS * sizeof(*lane_mem));
+    if (lane_mem == NULL)
+    {
+        bail_with_error("Unable to allocate memory for %d lanes!", BATCH_LANES);
+    }
+
+    vm_status prefix_status = run_prefix();
+
+    vm_context start;
+    start.mem = NULL;
+    vm_save_context(&start);
+
+    int (*previous_reader)(void) = vm_read_char;
+    vm_read_char = batch_read_char;
+
+    int result = EXIT_SUCCESS;
+    for (int first = 0; first < num_inputs; first += BATCH_LANES)
+    {
+        int count = num_inputs - first;
+        if (count > BATCH_LANES) count = BATCH_LANES;
+
+        if (prefix_status == VM_YIELDED)
+        {
+            run_lanes(&start, count, &inputs[first]);
+        }
+
+        for (int l = 0; l < count; l++)
+        {
+            batch_lane* lane = &lanes[l];
+            copy_output(prefix_out);
+            if (prefix_status != VM_YIELDED)
+            {
+                lane->status = prefix_status;
+                lane->exit_code = vm_exit_code;
+                strcpy(lane->fault_message, vm_fault_message);
+            }
+            else
+            {
+                copy_output(lane->out);
+                fclose(lane->out);
+                fclose(lane->in);
+            }
+            fflush(stdout);
+
+            if (lane->status == VM_FAULTED)
+            {
+                // No lane ran after a faulting prefix, so the recorder
+                // still holds it.
+                if (prefix_status == VM_FAULTED && first + l == 0) print_flight_record(stderr);
+                if (lane->flight_record != NULL)
+                {
+                    fputs(lane->flight_record, stderr);
+                    free(lane->flight_record);
+                    lane->flight_record = NULL;
+                }
+                fprintf(stderr, "%s: %s\n", inputs[first + l], lane->fault_message);
+                result = EXIT_FAILURE;
+            }
+            else if (lane->exit_code != 0)
+            {
+                result = EXIT_FAILURE;
+            }
+        }
+    }
+
+    vm_read_char = previous_reader;
+    fclose(prefix_out);
+    free(start.mem);
+    free(lane_mem);
+    return result;
+}
@@ -0,0 +1,22 @@
+#ifndef _BATCH_H
+#define _BATCH_H
+
+// Number of instances run in lockstep, one per SIMD lane.
+#define BATCH_LANES 8
+
+// Pre-Condition: bof_name names a valid binary object file and inputs
+// names num_inputs readable files.
+// Post-Condition: Runs the program once per input file like -r does, but
+// BATCH_LANES inputs at a time in lockstep: each instruction is decoded
+// once and applied to every lane, with registers and memory laid out as
+// structure-of-arrays. A lane that branches or jumps away from the others,
+// or is about to fault, is split off and finished on the scalar engine;
+// split lanes never rejoin, so inputs that send the program down
+// different paths early gain little. Traced instructions run on the
+// scalar engine: the traced start of the program runs once and its output
+// is repeated for every input, and lanes still traced when they first
+// read input run one at a time. Each input's output is written to standard output in input order.
+// Returns EXIT_FAILURE if any run did not exit with code 0.
+extern int batch_run(const char* bof_name, int num_inputs, char* inputs[]);
+
+#endif
@@ -0,0 +1,443 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include "bench.h"
+#include "machine.h"
+#include "instruction.h"
+#include "builder.h"
+#include "utilities.h"
+
+#define DEBUG 0
+
+// Most repetitions of one workload.
+#define MAX_BENCH_REPS 100
+
+// One timed run of a workload, measured in its own process.
+typedef struct
+{
+    bool ok;
+    unsigned long long instrs;
+    double startup_us;
+    double run_s;
+    long rss_kb;
+} bench_sample;
+
+typedef struct
+{
+    const char* name;
+    void (*build)(bof_builder* b);
+} bench_workload;
+
+// Pre-Condition: No data has been added to b yet.
+// Post-Condition: Adds count zeroed globals with global 0, the loop
+// counter, set to iterations.
+static void add_globals(bof_builder* b, unsigned int count, word_type iterations)
+{
+    builder_reserve(b, count);
+    builder_set_word(b, BUILDER_DEFAULT_DATA_START, iterations);
+}
+
+static void set_global(bof_builder* b, unsigned int index, word_type value)
+{
+    builder_set_word(b, BUILDER_DEFAULT_DATA_START + index, value);
+}
+
+// Pre-Condition: The loop counter is global 0.
+// Post-Condition: Emits the end of a loop back to top and the exit.
+static void end_loop(bof_builder* b, bof_label top)
+{
+    builder_immed(b, ADDI_O, GP, 0, -1);
+    builder_branch(b, BGTZ_O, GP, 0, top);
+    builder_syscall(b, exit_sc, 0, 0);
+}
+
+// Adds, logic and compares on globals in a tight loop.
+static void build_arith(bof_builder* b)
+{
+    add_globals(b, 8, BENCH_TARGET_INSTRS / 8);
+    set_global(b, 1, 3);
+
+    bof_label top = builder_new_label(b);
+    builder_place_label(b, top);
+    builder_immed(b, ADDI_O, GP, 2, 7);
+    builder_immed(b, XORI_O, GP, 3, 0x5a5a);
+    builder_comp(b, ADD_F, GP, 4, GP, 2);
+    builder_comp(b, SUB_F, GP, 5, GP, 1);
+    builder_immed(b, ANDI_O, GP, 3, 0x7fff);
+    builder_comp(b, CPW_F, GP, 6, GP, 4);
+    end_loop(b, top);
+}
+
+// Calls a routine that recurses to a fixed depth, saving its return
+// address and argument on the stack in each frame.
+static void build_recursion(bof_builder* b)
+{
+    const int depth = 1000;
+    add_globals(b, 2, BENCH_TARGET_INSTRS / (9 * depth));
+    set_global(b, 1, depth);
+
+    bof_label top = builder_new_label(b);
+    bof_label routine = builder_new_label(b);
+    bof_label done = builder_new_label(b);
+
+    builder_place_label(b, top);
+    builder_comp(b, CPW_F, SP, 0, GP, 1);
+    builder_jump_to(b, CALL_O, routine);
+    end_loop(b, top);
+
+    // The argument is on top of the stack.
+    builder_place_label(b, routine);
+    builder_branch(b, BLEZ_O, SP, 0, done);
+    builder_othc(b, SRI_F, SP, 0, 2);
+    builder_comp(b, SWR_F, SP, 1, RA, 0);
+    builder_comp(b, CPW_F, SP, 0, SP, 2);
+    builder_immed(b, ADDI_O, SP, 0, -1);
+    builder_jump_to(b, CALL_O, routine);
+    builder_comp(b, LWR_F, RA, 0, SP, 1);
+    builder_othc(b, ARI_F, SP, 0, 2);
+    builder_place_label(b, done);
+    builder_jump(b, RTN_O, 0);
+}
+
+// Evaluates (a + b) * (d - c) by pushing operands and combining the top
+// of the stack, as compiled expressions do.
+static void build_stack(bof_builder* b)
+{
+    add_globals(b, 8, BENCH_TARGET_INSTRS / 20);
+    set_global(b, 1, 11);
+    set_global(b, 2, 22);
+    set_global(b, 3, 5);
+    set_global(b, 4, 9);
+
+    bof_label top = builder_new_label(b);
+    builder_place_label(b, top);
+    builder_othc(b, SRI_F, SP, 0, 1);
+    builder_comp(b, CPW_F, SP, 0, GP, 1);
+    builder_othc(b, SRI_F, SP, 0, 1);
+    builder_comp(b, CPW_F, SP, 0, GP, 2);
+    builder_comp(b, ADD_F, SP, 1, SP, 1);
+    builder_othc(b, ARI_F, SP, 0, 1);
+    builder_othc(b, SRI_F, SP, 0, 1);
+    builder_comp(b, CPW_F, SP, 0, GP, 3);
+    builder_othc(b, SRI_F, SP, 0, 1);
+    builder_comp(b, CPW_F, SP, 0, GP, 4);
+    builder_comp(b, SUB_F, SP, 1, SP, 1);
+    builder_othc(b, ARI_F, SP, 0, 1);
+    builder_othc(b, MUL_F, SP, 1, 0);
+    builder_othc(b, CFLO_F, SP, 1, 0);
+    builder_othc(b, ARI_F, SP, 0, 1);
+    builder_comp(b, CPW_F, GP, 5, SP, 0);
+    builder_othc(b, ARI_F, SP, 0, 1);
+    end_loop(b, top);
+}
+
+// Multiplies and divides the top of the stack by globals.
+static void build_muldiv(bof_builder* b)
+{
+    add_globals(b, 8, BENCH_TARGET_INSTRS / 10);
+    set_global(b, 1, 12345);
+    set_global(b, 3, 7);
+
+    builder_othc(b, LIT_F, SP, 0, 1000);
+    bof_label top = builder_new_label(b);
+    builder_place_label(b, top);
+    builder_othc(b, MUL_F, GP, 1, 0);
+    builder_othc(b, CFLO_F, GP, 2, 0);
+    builder_othc(b, CFHI_F, GP, 6, 0);
+    builder_othc(b, DIV_F, GP, 3, 0);
+    builder_othc(b, CFLO_F, GP, 4, 0);
+    builder_othc(b, CFHI_F, GP, 5, 0);
+    builder_othc(b, MUL_F, GP, 3, 0);
+    builder_othc(b, DIV_F, GP, 1, 0);
+    end_loop(b, top);
+}
+
+// Writes lines of characters.
+static void build_output(bof_builder* b)
+{
+    add_globals(b, 4, BENCH_TARGET_INSTRS / 10);
+    set_global(b, 1, 'x');
+    set_global(b, 2, '\n');
+
+    bof_label top = builder_new_label(b);
+    builder_place_label(b, top);
+    for (int i = 0; i < 7; i++)
+    {
+        builder_syscall(b, print_char_sc, GP, 1);
+    }
+    builder_syscall(b, print_char_sc, GP, 2);
+    end_loop(b, top);
+}
+
+// Sums a large global array through a pointer held in memory.
+static void build_globals(bof_builder* b)
+{
+    const int words = 16384;
+    add_globals(b, 8, BENCH_TARGET_INSTRS / (5 * words + 4));
+    address_type base = builder_reserve(b, words);
+    set_global(b, 4, base);
+    set_global(b, 5, words);
+    for (int i = 0; i < words; i++)
+    {
+        builder_set_word(b, base + i, i * 7 + 1);
+    }
+
+    bof_label top = builder_new_label(b);
+    bof_label inner = builder_new_label(b);
+    builder_place_label(b, top);
+    builder_comp(b, CPW_F, GP, 1, GP, 4);
+    builder_comp(b, CPW_F, GP, 2, GP, 5);
+    builder_place_label(b, inner);
+    builder_comp(b, LWI_F, SP, 0, GP, 1);
+    builder_comp(b, ADD_F, GP, 3, GP, 3);
+    builder_immed(b, ADDI_O, GP, 1, 1);
+    builder_immed(b, ADDI_O, GP, 2, -1);
+    builder_branch(b, BGTZ_O, GP, 2, inner);
+    end_loop(b, top);
+}
+
+static const bench_workload workloads[] =
+{
+    { "arith", build_arith },
+    { "recursion", build_recursion },
+    { "stack", build_stack },
+    { "muldiv", build_muldiv },
+    { "output", build_output },
+    { "globals", build_globals },
+};
+
+#define NUM_WORKLOADS (sizeof(workloads) / sizeof(workloads[0]))
+
+// Pre-Condition: None.
+// Post-Condition: Returns the monotonic clock in seconds.
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Pre-Condition: path names a workload BOF.
+// Post-Condition: Loads and runs it untraced in a child process with its
+// output discarded, and returns what the run measured.
+static bench_sample run_once(const char* path)
+{
+    bench_sample sample;
+    memset(&sample, 0, sizeof(sample));
+
+    int fds[2];
+    if (pipe(fds) != 0)
+    {
+        bail_with_error("Unable to create a pipe for a benchmark run!");
+    }
+
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid < 0)
+    {
+        bail_with_error("Unable to start a benchmark run: %s", strerror(errno));
+    }
+
+    if (pid == 0)
+    {
+        close(fds[0]);
+        if (freopen("/dev/null", "w", stdout) == NULL) _exit(EXIT_FAILURE);
+
+        double start = now();
+        BOFFILE bof = bof_read_open(path);
+        load_bof(bof);
+        bof_close(bof);
+        double loaded = now();
+
+        trace_program = false;
+        vm_status status = vm_run_for(ULLONG_MAX);
+        fflush(stdout);
+        double done = now();
+
+        sample.ok = status == VM_EXITED && vm_exit_code == 0;
+        sample.instrs = vm_instr_count;
+        sample.startup_us = (loaded - start) * 1e6;
+        sample.run_s = done - loaded;
+        _exit(write(fds[1], &sample, sizeof(sample)) == sizeof(sample) ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+
+    close(fds[1]);
+    bool got = read(fds[0], &sample, sizeof(sample)) == sizeof(sample);
+    close(fds[0]);
+
+    int status;
+    struct rusage usage;
+    if (wait4(pid, &status, 0, &usage) != pid || !got || !WIFEXITED(status)
+        || WEXITSTATUS(status) != EXIT_SUCCESS)
+    {
+        sample.ok = false;
+    }
+    sample.rss_kb = usage.ru_maxrss;
+    return sample;
+}
+
+static int compare_doubles(const void* a, const void* b)
+{
+    double x = *(const double*) a, y = *(const double*) b;
+    return (x > y) - (x < y);
+}
+
+// Pre-Condition: n > 0.
+// Post-Condition: Sorts values and returns their median.
+static double median(double* values, int n)
+{
+    qsort(values, n, sizeof(double), compare_doubles);
+    return n % 2 == 1 ? values[n / 2] : (values[n / 2 - 1] + values[n / 2]) / 2;
+}
+
+// Pre-Condition: text is a baseline file written by bench_run.
+// Post-Condition: Finds key in the entry for the named workload. Returns
+// false if there is none.
+static bool baseline_value(const char* text, const char* name, const char* key, double* value)
+{
+    char pattern[128];
+    snprintf(pattern, sizeof(pattern), "\"name\": \"%s\"", name);
+    const char* entry = strstr(text, pattern);
+    if (entry == NULL) return false;
+
+    const char* end = strchr(entry, '}');
+    snprintf(pattern, sizeof(pattern), "\"%s\":", key);
+    const char* field = strstr(entry, pattern);
+    if (field == NULL || (end != NULL && field > end)) return false;
+
+    *value = strtod(field + strlen(pattern), NULL);
+    return true;
+}
+
+// Pre-Condition: None.
+// Post-Condition: Returns the contents of path in a malloc'd string.
+static char* read_text(const char* path)
+{
+    FILE* f = fopen(path, "r");
+    if (f == NULL)
+    {
+        bail_with_error("Unable to open benchmark baseline %s!", path);
+    }
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    rewind(f);
+
+    char* text = malloc(size + 1);
+    if (text == NULL || fread(text, 1, size, f) != (size_t) size)
+    {
+        bail_with_error("Unable to read benchmark baseline %s!", path);
+    }
+    text[size] = '\0';
+    fclose(f);
+    return text;
+}
+
+int bench_run(int reps, const char* baseline, const char* save)
+{
+    if (reps < 1) reps = 1;
+    if (reps > MAX_BENCH_REPS) reps = MAX_BENCH_REPS;
+
+    char* base_text = baseline != NULL ? read_text(baseline) : NULL;
+    FILE* json = NULL;
+    if (save != NULL && (json = fopen(save, "w")) == NULL)
+    {
+        bail_with_error("Unable to create benchmark results file %s!", save);
+    }
+    if (json != NULL) fprintf(json, "{\n  \"version\": 1,\n  \"reps\": %d,\n  \"workloads\": [", reps);
+
+    char path[] = "/tmp/srm-bench-XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0)
+    {
+        bail_with_error("Unable to create a temporary benchmark file!");
+    }
+    close(fd);
+
+    printf("%-10s %12s %10s %10s %8s %11s %9s %9s\n", "Workload", "Instrs", "MIPS",
+           "Min MIPS", "Stddev", "Startup us", "RSS KB", "vs base");
+
+    int result = EXIT_SUCCESS;
+    for (size_t w = 0; w < NUM_WORKLOADS; w++)
+    {
+        bof_builder* b = builder_create();
+        workloads[w].build(b);
+        builder_write(b, path);
+        builder_free(b);
+
+        double mips[MAX_BENCH_REPS], startup[MAX_BENCH_REPS];
+        long rss = 0;
+        unsigned long long instrs = 0;
+        bool ok = true;
+
+        for (int r = 0; r < reps; r++)
+        {
+            bench_sample sample = run_once(path);
+            ok = ok && sample.ok;
+            instrs = sample.instrs;
+            mips[r] = sample.run_s > 0 ? sample.instrs / sample.run_s / 1e6 : 0;
+            startup[r] = sample.startup_us;
+            if (sample.rss_kb > rss) rss = sample.rss_kb;
+        }
+
+        double mean = 0, var = 0;
+        for (int r = 0; r < reps; r++) mean += mips[r];
+        mean /= reps;
+        for (int r = 0; r < reps; r++) var += (mips[r] - mean) * (mips[r] - mean);
+        double stddev = reps > 1 ? sqrt(var / (reps - 1)) : 0;
+        double med = median(mips, reps);
+        double min = mips[0];
+        double start_med = median(startup, reps);
+
+        printf("%-10s %12llu %10.1f %10.1f %8.2f %11.1f %9ld", workloads[w].name, instrs,
+               med, min, stddev, start_med, rss);
+
+        double base_mips, base_rss;
+        if (!ok)
+        {
+            printf(" %9s  FAILED", "");
+            result = EXIT_FAILURE;
+        }
+        else if (base_text != NULL && baseline_value(base_text, workloads[w].name, "mips_median", &base_mips)
+                 && base_mips > 0)
+        {
+            printf(" %+8.1f%%", 100.0 * (med - base_mips) / base_mips);
+            bool slower = med < base_mips * (1 - BENCH_TOLERANCE);
+            bool bigger = baseline_value(base_text, workloads[w].name, "peak_rss_kb", &base_rss)
+                          && rss > base_rss * (1 + BENCH_TOLERANCE) + BENCH_RSS_SLACK_KB;
+            if (slower || bigger)
+            {
+                printf("  REGRESSION%s%s", slower ? " (speed)" : "", bigger ? " (memory)" : "");
+                result = EXIT_FAILURE;
+            }
+        }
+        printf("\n");
+
+        if (json != NULL)
+        {
+            fprintf(json, "%s\n    { \"name\": \"%s\", \"instructions\": %llu, \"mips_median\": %.3f, "
+                    "\"mips_mean\": %.3f, \"mips_min\": %.3f, \"mips_stddev\": %.3f, "
+                    "\"startup_us_median\": %.1f, \"peak_rss_kb\": %ld }",
+                    w == 0 ? "" : ",", workloads[w].name, instrs, med, mean, min, stddev,
+                    start_med, rss);
+        }
+    }
+
+    unlink(path);
+    free(base_text);
+    if (json != NULL)
+    {
+        fprintf(json, "\n  ]\n}\n");
+        if (fclose(json) != 0)
+        {
+            bail_with_error("Unable to write benchmark results file %s!", save);
+        }
+    }
+    return result;
+}
@@ -0,0 +1,29 @@
+#ifndef _BENCH_H
+#define _BENCH_H
+
+// Times each workload is run when no count is given.
+#define BENCH_DEFAULT_REPS 5
+
+// Roughly how many instructions each workload executes per run.
+#define BENCH_TARGET_INSTRS 10000000
+
+// Fraction by which a result may be worse than the baseline before it is
+// flagged as a regression.
+#define BENCH_TOLERANCE 0.10
+
+// Peak RSS growth always allowed, since runs are forked from the harness
+// and inherit its pages.
+#define BENCH_RSS_SLACK_KB 512
+
+// Pre-Condition: reps > 0. baseline is NULL or names a file written by an
+// earlier run with save set.
+// Post-Condition: Generates the synthetic workloads (arithmetic loop, deep
+// recursion through CALL and RTN, stack-based expression evaluation,
+// multiply and divide kernel, character output, large global data), runs
+// each reps times in a fresh process and prints instructions per second,
+// startup time and peak RSS with their spread. Compares against baseline
+// if given and writes the results as JSON to save if given. Returns
+// EXIT_FAILURE if a workload failed or regressed.
+extern int bench_run(int reps, const char* baseline, const char* save);
+
+#endif
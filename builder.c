@@ -0,0 +1,300 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "builder.h"
+#include "machine.h"
+#include "instruction.h"
+#include "bof.h"
+#include "utilities.h"
+
+#define DEBUG 0
+
+// Address of a label that has not been placed yet.
+#define UNPLACED (-1)
+
+// Pre-Condition: *items holds *cap elements of size bytes.
+// Post-Condition: Makes room for at least one more element.
+static void grow(void** items, unsigned int count, unsigned int* cap, size_t size)
+{
+    if (count < *cap) return;
+
+    *cap = *cap == 0 ? 64 : *cap * 2;
+    *items = realloc(*items, (size_t) *cap * size);
+    if (*items == NULL)
+    {
+        bail_with_error("Unable to allocate memory for a program being built!");
+    }
+}
+
+bof_builder* builder_create()
+{
+    bof_builder* b = calloc(1, sizeof(bof_builder));
+    if (b == NULL)
+    {
+        bail_with_error("Unable to allocate memory for a program being built!");
+    }
+    memcpy(b->header.magic, BUILDER_MAGIC, sizeof(b->header.magic));
+    b->header.text_start_address = 0;
+    b->header.data_start_address = BUILDER_DEFAULT_DATA_START;
+    b->header.stack_bottom_addr = BUILDER_DEFAULT_STACK_BOTTOM;
+    return b;
+}
+
+void builder_free(bof_builder* b)
+{
+    free(b->instrs);
+    free(b->data);
+    free(b->labels);
+    free(b->fixups);
+    free(b);
+}
+
+void builder_set_text_start(bof_builder* b, address_type addr)
+{
+    b->header.text_start_address = addr;
+}
+
+void builder_set_data_start(bof_builder* b, address_type addr)
+{
+    b->header.data_start_address = addr;
+}
+
+void builder_set_stack_bottom(bof_builder* b, address_type addr)
+{
+    b->header.stack_bottom_addr = addr;
+}
+
+bof_label builder_new_label(bof_builder* b)
+{
+    grow((void**) &b->labels, b->num_labels, &b->label_cap, sizeof(long));
+    b->labels[b->num_labels] = UNPLACED;
+    return b->num_labels++;
+}
+
+void builder_place_label(bof_builder* b, bof_label label)
+{
+    if (label >= b->num_labels || b->labels[label] != UNPLACED)
+    {
+        bail_with_error("Label %u is unknown or already placed!", label);
+    }
+    b->labels[label] = b->num_instrs;
+}
+
+address_type builder_here(const bof_builder* b)
+{
+    return b->num_instrs;
+}
+
+address_type builder_emit(bof_builder* b, bin_instr_t instr)
+{
+    if (b->num_instrs >= MEMORY_SIZE_IN_WORDS)
+    {
+        bail_with_error("Program being built has more instructions than memory holds!");
+    }
+    grow((void**) &b->instrs, b->num_instrs, &b->instr_cap, sizeof(bin_instr_t));
+    b->instrs[b->num_instrs] = instr;
+    return b->num_instrs++;
+}
+
+address_type builder_comp(bof_builder* b, func_type func, reg_num_type rt, int ot,
+                          reg_num_type rs, int os)
+{
+    bin_instr_t instr;
+    memset(&instr, 0, sizeof(instr));
+    instr.comp.op = COMP_O;
+    instr.comp.func = func;
+    instr.comp.rt = rt;
+    instr.comp.ot = ot;
+    instr.comp.rs = rs;
+    instr.comp.os = os;
+    return builder_emit(b, instr);
+}
+
+address_type builder_othc(bof_builder* b, func_type func, reg_num_type reg, int offset, int arg)
+{
+    bin_instr_t instr;
+    memset(&instr, 0, sizeof(instr));
+    instr.othc.op = OTHC_O;
+    instr.othc.func = func;
+    instr.othc.reg = reg;
+    instr.othc.offset = offset;
+    instr.othc.arg = arg;
+    return builder_emit(b, instr);
+}
+
+address_type builder_syscall(bof_builder* b, syscall_type code, reg_num_type reg, int offset)
+{
+    bin_instr_t instr;
+    memset(&instr, 0, sizeof(instr));
+    instr.syscall.op = OTHC_O;
+    instr.syscall.func = SYS_F;
+    instr.syscall.code = code;
+    instr.syscall.reg = reg;
+    instr.syscall.offset = offset;
+    return builder_emit(b, instr);
+}
+
+address_type builder_immed(bof_builder* b, opcode_type op, reg_num_type reg, int offset, int immed)
+{
+    bin_instr_t instr;
+    memset(&instr, 0, sizeof(instr));
+    instr.immed.op = op;
+    instr.immed.reg = reg;
+    instr.immed.offset = offset;
+    instr.immed.immed = immed;
+    return builder_emit(b, instr);
+}
+
+address_type builder_jump(bof_builder* b, opcode_type op, address_type addr)
+{
+    bin_instr_t instr;
+    memset(&instr, 0, sizeof(instr));
+    instr.jump.op = op;
+    instr.jump.addr = addr;
+    return builder_emit(b, instr);
+}
+
+// Pre-Condition: The instruction at addr refers to label.
+// Post-Condition: Records that it must be patched once label is placed.
+static void add_fixup(bof_builder* b, address_type addr, bof_label label)
+{
+    if (label >= b->num_labels)
+    {
+        bail_with_error("Label %u is unknown!", label);
+    }
+    grow((void**) &b->fixups, b->num_fixups, &b->fixup_cap, sizeof(builder_fixup));
+    b->fixups[b->num_fixups].addr = addr;
+    b->fixups[b->num_fixups].label = label;
+    b->num_fixups++;
+}
+
+address_type builder_branch(bof_builder* b, opcode_type op, reg_num_type reg, int offset,
+                            bof_label target)
+{
+    if (op < BEQ_O || op > BNE_O)
+    {
+        bail_with_error("Opcode %u is not a branch!", op);
+    }
+    address_type addr = builder_immed(b, op, reg, offset, 0);
+    add_fixup(b, addr, target);
+    return addr;
+}
+
+address_type builder_jump_to(bof_builder* b, opcode_type op, bof_label target)
+{
+    if (op != JMPA_O && op != CALL_O)
+    {
+        bail_with_error("Opcode %u does not jump to an address!", op);
+    }
+    address_type addr = builder_jump(b, op, 0);
+    add_fixup(b, addr, target);
+    return addr;
+}
+
+address_type builder_add_word(bof_builder* b, word_type value)
+{
+    if (b->num_data >= MEMORY_SIZE_IN_WORDS)
+    {
+        bail_with_error("Program being built has more data than memory holds!");
+    }
+    grow((void**) &b->data, b->num_data, &b->data_cap, sizeof(word_type));
+    b->data[b->num_data] = value;
+    return b->header.data_start_address + b->num_data++;
+}
+
+address_type builder_reserve(bof_builder* b, unsigned int count)
+{
+    address_type first = b->header.data_start_address + b->num_data;
+    for (unsigned int i = 0; i < count; i++)
+    {
+        builder_add_word(b, 0);
+    }
+    return first;
+}
+
+void builder_set_word(bof_builder* b, address_type addr, word_type value)
+{
+    address_type index = addr - b->header.data_start_address;
+    if (addr < (address_type) b->header.data_start_address || index >= b->num_data)
+    {
+        bail_with_error("Address %u is not in the global data being built!", addr);
+    }
+    b->data[index] = value;
+}
+
+void builder_finish(bof_builder* b)
+{
+    for (unsigned int i = 0; i < b->num_fixups; i++)
+    {
+        builder_fixup* fix = &b->fixups[i];
+        long target = b->labels[fix->label];
+        if (target == UNPLACED)
+        {
+            bail_with_error("Label %u is used at address %u but never placed!", fix->label, fix->addr);
+        }
+
+        bin_instr_t* instr = &b->instrs[fix->addr];
+        if (instruction_type(*instr) == jump_instr_type)
+        {
+            instr->jump.addr = target;
+        }
+        else
+        {
+            // Branches are relative to their own address.
+            long distance = target - (long) fix->addr;
+            if (distance < -32768 || distance > 32767)
+            {
+                bail_with_error("Branch at address %u cannot reach address %ld!", fix->addr, target);
+            }
+            instr->immed.immed = distance;
+        }
+    }
+
+    b->header.text_length = b->num_instrs;
+    b->header.data_length = b->num_data;
+
+    BOFHeader* h = &b->header;
+    if (h->text_start_address < 0 || h->text_start_address >= h->text_length
+        || h->data_start_address < h->text_length
+        || h->data_start_address + h->data_length >= h->stack_bottom_addr
+        || h->stack_bottom_addr >= MEMORY_SIZE_IN_WORDS)
+    {
+        bail_with_error("Program being built does not fit its layout (text %d at %d, data %d at %d, stack bottom %d)!",
+                        h->text_length, h->text_start_address, h->data_length,
+                        h->data_start_address, h->stack_bottom_addr);
+    }
+
+    if (DEBUG) printf("DEBUG: built %u instructions and %u data words\n", b->num_instrs, b->num_data);
+}
+
+void builder_write(bof_builder* b, const char* path)
+{
+    builder_finish(b);
+
+    BOFFILE bof = bof_write_open(path);
+    bof_write_header(bof, b->header);
+    for (unsigned int i = 0; i < b->num_instrs; i++)
+    {
+        instruction_write_bin_instr(bof, b->instrs[i]);
+    }
+    for (unsigned int i = 0; i < b->num_data; i++)
+    {
+        bof_write_word(bof, b->data[i]);
+    }
+    bof_close(bof);
+}
+
+void builder_load(bof_builder* b)
+{
+    builder_finish(b);
+
+    init(b->header);
+    invariant_check();
+
+    num_instrs = b->num_instrs;
+    memcpy(vm_memory->instrs, b->instrs, num_instrs * sizeof(bin_instr_t));
+    compute_block_lengths();
+
+    num_globals = b->num_data;
+    memcpy(&vm_memory->words[b->header.data_start_address], b->data, num_globals * sizeof(word_type));
+}
@@ -0,0 +1,125 @@
+#ifndef _BUILDER_H
+#define _BUILDER_H
+#include <stdbool.h>
+#include "machine.h"
+#include "instruction.h"
+
+// Magic number written at the start of built BOFs.
+#define BUILDER_MAGIC "BO32"
+
+// Header fields of a new program until they are set.
+#define BUILDER_DEFAULT_DATA_START 1024
+#define BUILDER_DEFAULT_STACK_BOTTOM 32000
+
+// A label names an instruction address that may not be known yet.
+typedef unsigned int bof_label;
+
+// Instruction that refers to a label, patched once the program is done.
+typedef struct
+{
+    address_type addr;
+    bof_label label;
+} builder_fixup;
+
+// A program under construction. Instructions and global data are kept
+// in growable arrays; labels map to addresses once placed.
+typedef struct
+{
+    BOFHeader header;
+    bin_instr_t* instrs;
+    unsigned int num_instrs;
+    unsigned int instr_cap;
+    word_type* data;
+    unsigned int num_data;
+    unsigned int data_cap;
+    long* labels;
+    unsigned int num_labels;
+    unsigned int label_cap;
+    builder_fixup* fixups;
+    unsigned int num_fixups;
+    unsigned int fixup_cap;
+} bof_builder;
+
+// Pre-Condition: None.
+// Post-Condition: Returns an empty program with text at address 0 and
+// the default data start and stack bottom.
+extern bof_builder* builder_create();
+
+// Pre-Condition: b was returned by builder_create.
+// Post-Condition: Frees b.
+extern void builder_free(bof_builder* b);
+
+// Pre-Condition: No global data has been added yet, since data addresses
+// depend on where the data starts.
+// Post-Condition: Set the matching header fields of b's program.
+extern void builder_set_text_start(bof_builder* b, address_type addr);
+extern void builder_set_data_start(bof_builder* b, address_type addr);
+extern void builder_set_stack_bottom(bof_builder* b, address_type addr);
+
+// Pre-Condition: None.
+// Post-Condition: Returns a new label that has not been placed yet.
+extern bof_label builder_new_label(bof_builder* b);
+
+// Pre-Condition: label has not been placed yet.
+// Post-Condition: Places label at the address of the next instruction.
+extern void builder_place_label(bof_builder* b, bof_label label);
+
+// Pre-Condition: None.
+// Post-Condition: Returns the address the next instruction will get.
+extern address_type builder_here(const bof_builder* b);
+
+// Pre-Condition: None.
+// Post-Condition: Appends instr to the text and returns its address.
+extern address_type builder_emit(bof_builder* b, bin_instr_t instr);
+
+// Pre-Condition: None.
+// Post-Condition: Append one instruction of each format, with the fields
+// in the order the assembly form shows them, and return its address.
+extern address_type builder_comp(bof_builder* b, func_type func, reg_num_type rt, int ot,
+                                 reg_num_type rs, int os);
+extern address_type builder_othc(bof_builder* b, func_type func, reg_num_type reg, int offset, int arg);
+extern address_type builder_syscall(bof_builder* b, syscall_type code, reg_num_type reg, int offset);
+extern address_type builder_immed(bof_builder* b, opcode_type op, reg_num_type reg, int offset, int immed);
+extern address_type builder_jump(bof_builder* b, opcode_type op, address_type addr);
+
+// Pre-Condition: op is one of the branch opcodes BEQ_O to BNE_O.
+// Post-Condition: Appends a branch to target, which may be placed later,
+// and returns its address.
+extern address_type builder_branch(bof_builder* b, opcode_type op, reg_num_type reg, int offset,
+                                   bof_label target);
+
+// Pre-Condition: op is JMPA_O or CALL_O.
+// Post-Condition: Appends a jump or call to target, which may be placed
+// later, and returns its address.
+extern address_type builder_jump_to(bof_builder* b, opcode_type op, bof_label target);
+
+// Pre-Condition: None.
+// Post-Condition: Appends value to the global data and returns its
+// address in memory.
+extern address_type builder_add_word(bof_builder* b, word_type value);
+
+// Pre-Condition: None.
+// Post-Condition: Appends count zero words to the global data and returns
+// the address of the first.
+extern address_type builder_reserve(bof_builder* b, unsigned int count);
+
+// Pre-Condition: addr was returned by builder_add_word or builder_reserve.
+// Post-Condition: Changes the initial value of the word at addr.
+extern void builder_set_word(bof_builder* b, address_type addr, word_type value);
+
+// Pre-Condition: Every label used has been placed.
+// Post-Condition: Patches label references and checks that the layout
+// fits in memory, bailing out if not. Called by builder_write and
+// builder_load, and harmless to repeat.
+extern void builder_finish(bof_builder* b);
+
+// Pre-Condition: Every label used has been placed.
+// Post-Condition: Writes the program to path as a BOF.
+extern void builder_write(bof_builder* b, const char* path);
+
+// Pre-Condition: Every label used has been placed.
+// Post-Condition: Loads the program straight into memory and initializes
+// the registers, as load_bof would for the written file.
+extern void builder_load(bof_builder* b);
+
+#endif
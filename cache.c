@@ -0,0 +1,217 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cache.h"
+#include "machine.h"
+#include "utilities.h"
+
+#define DEBUG 0
+
+// A set-associative cache with least recently used replacement. Each way
+// holds the number of the line it caches plus one, so zero means empty.
+typedef struct
+{
+    const char* name;
+    unsigned int size;
+    unsigned int ways;
+    unsigned int line;
+    unsigned int sets;
+    unsigned long long* tags;
+    unsigned long long* last_used;
+    unsigned long long clock;
+    unsigned long long hits;
+    unsigned long long misses;
+} cache_level;
+
+enum { L1I, L1D, L2, NUM_LEVELS };
+
+static cache_level levels[NUM_LEVELS] =
+{
+    { "L1I", CACHE_DEFAULT_L1_SIZE, CACHE_DEFAULT_WAYS, CACHE_DEFAULT_LINE },
+    { "L1D", CACHE_DEFAULT_L1_SIZE, CACHE_DEFAULT_WAYS, CACHE_DEFAULT_LINE },
+    { "L2", CACHE_DEFAULT_L2_SIZE, CACHE_DEFAULT_WAYS, CACHE_DEFAULT_LINE },
+};
+
+// Accesses and misses per region, and per PC (index num_instrs collects
+// instructions run from outside the text), split by L1 cache.
+typedef struct
+{
+    unsigned long long accesses;
+    unsigned long long l1_misses;
+    unsigned long long l2_misses;
+} access_stats;
+
+static access_stats region_stats[2][NUM_REGIONS];
+static access_stats* pc_stats[2] = { NULL, NULL };
+
+// Pre-Condition: c's geometry has been set.
+// Post-Condition: Allocates c's empty tag arrays. Returns false if the
+// geometry does not divide into whole sets.
+static bool level_init(cache_level* c)
+{
+    if (c->ways == 0 || c->line == 0 || c->size % (c->ways * c->line) != 0
+        || c->size / (c->ways * c->line) == 0)
+    {
+        return false;
+    }
+    c->sets = c->size / (c->ways * c->line);
+    c->tags = calloc((size_t) c->sets * c->ways, sizeof(unsigned long long));
+    c->last_used = calloc((size_t) c->sets * c->ways, sizeof(unsigned long long));
+    if (c->tags == NULL || c->last_used == NULL)
+    {
+        bail_with_error("Unable to allocate the %s cache!", c->name);
+    }
+    return true;
+}
+
+// Pre-Condition: c was set up by level_init.
+// Post-Condition: Looks up the line holding byte_addr, filling it in on a
+// miss. Returns true on a hit.
+static bool level_access(cache_level* c, unsigned long long byte_addr)
+{
+    unsigned long long line = byte_addr / c->line;
+    unsigned long long* tags = &c->tags[(line % c->sets) * c->ways];
+    unsigned long long* last_used = &c->last_used[(line % c->sets) * c->ways];
+    unsigned int victim = 0;
+
+    c->clock++;
+    for (unsigned int w = 0; w < c->ways; w++)
+    {
+        if (tags[w] == line + 1)
+        {
+            last_used[w] = c->clock;
+            c->hits++;
+            return true;
+        }
+        if (last_used[w] < last_used[victim]) victim = w;
+    }
+
+    tags[victim] = line + 1;
+    last_used[victim] = c->clock;
+    c->misses++;
+    return false;
+}
+
+// Pre-Condition: PC is the instruction making the access.
+// Post-Condition: Runs the access through the hierarchy and counts it.
+static void on_access(vm_access_kind kind, address_type addr)
+{
+    int side = (kind == ACCESS_FETCH) ? 0 : 1;
+    unsigned long long byte_addr = (unsigned long long) addr * sizeof(word_type);
+    access_stats* region = &region_stats[side][vm_region_of(addr)];
+    access_stats* pc = &pc_stats[side][PC < num_instrs ? PC : num_instrs];
+
+    region->accesses++;
+    pc->accesses++;
+    if (level_access(&levels[side == 0 ? L1I : L1D], byte_addr)) return;
+
+    region->l1_misses++;
+    pc->l1_misses++;
+    if (level_access(&levels[L2], byte_addr)) return;
+
+    region->l2_misses++;
+    pc->l2_misses++;
+}
+
+// Pre-Condition: None.
+// Post-Condition: Returns part as a percentage of whole.
+static double percent(unsigned long long part, unsigned long long whole)
+{
+    return whole > 0 ? 100.0 * part / whole : 0.0;
+}
+
+// Pre-Condition: None.
+// Post-Condition: Writes one line of statistics to out.
+static void print_stats(FILE* out, const access_stats* stats)
+{
+    fprintf(out, " %12llu %12llu %7.2f%% %12llu %7.2f%%\n", stats->accesses,
+            stats->l1_misses, percent(stats->l1_misses, stats->accesses),
+            stats->l2_misses, percent(stats->l2_misses, stats->accesses));
+}
+
+// Pre-Condition: None.
+// Post-Condition: Writes the simulation results to stderr. Registered
+// with atexit, since the program ends by exiting.
+static void cache_report()
+{
+    static const char* sides[2] = { "fetch", "data" };
+    FILE* out = stderr;
+
+    fflush(stdout);
+    for (int i = 0; i < NUM_LEVELS; i++)
+    {
+        cache_level* c = &levels[i];
+        fprintf(out, "%-3s %8u bytes %2u-way %3u-byte lines: %llu hits, %llu misses (%.2f%% miss rate)\n",
+                c->name, c->size, c->ways, c->line, c->hits, c->misses,
+                percent(c->misses, c->hits + c->misses));
+    }
+
+    fprintf(out, "%-6s %-6s %12s %12s %8s %12s %8s\n",
+            "Access", "Region", "Accesses", "L1 misses", "Rate", "L2 misses", "Rate");
+    for (int side = 0; side < 2; side++)
+    {
+        for (int r = 0; r < NUM_REGIONS; r++)
+        {
+            if (region_stats[side][r].accesses == 0) continue;
+            fprintf(out, "%-6s %-6s", sides[side], vm_region_name((vm_region) r));
+            print_stats(out, &region_stats[side][r]);
+        }
+    }
+
+    fprintf(out, "%-6s %6s %12s %12s %8s %12s %8s\n",
+            "Access", "PC", "Accesses", "L1 misses", "Rate", "L2 misses", "Rate");
+    for (address_type pc = 0; pc <= num_instrs; pc++)
+    {
+        for (int side = 0; side < 2; side++)
+        {
+            if (pc_stats[side][pc].l1_misses == 0) continue;
+            if (pc == num_instrs) fprintf(out, "%-6s %6s", sides[side], "other");
+            else fprintf(out, "%-6s %6u", sides[side], pc);
+            print_stats(out, &pc_stats[side][pc]);
+        }
+    }
+}
+
+bool cache_enable(const char* spec)
+{
+    if (strcmp(spec, "default") != 0)
+    {
+        char copy[256];
+        snprintf(copy, sizeof(copy), "%s", spec);
+
+        for (char* item = strtok(copy, ","); item != NULL; item = strtok(NULL, ","))
+        {
+            char name[8];
+            unsigned int size, ways, line;
+            if (sscanf(item, "%7[^=]=%u:%u:%u", name, &size, &ways, &line) != 4) return false;
+
+            int i;
+            if (strcmp(name, "l1i") == 0) i = L1I;
+            else if (strcmp(name, "l1d") == 0) i = L1D;
+            else if (strcmp(name, "l2") == 0) i = L2;
+            else return false;
+
+            levels[i].size = size;
+            levels[i].ways = ways;
+            levels[i].line = line;
+        }
+    }
+
+    for (int i = 0; i < NUM_LEVELS; i++)
+    {
+        if (!level_init(&levels[i])) return false;
+    }
+
+    for (int side = 0; side < 2; side++)
+    {
+        pc_stats[side] = calloc(num_instrs + 1, sizeof(access_stats));
+        if (pc_stats[side] == NULL)
+        {
+            bail_with_error("Unable to allocate the cache statistics!");
+        }
+    }
+
+    vm_access_hook = on_access;
+    atexit(cache_report);
+    return true;
+}
@@ -0,0 +1,22 @@
+#ifndef _CACHE_H
+#define _CACHE_H
+#include <stdbool.h>
+
+// Default geometry of each simulated cache level, in bytes.
+#define CACHE_DEFAULT_L1_SIZE 32768
+#define CACHE_DEFAULT_L2_SIZE 262144
+#define CACHE_DEFAULT_WAYS 8
+#define CACHE_DEFAULT_LINE 64
+
+// Pre-Condition: A program has been loaded. spec is "default" or a comma
+// separated list of level=size:ways:line, with level one of l1i, l1d or
+// l2 and sizes in bytes, such as "l1d=16384:4:32,l2=131072:8:64".
+// Levels not listed keep their defaults.
+// Post-Condition: Feeds every instruction fetch into a simulated L1I and
+// every load and store into a simulated L1D, with misses from both going
+// to a shared L2. Caches are LRU and allocate on writes. Hit and miss
+// rates per region and per PC are written to stderr when the program
+// ends. Returns false if spec is malformed.
+extern bool cache_enable(const char* spec);
+
+#endif
@@ -0,0 +1,269 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include "checkpoint.h"
+#include "machine.h"
+#include "utilities.h"
+
+#define DEBUG 0
+
+#define CHECKPOINT_MAGIC "SRMC"
+#define CHECKPOINT_VERSION 2
+
+// Zero runs at least this long are left out of the memory encoding;
+// shorter ones are cheaper to store than to break a run for.
+#define MIN_ZERO_RUN 2
+
+static const char* checkpoint_path = NULL;
+static volatile sig_atomic_t checkpoint_requested = 0;
+
+// Every character read_char has returned so far, and how many of them a
+// resumed run still has to skip over in its standard input.
+static char* input_log = NULL;
+static size_t input_len = 0;
+static size_t input_cap = 0;
+static size_t input_skip = 0;
+static bool input_mismatch = false;
+static int (*previous_reader)(void) = NULL;
+
+static void on_checkpoint_signal(int sig)
+{
+    checkpoint_requested = 1;
+}
+
+// Pre-Condition: None.
+// Post-Condition: Appends c to the input log.
+static void log_input(char c)
+{
+    if (input_len == input_cap)
+    {
+        input_cap = input_cap == 0 ? 4096 : 2 * input_cap;
+        input_log = realloc(input_log, input_cap);
+        if (input_log == NULL)
+        {
+            bail_with_error("Unable to grow the checkpoint input log!");
+        }
+    }
+    input_log[input_len++] = c;
+}
+
+// Pre-Condition: previous_reader is the reader installed before ours.
+// Post-Condition: Returns the next new input character, logging it.
+static int logging_read_char(void)
+{
+    while (input_skip > 0)
+    {
+        int skipped = previous_reader();
+        if (skipped == VM_INPUT_PENDING) return VM_INPUT_PENDING;
+
+        size_t pos = input_len - input_skip;
+        if (!input_mismatch && (skipped == EOF || (char) skipped != input_log[pos]))
+        {
+            fprintf(stderr, "Warning: input differs from the checkpointed run at character %zu\n", pos);
+            input_mismatch = true;
+        }
+        input_skip--;
+    }
+
+    int c = previous_reader();
+    if (c != EOF && c != VM_INPUT_PENDING) log_input((char) c);
+    return c;
+}
+
+void checkpoint_enable(const char* path)
+{
+    checkpoint_path = path;
+
+    previous_reader = vm_read_char;
+    vm_read_char = logging_read_char;
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = on_checkpoint_signal;
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = SA_RESTART;
+    sigaction(SIGUSR1, &action, NULL);
+}
+
+// Pre-Condition: out is open for binary writing.
+// Post-Condition: Writes the VM state and input log to out.
+// Returns false on a write error.
+static bool write_state(FILE* out)
+{
+    unsigned int header[10] = { CHECKPOINT_VERSION, PC, (unsigned int) HI, (unsigned int) LO,
+                                num_instrs, num_globals, trace_program,
+                                vm_data_start, vm_stack_bottom, 0 };
+    bool ok = fwrite(CHECKPOINT_MAGIC, 1, 4, out) == 4
+        && fwrite(header, sizeof(header), 1, out) == 1
+        && fwrite(GPR, sizeof(GPR), 1, out) == 1
+        && fwrite(&vm_instr_count, sizeof(vm_instr_count), 1, out) == 1;
+
+    // Memory is written as (start, length, words...) runs of the nonzero
+    // parts, like print_global_data collapsing zeros into "...", and ends
+    // with a zero-length run.
+    int i = 0;
+    while (ok && i < MEMORY_SIZE_IN_WORDS)
+    {
+        if (vm_memory->words[i] == 0)
+        {
+            i++;
+            continue;
+        }
+
+        int start = i;
+        int zeros = 0;
+        while (i < MEMORY_SIZE_IN_WORDS && zeros < MIN_ZERO_RUN)
+        {
+            zeros = (vm_memory->words[i] == 0) ? zeros + 1 : 0;
+            i++;
+        }
+        unsigned int run[2] = { start, (i - zeros) - start };
+        ok = fwrite(run, sizeof(run), 1, out) == 1
+            && fwrite(&vm_memory->words[start], sizeof(word_type), run[1], out) == run[1];
+    }
+
+    unsigned int end[2] = { 0, 0 };
+    unsigned long long logged = input_len;
+    return ok && fwrite(end, sizeof(end), 1, out) == 1
+        && fwrite(&logged, sizeof(logged), 1, out) == 1
+        && fwrite(input_log, 1, input_len, out) == input_len;
+}
+
+void checkpoint_write()
+{
+    // Reap any earlier writer that has finished.
+    while (waitpid(-1, NULL, WNOHANG) > 0);
+
+    fflush(stdout);
+    pid_t child = fork();
+    if (child < 0)
+    {
+        fprintf(stderr, "Warning: unable to fork to write checkpoint %s\n", checkpoint_path);
+        return;
+    }
+    if (child > 0) return;
+
+    // The child sees memory as it was at the fork, copy-on-write, and
+    // publishes the checkpoint atomically with a rename.
+    char tmp_path[4096];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp.%d", checkpoint_path, (int) getpid());
+
+    FILE* out = fopen(tmp_path, "wb");
+    bool ok = out != NULL && write_state(out);
+    if (out != NULL && fclose(out) != 0) ok = false;
+
+    if (!ok || rename(tmp_path, checkpoint_path) != 0)
+    {
+        fprintf(stderr, "Warning: unable to write checkpoint %s\n", checkpoint_path);
+        unlink(tmp_path);
+        _exit(EXIT_FAILURE);
+    }
+    _exit(EXIT_SUCCESS);
+}
+
+void checkpoint_resume(const char* path)
+{
+    FILE* in = fopen(path, "rb");
+    if (in == NULL)
+    {
+        bail_with_error("Unable to open checkpoint %s!", path);
+    }
+
+    char magic[4];
+    unsigned int header[10];
+    if (fread(magic, 1, 4, in) != 4 || memcmp(magic, CHECKPOINT_MAGIC, 4) != 0
+        || fread(header, sizeof(header), 1, in) != 1 || header[0] != CHECKPOINT_VERSION
+        || fread(GPR, sizeof(GPR), 1, in) != 1
+        || fread(&vm_instr_count, sizeof(vm_instr_count), 1, in) != 1)
+    {
+        bail_with_error("%s is not a valid checkpoint!", path);
+    }
+
+    PC = header[1];
+    HI = (word_type) header[2];
+    LO = (word_type) header[3];
+    num_instrs = header[4];
+    num_globals = header[5];
+    trace_program = header[6];
+    vm_data_start = header[7];
+    vm_stack_bottom = header[8];
+
+    memset(vm_memory, 0, sizeof(union mem_u));
+    while (true)
+    {
+        unsigned int run[2];
+        if (fread(run, sizeof(run), 1, in) != 1 || run[0] > MEMORY_SIZE_IN_WORDS
+            || run[1] > MEMORY_SIZE_IN_WORDS - run[0])
+        {
+            bail_with_error("Checkpoint %s has a corrupt memory image!", path);
+        }
+        if (run[1] == 0) break;
+
+        if (fread(&vm_memory->words[run[0]], sizeof(word_type), run[1], in) != run[1])
+        {
+            bail_with_error("Checkpoint %s has a corrupt memory image!", path);
+        }
+    }
+
+    unsigned long long logged;
+    if (fread(&logged, sizeof(logged), 1, in) != 1)
+    {
+        bail_with_error("Checkpoint %s has a corrupt input log!", path);
+    }
+    input_len = input_cap = logged;
+    input_log = malloc(logged > 0 ? logged : 1);
+    if (input_log == NULL || fread(input_log, 1, logged, in) != logged)
+    {
+        bail_with_error("Checkpoint %s has a corrupt input log!", path);
+    }
+    input_skip = logged;
+    fclose(in);
+
+    if (num_instrs > MEMORY_SIZE_IN_WORDS)
+    {
+        bail_with_error("Checkpoint %s has a corrupt header!", path);
+    }
+    compute_block_lengths();
+    invariant_check();
+
+    if (DEBUG) printf("DEBUG: resumed at PC %u after %llu instructions\n", PC, vm_instr_count);
+}
+
+void checkpoint_run(unsigned long long every)
+{
+    if (trace_program)
+    {
+        print_state();
+    }
+
+    invariant_check();
+
+    unsigned long long chunk = every != 0 ? every : CHECKPOINT_POLL_INTERVAL;
+
+    while (true)
+    {
+        vm_status status = vm_run_for(chunk);
+
+        if (status == VM_EXITED)
+        {
+            fflush(stdout);
+            exit(vm_exit_code);
+        }
+        if (status == VM_FAULTED)
+        {
+            fflush(stdout);
+            print_flight_record(stderr);
+            bail_with_error("%s", vm_fault_message);
+        }
+
+        if (every != 0 || checkpoint_requested)
+        {
+            checkpoint_requested = 0;
+            checkpoint_write();
+        }
+    }
+}
@@ -0,0 +1,31 @@
+#ifndef _CHECKPOINT_H
+#define _CHECKPOINT_H
+#include <stdbool.h>
+
+// Instructions run between checks for a checkpoint requested by signal
+// when no checkpoint interval is given.
+#define CHECKPOINT_POLL_INTERVAL 1000000
+
+// Pre-Condition: A program has been loaded or resumed.
+// Post-Condition: Arranges for checkpoints to be written to path, and for
+// input read by read_char to be logged so a resumed run sees the same
+// input. SIGUSR1 requests a checkpoint at the next opportunity.
+extern void checkpoint_enable(const char* path);
+
+// Pre-Condition: checkpoint_enable has been called.
+// Post-Condition: Writes a checkpoint of the current VM state from a
+// forked child, so the caller keeps running while it is written.
+extern void checkpoint_write();
+
+// Pre-Condition: path names a checkpoint written by checkpoint_write.
+// Post-Condition: Restores the VM state from it. The program's standard
+// input must be the same as in the original run; the characters it had
+// already consumed are skipped (and checked) before reading more.
+extern void checkpoint_resume(const char* path);
+
+// Pre-Condition: checkpoint_enable has been called.
+// Post-Condition: Runs the program to completion, writing a checkpoint
+// every `every` instructions (if nonzero) and whenever one is requested.
+extern void checkpoint_run(unsigned long long every);
+
+#endif
@@ -0,0 +1,355 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "compact.h"
+#include "machine.h"
+#include "instruction.h"
+#include "utilities.h"
+
+#define DEBUG 0
+
+// Low nibble of the first byte of an instruction that has no function code.
+#define FORMAT_FIELDS 0
+#define FORMAT_RAW 1
+
+// Growable output buffer for the encoder.
+typedef struct
+{
+    unsigned char* bytes;
+    size_t len;
+    size_t cap;
+} byte_buffer;
+
+// Position in the file being decoded, and the file's name for errors.
+typedef struct
+{
+    const unsigned char* next;
+    const unsigned char* end;
+    const char* name;
+} byte_reader;
+
+// Pre-Condition: None.
+// Post-Condition: Returns the FNV-1a hash of the len bytes at bytes.
+static uint32_t checksum(const unsigned char* bytes, size_t len)
+{
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < len; i++)
+    {
+        hash ^= bytes[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static void put_byte(byte_buffer* buf, unsigned char b)
+{
+    if (buf->len == buf->cap)
+    {
+        buf->cap = buf->cap == 0 ? 4096 : buf->cap * 2;
+        buf->bytes = realloc(buf->bytes, buf->cap);
+        if (buf->bytes == NULL)
+        {
+            bail_with_error("Unable to allocate memory for a compact BOF!");
+        }
+    }
+    buf->bytes[buf->len++] = b;
+}
+
+static void put_varint(byte_buffer* buf, uint32_t v)
+{
+    while (v >= 0x80)
+    {
+        put_byte(buf, (unsigned char) (v | 0x80));
+        v >>= 7;
+    }
+    put_byte(buf, (unsigned char) v);
+}
+
+// Small negative numbers, common in offsets, become small varints.
+static void put_signed(byte_buffer* buf, int32_t v)
+{
+    put_varint(buf, ((uint32_t) v << 1) ^ (uint32_t) (v >> 31));
+}
+
+// Decoded into 64 bits, so that a count too large for 32 bits is seen as
+// too large rather than wrapping around.
+static uint64_t get_varint(byte_reader* in)
+{
+    uint64_t v = 0;
+    for (int shift = 0; shift < 35; shift += 7)
+    {
+        if (in->next == in->end)
+        {
+            bail_with_error("Compact BOF %s is truncated!", in->name);
+        }
+        unsigned char b = *in->next++;
+        v |= (uint64_t) (b & 0x7f) << shift;
+        if ((b & 0x80) == 0) return v;
+    }
+    bail_with_error("Compact BOF %s has an overlong number!", in->name);
+    return 0;
+}
+
+static uint32_t get_word(byte_reader* in)
+{
+    uint64_t v = get_varint(in);
+    if (v > UINT32_MAX)
+    {
+        bail_with_error("Compact BOF %s has an overlong number!", in->name);
+    }
+    return (uint32_t) v;
+}
+
+static int32_t get_signed(byte_reader* in)
+{
+    uint32_t v = get_word(in);
+    return (int32_t) (v >> 1) ^ -(int32_t) (v & 1);
+}
+
+static unsigned char get_byte(byte_reader* in)
+{
+    if (in->next == in->end)
+    {
+        bail_with_error("Compact BOF %s is truncated!", in->name);
+    }
+    return *in->next++;
+}
+
+// Pre-Condition: None.
+// Post-Condition: Appends instr to buf in the compact form.
+static void put_instr(byte_buffer* buf, bin_instr_t instr)
+{
+    switch (instruction_type(instr))
+    {
+        case comp_instr_type:
+            put_byte(buf, (unsigned char) (instr.comp.op << 4 | instr.comp.func));
+            put_byte(buf, (unsigned char) (instr.comp.rt << 3 | instr.comp.rs));
+            put_signed(buf, instr.comp.ot);
+            put_signed(buf, instr.comp.os);
+            break;
+
+        case other_comp_instr_type:
+        case syscall_instr_type:
+            // A system call's code lies where the other instructions' arg is.
+            put_byte(buf, (unsigned char) (instr.othc.op << 4 | instr.othc.func));
+            put_byte(buf, (unsigned char) instr.othc.reg);
+            put_signed(buf, instr.othc.offset);
+            put_signed(buf, instr.othc.arg);
+            break;
+
+        case immed_instr_type:
+            put_byte(buf, (unsigned char) (instr.immed.op << 4 | FORMAT_FIELDS));
+            put_byte(buf, (unsigned char) instr.immed.reg);
+            put_signed(buf, instr.immed.offset);
+            put_signed(buf, instr.immed.immed);
+            break;
+
+        case jump_instr_type:
+            put_byte(buf, (unsigned char) (instr.jump.op << 4 | FORMAT_FIELDS));
+            put_varint(buf, instr.jump.addr);
+            break;
+
+        default:
+        {
+            uint32_t raw;
+            memcpy(&raw, &instr, sizeof(raw));
+            put_byte(buf, (unsigned char) (instr.comp.op << 4 | FORMAT_RAW));
+            put_varint(buf, raw);
+            break;
+        }
+    }
+}
+
+// Pre-Condition: None.
+// Post-Condition: Decodes one instruction from in.
+static bin_instr_t get_instr(byte_reader* in)
+{
+    bin_instr_t instr;
+    memset(&instr, 0, sizeof(instr));
+
+    unsigned char first = get_byte(in);
+    unsigned int op = first >> 4;
+
+    if (op == COMP_O)
+    {
+        unsigned char regs = get_byte(in);
+        instr.comp.op = op;
+        instr.comp.func = first & 0xf;
+        instr.comp.rt = regs >> 3;
+        instr.comp.rs = regs & 0x7;
+        instr.comp.ot = get_signed(in);
+        instr.comp.os = get_signed(in);
+        return instr;
+    }
+
+    if (op == OTHC_O)
+    {
+        instr.othc.op = op;
+        instr.othc.func = first & 0xf;
+        instr.othc.reg = get_byte(in);
+        instr.othc.offset = get_signed(in);
+        instr.othc.arg = get_signed(in);
+        return instr;
+    }
+
+    if ((first & 0xf) == FORMAT_RAW)
+    {
+        uint32_t raw = get_word(in);
+        memcpy(&instr, &raw, sizeof(instr));
+        return instr;
+    }
+
+    instr.comp.op = op;
+    if (instruction_type(instr) == jump_instr_type)
+    {
+        instr.jump.addr = get_word(in);
+        return instr;
+    }
+
+    instr.immed.reg = get_byte(in);
+    instr.immed.offset = get_signed(in);
+    instr.immed.immed = get_signed(in);
+    return instr;
+}
+
+bool compact_detect(BOFFILE bof)
+{
+    char magic[4];
+    bool compact = fread(magic, 1, sizeof(magic), bof.fileptr) == sizeof(magic)
+                   && memcmp(magic, COMPACT_MAGIC, sizeof(magic)) == 0;
+    rewind(bof.fileptr);
+    return compact;
+}
+
+void compact_load(BOFFILE bof)
+{
+    // Decode from one buffer rather than reading the file word by word.
+    fseek(bof.fileptr, 0, SEEK_END);
+    long size = ftell(bof.fileptr);
+    rewind(bof.fileptr);
+
+    unsigned char* bytes = malloc(size > 0 ? size : 1);
+    if (bytes == NULL)
+    {
+        bail_with_error("Unable to allocate memory to load %s!", bof.filename);
+    }
+    if (size < 8 || fread(bytes, 1, size, bof.fileptr) != (size_t) size)
+    {
+        bail_with_error("Compact BOF %s is truncated!", bof.filename);
+    }
+
+    const unsigned char* tail = bytes + size - 4;
+    uint32_t stored = tail[0] | tail[1] << 8 | tail[2] << 16 | (uint32_t) tail[3] << 24;
+    if (checksum(bytes, size - 4) != stored)
+    {
+        bail_with_error("Compact BOF %s has a bad checksum!", bof.filename);
+    }
+
+    byte_reader in = { bytes + 4, tail, bof.filename };
+    if (get_word(&in) != COMPACT_VERSION)
+    {
+        bail_with_error("Compact BOF %s has an unsupported version!", bof.filename);
+    }
+
+    BOFHeader header;
+    memcpy(header.magic, COMPACT_MAGIC, sizeof(header.magic));
+    header.text_start_address = get_signed(&in);
+    header.text_length = get_signed(&in);
+    header.data_start_address = get_signed(&in);
+    header.data_length = get_signed(&in);
+    header.stack_bottom_addr = get_signed(&in);
+
+    if (header.text_length < 0 || header.text_length > MEMORY_SIZE_IN_WORDS
+        || header.data_length < 0 || header.data_start_address < 0
+        || (int64_t) header.data_start_address + header.data_length > MEMORY_SIZE_IN_WORDS)
+    {
+        bail_with_error("Compact BOF %s has an invalid header!", bof.filename);
+    }
+
+    init(header);
+    invariant_check();
+
+    num_instrs = header.text_length;
+    for (unsigned int i = 0; i < num_instrs; i++)
+    {
+        vm_memory->instrs[i] = get_instr(&in);
+    }
+    compute_block_lengths();
+
+    num_globals = header.data_length;
+    word_type* data = &vm_memory->words[header.data_start_address];
+    unsigned int filled = 0;
+    while (filled < num_globals)
+    {
+        // init already zeroed memory, so zero runs are just skipped. Each
+        // run is checked against what is left before it is added.
+        uint64_t zeros = get_varint(&in);
+        if (zeros > num_globals - filled)
+        {
+            bail_with_error("Compact BOF %s has too much data!", bof.filename);
+        }
+        filled += zeros;
+
+        uint64_t literals = get_varint(&in);
+        if (literals > num_globals - filled)
+        {
+            bail_with_error("Compact BOF %s has too much data!", bof.filename);
+        }
+        for (uint64_t i = 0; i < literals; i++)
+        {
+            data[filled++] = get_signed(&in);
+        }
+    }
+
+    if (in.next != in.end)
+    {
+        bail_with_error("Compact BOF %s has trailing bytes!", bof.filename);
+    }
+    free(bytes);
+}
+
+bool compact_write(FILE* out)
+{
+    byte_buffer buf = { NULL, 0, 0 };
+
+    for (int i = 0; i < 4; i++) put_byte(&buf, COMPACT_MAGIC[i]);
+    put_varint(&buf, COMPACT_VERSION);
+    put_signed(&buf, PC);
+    put_signed(&buf, num_instrs);
+    put_signed(&buf, GPR[GP]);
+    put_signed(&buf, num_globals);
+    put_signed(&buf, GPR[FP]);
+
+    for (unsigned int i = 0; i < num_instrs; i++)
+    {
+        put_instr(&buf, vm_memory->instrs[i]);
+    }
+
+    const word_type* data = &vm_memory->words[GPR[GP]];
+    unsigned int i = 0;
+    while (i < num_globals)
+    {
+        uint32_t zeros = 0;
+        while (i + zeros < num_globals && data[i + zeros] == 0) zeros++;
+        i += zeros;
+
+        uint32_t literals = 0;
+        while (i + literals < num_globals && data[i + literals] != 0) literals++;
+
+        put_varint(&buf, zeros);
+        put_varint(&buf, literals);
+        for (uint32_t j = 0; j < literals; j++)
+        {
+            put_signed(&buf, data[i + j]);
+        }
+        i += literals;
+    }
+
+    uint32_t sum = checksum(buf.bytes, buf.len);
+    for (int b = 0; b < 4; b++) put_byte(&buf, (unsigned char) (sum >> (8 * b)));
+
+    bool ok = fwrite(buf.bytes, 1, buf.len, out) == buf.len;
+    free(buf.bytes);
+    return ok;
+}
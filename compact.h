@@ -0,0 +1,36 @@
+#ifndef _COMPACT_H
+#define _COMPACT_H
+#include <stdio.h>
+#include <stdbool.h>
+#include "bof.h"
+
+// Compact BOF files start with this instead of the usual BOF magic.
+#define COMPACT_MAGIC "BOFZ"
+#define COMPACT_VERSION 1
+
+// Compact layout: COMPACT_MAGIC, the version as a varint, then the five
+// header fields as zigzag varints (text start, text length, data start,
+// data length, stack bottom). Each instruction follows as one byte with
+// its opcode in the high nibble and its function code (or a format tag)
+// in the low nibble, then its remaining fields as varints. The global
+// data is runs of a zero count and a literal count followed by that many
+// zigzag varint words. The last four bytes are an FNV-1a checksum of
+// everything before them, least significant byte first.
+
+// Pre-Condition: bof is open at its start.
+// Post-Condition: Returns true if bof is a compact BOF. Leaves bof at its
+// start either way.
+extern bool compact_detect(BOFFILE bof);
+
+// Pre-Condition: bof is a compact BOF open at its start.
+// Post-Condition: Checks the checksum and decodes the program straight
+// into memory, initializing the registers like load_bof.
+extern void compact_load(BOFFILE bof);
+
+// Pre-Condition: A program has been loaded and has not run yet. out is
+// open for binary writing.
+// Post-Condition: Writes the loaded program to out as a compact BOF.
+// Returns false if writing failed.
+extern bool compact_write(FILE* out);
+
+#endif
@@ -0,0 +1,317 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "cosim.h"
+#include "machine.h"
+#include "paging.h"
+#include "mempage.h"
+#include "verify.h"
+#include "utilities.h"
+
+#define DEBUG 0
+
+#define NUM_ENGINES 2
+
+// State of the program under one engine between blocks.
+typedef struct
+{
+    const cosim_engine* engine;
+    paged_mem mem;
+    vm_context ctx;
+    vm_status status;
+    // Instructions the last block ran.
+    unsigned long long instrs;
+    int exit_code;
+    char fault[256];
+    // What the last block wrote to stdout.
+    FILE* out;
+    char* output;
+    size_t output_len;
+    uint64_t hash;
+} engine_state;
+
+static vm_status run_reference(unsigned long long n)
+{
+    program_verified = false;
+    return vm_run_for(n);
+}
+
+static vm_status run_verified(unsigned long long n)
+{
+    program_verified = true;
+    return vm_run_for(n);
+}
+
+// The first engine is the reference the others are checked against.
+static const cosim_engine engines[NUM_ENGINES] =
+{
+    { "reference", run_reference },
+    { "verified", run_verified },
+};
+
+// Characters the reference read during the current block, EOF included,
+// replayed to the other engines.
+static int* input = NULL;
+static size_t input_len = 0;
+static size_t input_cap = 0;
+static size_t input_pos = 0;
+
+// Index of the engine running the current block.
+static int running = 0;
+
+static int cosim_read_char(void)
+{
+    if (running > 0)
+    {
+        // Reading more than the reference did is itself a divergence,
+        // which will show in the state after the block.
+        return input_pos < input_len ? input[input_pos++] : EOF;
+    }
+
+    if (input_len == input_cap)
+    {
+        input_cap = input_cap == 0 ? 256 : input_cap * 2;
+        input = realloc(input, input_cap * sizeof(int));
+        if (input == NULL)
+        {
+            bail_with_error("Unable to allocate memory for replayed input!");
+        }
+    }
+    int ch = getc(stdin);
+    input[input_len++] = ch;
+    return ch;
+}
+
+// Pre-Condition: state's memory is attached to the program's image.
+// Post-Condition: Runs n instructions of the program under state's
+// engine, or until it stops, and marks the pages it wrote in dirty.
+static void run_block(engine_state* state, unsigned long long n, unsigned char* dirty)
+{
+    paging_swap_in(&state->mem);
+    vm_restore_registers(&state->ctx);
+
+    FILE* saved_stdout = stdout;
+    stdout = state->out;
+    rewind(stdout);
+    unsigned long long before = vm_instr_count;
+    state->status = state->engine->run(n);
+    state->instrs = vm_instr_count - before;
+    fflush(stdout);
+    stdout = saved_stdout;
+
+    state->exit_code = vm_exit_code;
+    strcpy(state->fault, state->status == VM_FAULTED ? vm_fault_message : "");
+    vm_save_registers(&state->ctx);
+
+    for (unsigned int i = 0; i < paging_num_pages(); i++)
+    {
+        if (mempage_is_dirty(i)) dirty[i] = 1;
+    }
+    paging_swap_out(&state->mem);
+}
+
+// Pre-Condition: dirty marks the pages written by any engine this block.
+// Post-Condition: Returns a hash of the contents of those pages.
+static uint64_t hash_dirty(const paged_mem* mem, const unsigned char* dirty)
+{
+    // FNV-1a, a word at a time.
+    uint64_t hash = 14695981039346656037ull;
+    size_t words = paging_page_bytes() / sizeof(word_type);
+
+    for (unsigned int i = 0; i < paging_num_pages(); i++)
+    {
+        if (!dirty[i]) continue;
+
+        hash = (hash ^ i) * 1099511628211ull;
+        for (size_t w = 0; w < words; w++)
+        {
+            hash = (hash ^ (uint32_t) mem->pages[i][w]) * 1099511628211ull;
+        }
+    }
+    return hash;
+}
+
+static bool same_state(const engine_state* a, const engine_state* b)
+{
+    return a->status == b->status
+           && (a->status != VM_EXITED || a->exit_code == b->exit_code)
+           && strcmp(a->fault, b->fault) == 0
+           && a->ctx.PC == b->ctx.PC
+           && memcmp(a->ctx.GPR, b->ctx.GPR, sizeof(a->ctx.GPR)) == 0
+           && a->ctx.HI == b->ctx.HI
+           && a->ctx.LO == b->ctx.LO
+           && a->output_len == b->output_len
+           && memcmp(a->output, b->output, a->output_len) == 0
+           && a->hash == b->hash;
+}
+
+static void print_status(const engine_state* state)
+{
+    switch (state->status)
+    {
+        case VM_EXITED:
+            printf("exited with code %d", state->exit_code);
+            break;
+        case VM_FAULTED:
+            printf("faulted: %s", state->fault);
+            break;
+        default:
+            printf("running");
+            break;
+    }
+}
+
+// Pre-Condition: The engines disagree after the block starting at pc.
+// Post-Condition: Prints each engine's state and what differs.
+static void report_mismatch(engine_state* states, const unsigned char* dirty, address_type pc,
+                            unsigned long long count)
+{
+    engine_state* ref = &states[0];
+
+    printf("Engines diverged in the block starting at PC %u, within %llu instructions.\n", pc, count);
+    for (int i = 0; i < NUM_ENGINES; i++)
+    {
+        printf("%s engine, ", states[i].engine->name);
+        print_status(&states[i]);
+        printf(":\n");
+        paging_swap_in(&states[i].mem);
+        vm_restore_registers(&states[i].ctx);
+        print_state();
+    }
+
+    for (int i = 1; i < NUM_ENGINES; i++)
+    {
+        engine_state* alt = &states[i];
+        printf("Differences between the %s and %s engines:\n", ref->engine->name, alt->engine->name);
+
+        if (ref->status != alt->status || ref->exit_code != alt->exit_code
+            || strcmp(ref->fault, alt->fault) != 0)
+        {
+            printf("  status: ");
+            print_status(ref);
+            printf(" vs ");
+            print_status(alt);
+            printf("\n");
+        }
+        if (ref->ctx.PC != alt->ctx.PC) printf("  PC: %u vs %u\n", ref->ctx.PC, alt->ctx.PC);
+        for (int r = 0; r < NUM_REGISTERS; r++)
+        {
+            if (ref->ctx.GPR[r] != alt->ctx.GPR[r])
+            {
+                printf("  GPR[%s]: %d vs %d\n", regname_get(r), ref->ctx.GPR[r], alt->ctx.GPR[r]);
+            }
+        }
+        if (ref->ctx.HI != alt->ctx.HI) printf("  HI: %d vs %d\n", ref->ctx.HI, alt->ctx.HI);
+        if (ref->ctx.LO != alt->ctx.LO) printf("  LO: %d vs %d\n", ref->ctx.LO, alt->ctx.LO);
+        if (ref->output_len != alt->output_len || memcmp(ref->output, alt->output, ref->output_len) != 0)
+        {
+            printf("  output: \"%.*s\" vs \"%.*s\"\n", (int) ref->output_len, ref->output,
+                   (int) alt->output_len, alt->output);
+        }
+        if (ref->hash != alt->hash)
+        {
+            printf("  dirty memory hash: %016llx vs %016llx\n",
+                   (unsigned long long) ref->hash, (unsigned long long) alt->hash);
+
+            size_t words = paging_page_bytes() / sizeof(word_type);
+            for (unsigned int p = 0; p < paging_num_pages(); p++)
+            {
+                if (!dirty[p]) continue;
+                for (size_t w = 0; w < words; w++)
+                {
+                    if (ref->mem.pages[p][w] != alt->mem.pages[p][w])
+                    {
+                        printf("  memory[%zu]: %d vs %d\n", p * words + w,
+                               ref->mem.pages[p][w], alt->mem.pages[p][w]);
+                    }
+                }
+            }
+        }
+    }
+}
+
+int cosim_run(const char* bof_name, unsigned long long limit)
+{
+    vm_image* image = paging_load_image(bof_name);
+
+    engine_state states[NUM_ENGINES];
+    memset(states, 0, sizeof(states));
+    for (int i = 0; i < NUM_ENGINES; i++)
+    {
+        states[i].engine = &engines[i];
+        paging_attach(&states[i].mem, image);
+        states[i].ctx = image->regs;
+        // Only the program's own output is compared.
+        states[i].ctx.trace_program = false;
+        states[i].out = open_memstream(&states[i].output, &states[i].output_len);
+        if (states[i].out == NULL)
+        {
+            bail_with_error("Unable to capture the output of the %s engine!", engines[i].name);
+        }
+    }
+
+    // The verified engine is only correct for programs the verifier accepts.
+    paging_swap_in(&states[0].mem);
+    vm_restore_registers(&states[0].ctx);
+    char problem[256];
+    if (!verify_program(problem, sizeof(problem)))
+    {
+        bail_with_error("%s: %s", bof_name, problem);
+    }
+
+    unsigned char* dirty = malloc(paging_num_pages());
+    if (dirty == NULL)
+    {
+        bail_with_error("Unable to allocate memory for co-simulation!");
+    }
+
+    vm_read_char = cosim_read_char;
+    unsigned long long count = 0;
+    unsigned long long blocks = 0;
+
+    while (limit == 0 || count < limit)
+    {
+        // Every engine runs the same basic block, as the reference sees it.
+        address_type pc = states[0].ctx.PC;
+        unsigned long long len = pc < num_instrs ? block_lengths[pc] : 1;
+        if (limit != 0 && limit - count < len) len = limit - count;
+
+        memset(dirty, 0, paging_num_pages());
+        input_len = 0;
+        for (running = 0; running < NUM_ENGINES; running++)
+        {
+            input_pos = 0;
+            run_block(&states[running], len, dirty);
+        }
+        count += states[0].instrs;
+        blocks++;
+
+        for (int i = 0; i < NUM_ENGINES; i++)
+        {
+            states[i].hash = hash_dirty(&states[i].mem, dirty);
+        }
+        for (int i = 1; i < NUM_ENGINES; i++)
+        {
+            if (!same_state(&states[0], &states[i]))
+            {
+                fflush(stdout);
+                report_mismatch(states, dirty, pc, count);
+                return EXIT_FAILURE;
+            }
+        }
+
+        fwrite(states[0].output, 1, states[0].output_len, stdout);
+        if (states[0].status != VM_YIELDED) break;
+    }
+
+    fflush(stdout);
+    if (DEBUG) printf("DEBUG: engines agreed on %llu blocks\n", blocks);
+    if (states[0].status == VM_FAULTED)
+    {
+        fprintf(stderr, "Both engines faulted after %llu instructions: %s\n", count, states[0].fault);
+        return EXIT_FAILURE;
+    }
+    fprintf(stderr, "Engines agreed on %llu instructions in %llu blocks.\n", count, blocks);
+    return EXIT_SUCCESS;
+}
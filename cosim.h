@@ -0,0 +1,27 @@
+#ifndef _COSIM_H
+#define _COSIM_H
+#include "machine.h"
+
+// One way of executing instructions. run executes at most n instructions
+// of the program whose state is in the VM, like vm_run_for.
+typedef struct
+{
+    const char* name;
+    vm_status (*run)(unsigned long long n);
+} cosim_engine;
+
+// Pre-Condition: bof_name names a valid binary object file that passes
+// verify_program. limit is 0 for no limit.
+// Post-Condition: Runs the program under the reference engine, which
+// checks every instruction with execute_instruction, and under the
+// verified engine side by side, one basic block at a time. Both start
+// from the same loaded image; the alternate engine replays the input the
+// reference read. After each block, compares the status, PC, GPRs, HI,
+// LO, the output written and a hash of the memory pages either engine
+// dirtied. At the first mismatch, prints both states with print_state
+// and what differs. Only the reference's output reaches stdout, and the
+// program is not traced. Returns EXIT_SUCCESS if the engines agreed
+// until the program exited or limit instructions ran.
+extern int cosim_run(const char* bof_name, unsigned long long limit);
+
+#endif
@@ -0,0 +1,323 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include "coverage.h"
+#include "machine.h"
+#include "machine_types.h"
+#include "instruction.h"
+#include "bof.h"
+#include "utilities.h"
+
+#define DEBUG 0
+
+// Longest message describing a coverage file that cannot be used.
+#define COVERAGE_PROBLEM_SIZE 256
+
+// 64-bit words in a bitmap with one bit per address.
+#define BITMAP_WORDS (MEMORY_SIZE_IN_WORDS / 64)
+
+#define SET_BIT(map, a) ((map)[(a) / 64] |= 1ull << ((a) % 64))
+#define GET_BIT(map, a) ((bool) (((map)[(a) / 64] >> ((a) % 64)) & 1))
+
+// Start of a coverage file. The three bitmaps follow, each cut down to
+// words 64-bit words.
+typedef struct
+{
+    char magic[4];
+    uint32_t version;
+    uint64_t key;
+    uint32_t num_instrs;
+    uint32_t words;
+} coverage_header;
+
+// Coverage of one program, indexed by address.
+typedef struct
+{
+    uint64_t executed[BITMAP_WORDS];
+    uint64_t taken[BITMAP_WORDS];
+    uint64_t not_taken[BITMAP_WORDS];
+} coverage_maps;
+
+static coverage_maps collected;
+static const char* coverage_path = NULL;
+
+// Identifies the program, taken from its text when it first runs so that
+// coverage of different programs is never merged.
+static bool have_key = false;
+static uint64_t program_key = 0;
+static unsigned int program_instrs = 0;
+
+// Addresses of the program's conditional branches, and of those whose
+// target is the next instruction, which go there either way.
+static uint64_t branches[BITMAP_WORDS];
+static uint64_t to_next[BITMAP_WORDS];
+
+// Pre-Condition: A program has been loaded.
+// Post-Condition: Returns a 64-bit FNV-1a hash of its text.
+static uint64_t text_key()
+{
+    uint64_t hash = 14695981039346656037ull;
+    const unsigned char* bytes = (const unsigned char*) vm_memory->instrs;
+    for (size_t i = 0; i < num_instrs * sizeof(bin_instr_t); i++)
+    {
+        hash = (hash ^ bytes[i]) * 1099511628211ull;
+    }
+    return (hash ^ num_instrs) * 1099511628211ull;
+}
+
+static bool is_branch(bin_instr_t instr)
+{
+    return instruction_type(instr) == immed_instr_type
+           && instr.immed.op >= BEQ_O && instr.immed.op <= BNE_O;
+}
+
+// Pre-Condition: first <= last < MEMORY_SIZE_IN_WORDS.
+// Post-Condition: Sets the bits of map for addresses first to last.
+static void set_bits(uint64_t* map, address_type first, address_type last)
+{
+    while (first <= last)
+    {
+        unsigned int shift = first % 64;
+        unsigned int count = last - first + 1 < 64 - shift ? last - first + 1 : 64 - shift;
+        uint64_t mask = count == 64 ? ~0ull : ((1ull << count) - 1) << shift;
+        map[first / 64] |= mask;
+        first += count;
+    }
+}
+
+static void record(address_type first, address_type last, address_type next)
+{
+    if (first >= num_instrs) return;
+    bool whole = last < num_instrs;
+    if (!whole) last = num_instrs - 1;
+
+    set_bits(collected.executed, first, last);
+    if (!whole || !GET_BIT(branches, last)) return;
+
+    if (next != last + 1 || GET_BIT(to_next, last)) SET_BIT(collected.taken, last);
+    if (next == last + 1) SET_BIT(collected.not_taken, last);
+}
+
+// Pre-Condition: Nothing has been recorded yet.
+// Post-Condition: Identifies the program and finds its branches, so that
+// recording a block needs no decoding, then records like record from now on.
+static void first_record(address_type first, address_type last, address_type next)
+{
+    program_key = text_key();
+    program_instrs = num_instrs;
+    for (address_type a = 0; a < num_instrs; a++)
+    {
+        if (!is_branch(vm_memory->instrs[a])) continue;
+        SET_BIT(branches, a);
+        if (machine_types_formOffset(vm_memory->instrs[a].immed.immed) == 1) SET_BIT(to_next, a);
+    }
+    have_key = true;
+
+    vm_coverage_hook = record;
+    record(first, last, next);
+}
+
+// Pre-Condition: fd is open on the coverage file at path and locked, and
+// problem has room for COVERAGE_PROBLEM_SIZE characters.
+// Post-Condition: ORs the coverage it holds into maps; an empty file holds
+// none. Returns false, describing the problem, if it is not coverage of
+// the program with the given key.
+static bool read_coverage(int fd, const char* path, coverage_maps* maps, uint64_t key, char* problem)
+{
+    coverage_header header;
+    ssize_t got = pread(fd, &header, sizeof(header), 0);
+    if (got == 0) return true;
+    if (got != sizeof(header) || memcmp(header.magic, COVERAGE_MAGIC, sizeof(header.magic)) != 0
+        || header.version != COVERAGE_VERSION || header.words > BITMAP_WORDS)
+    {
+        snprintf(problem, COVERAGE_PROBLEM_SIZE, "%s is not a coverage file!", path);
+        return false;
+    }
+    if (header.key != key)
+    {
+        snprintf(problem, COVERAGE_PROBLEM_SIZE, "%s holds coverage of a different program!", path);
+        return false;
+    }
+
+    uint64_t* targets[] = { maps->executed, maps->taken, maps->not_taken };
+    uint64_t bits[BITMAP_WORDS];
+    size_t bytes = header.words * sizeof(uint64_t);
+    for (int m = 0; m < 3; m++)
+    {
+        if (pread(fd, bits, bytes, sizeof(header) + m * bytes) != (ssize_t) bytes)
+        {
+            snprintf(problem, COVERAGE_PROBLEM_SIZE, "Coverage file %s is truncated!", path);
+            return false;
+        }
+        for (uint32_t w = 0; w < header.words; w++)
+        {
+            targets[m][w] |= bits[w];
+        }
+    }
+    return true;
+}
+
+// Pre-Condition: fd is open on the coverage file at path and locked.
+// Post-Condition: Replaces its contents with maps. Returns false if that
+// fails.
+static bool write_coverage(int fd, const coverage_maps* maps)
+{
+    coverage_header header;
+    memcpy(header.magic, COVERAGE_MAGIC, sizeof(header.magic));
+    header.version = COVERAGE_VERSION;
+    header.key = program_key;
+    header.num_instrs = program_instrs;
+    header.words = (program_instrs + 63) / 64;
+
+    const uint64_t* sources[] = { maps->executed, maps->taken, maps->not_taken };
+    size_t bytes = header.words * sizeof(uint64_t);
+    bool ok = pwrite(fd, &header, sizeof(header), 0) == sizeof(header);
+    for (int m = 0; m < 3 && ok; m++)
+    {
+        ok = pwrite(fd, sources[m], bytes, sizeof(header) + m * bytes) == (ssize_t) bytes;
+    }
+    return ok && ftruncate(fd, sizeof(header) + 3 * bytes) == 0;
+}
+
+// Pre-Condition: Called from coverage_save, while the process exits.
+// Post-Condition: Reports problem and ends the process at once, since
+// bail_with_error would call exit again from inside an atexit handler.
+static void save_failed(const char* problem)
+{
+    fflush(stdout);
+    fprintf(stderr, "%s\n", problem);
+    _exit(EXIT_FAILURE);
+}
+
+// Pre-Condition: coverage_enable has run. Registered with atexit, since
+// the program ends by exiting.
+// Post-Condition: Merges this run's coverage into the coverage file.
+static void coverage_save()
+{
+    // Nothing ran, so there is nothing to add.
+    if (!have_key) return;
+
+    char problem[COVERAGE_PROBLEM_SIZE];
+    int fd = open(coverage_path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0)
+    {
+        snprintf(problem, sizeof(problem), "Unable to open coverage file %s!", coverage_path);
+        save_failed(problem);
+    }
+    // Other runs may be merging into the same file.
+    if (flock(fd, LOCK_EX) != 0)
+    {
+        snprintf(problem, sizeof(problem), "Unable to lock coverage file %s!", coverage_path);
+        save_failed(problem);
+    }
+
+    if (!read_coverage(fd, coverage_path, &collected, program_key, problem)) save_failed(problem);
+    if (!write_coverage(fd, &collected))
+    {
+        snprintf(problem, sizeof(problem), "Unable to write coverage file %s!", coverage_path);
+        save_failed(problem);
+    }
+    close(fd);
+
+    if (DEBUG) printf("DEBUG: saved coverage of %u instructions to %s\n", program_instrs, coverage_path);
+}
+
+void coverage_enable(const char* path)
+{
+    coverage_path = path;
+    vm_coverage_hook = first_record;
+    atexit(coverage_save);
+}
+
+static double percent(unsigned int n, unsigned int of)
+{
+    return of == 0 ? 0.0 : 100.0 * n / of;
+}
+
+int coverage_report(const char* bof_name, int num_paths, char* paths[], const char* lcov_path, FILE* out)
+{
+    BOFFILE bof = bof_read_open(bof_name);
+    load_bof(bof);
+    bof_close(bof);
+    uint64_t key = text_key();
+
+    static coverage_maps maps;
+    for (int i = 0; i < num_paths; i++)
+    {
+        int fd = open(paths[i], O_RDONLY);
+        if (fd < 0 || flock(fd, LOCK_SH) != 0)
+        {
+            bail_with_error("Unable to open coverage file %s!", paths[i]);
+        }
+        char problem[COVERAGE_PROBLEM_SIZE];
+        if (!read_coverage(fd, paths[i], &maps, key, problem))
+        {
+            bail_with_error("%s", problem);
+        }
+        close(fd);
+    }
+
+    unsigned int ran = 0;
+    unsigned int branches = 0;
+    unsigned int both_ways = 0;
+    unsigned int outcomes = 0;
+
+    fprintf(out, "%-5s", "Cov");
+    instruction_print_table_heading(out);
+    for (address_type a = 0; a < num_instrs; a++)
+    {
+        bool executed = GET_BIT(maps.executed, a);
+        char mark[4] = { executed ? '+' : '-', '\0' };
+        if (executed) ran++;
+
+        if (is_branch(vm_memory->instrs[a]))
+        {
+            bool taken = GET_BIT(maps.taken, a);
+            bool not_taken = GET_BIT(maps.not_taken, a);
+            mark[1] = taken ? 'T' : ' ';
+            mark[2] = not_taken ? 'N' : ' ';
+            branches++;
+            outcomes += taken + not_taken;
+            if (taken && not_taken) both_ways++;
+        }
+
+        fprintf(out, "%-5s", mark);
+        instruction_print(out, a, vm_memory->instrs[a]);
+    }
+    fprintf(out, "Instructions run: %u of %u (%.1f%%)\n", ran, num_instrs, percent(ran, num_instrs));
+    fprintf(out, "Branches taken both ways: %u of %u (%.1f%%)\n", both_ways, branches,
+            percent(both_ways, branches));
+
+    if (lcov_path == NULL) return EXIT_SUCCESS;
+
+    FILE* lcov = fopen(lcov_path, "w");
+    if (lcov == NULL)
+    {
+        bail_with_error("Unable to open lcov file %s!", lcov_path);
+    }
+    fprintf(lcov, "TN:\nSF:%s\n", bof_name);
+    for (address_type a = 0; a < num_instrs; a++)
+    {
+        if (!is_branch(vm_memory->instrs[a])) continue;
+
+        // lcov writes "-" for branches whose line never ran.
+        bool executed = GET_BIT(maps.executed, a);
+        fprintf(lcov, "BRDA:%u,0,0,%s\n", a + 1, !executed ? "-" : GET_BIT(maps.taken, a) ? "1" : "0");
+        fprintf(lcov, "BRDA:%u,0,1,%s\n", a + 1, !executed ? "-" : GET_BIT(maps.not_taken, a) ? "1" : "0");
+    }
+    fprintf(lcov, "BRF:%u\nBRH:%u\n", 2 * branches, outcomes);
+    for (address_type a = 0; a < num_instrs; a++)
+    {
+        fprintf(lcov, "DA:%u,%d\n", a + 1, GET_BIT(maps.executed, a));
+    }
+    fprintf(lcov, "LF:%u\nLH:%u\nend_of_record\n", num_instrs, ran);
+    if (fclose(lcov) != 0)
+    {
+        bail_with_error("Unable to write lcov file %s!", lcov_path);
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,29 @@
+#ifndef _COVERAGE_H
+#define _COVERAGE_H
+#include <stdio.h>
+
+// Magic number and format version at the start of coverage files.
+#define COVERAGE_MAGIC "SRMC"
+#define COVERAGE_VERSION 1
+
+// Pre-Condition: No vm_access_hook is set, since the observed loop does
+// not report coverage. Every run is of the same program.
+// Post-Condition: Keeps one bit per instruction in the text, set once it
+// has run, and two bits per conditional branch (BEQ_O to BNE_O), set once
+// it has been taken and once it has fallen through. When the process
+// exits, ORs them into the coverage file at path, creating it if needed,
+// so that many runs, even at once, add up to one file. If that fails, the
+// process exits with a failure status after saying why.
+extern void coverage_enable(const char* path);
+
+// Pre-Condition: bof_name names a valid binary object file, and paths
+// names num_paths coverage files written for it.
+// Post-Condition: Merges the files and prints every instruction as
+// print_all_instrs would, each preceded by whether it ran and which ways
+// a branch went, followed by a summary. If lcov_path is not NULL, also
+// writes an lcov tracefile there, with address a as line a + 1 and each
+// conditional branch as a pair of lcov branches. Returns EXIT_SUCCESS.
+extern int coverage_report(const char* bof_name, int num_paths, char* paths[], const char* lcov_path,
+                           FILE* out);
+
+#endif
@@ -0,0 +1,210 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "debugger.h"
+#include "machine.h"
+#include "instruction.h"
+#include "watch.h"
+#include "utilities.h"
+
+#define DEBUG 0
+
+// A breakpoint replaces the word at its address with the trap instruction
+// and remembers the word it replaced.
+typedef struct
+{
+    address_type addr;
+    bin_instr_t original;
+} breakpoint;
+
+static breakpoint breakpoints[MAX_BREAKPOINTS];
+static int num_breakpoints = 0;
+static FILE* command_file = NULL;
+static bool interactive = false;
+static void (*previous_hook)(void) = NULL;
+
+// Set by a step command, so that resuming from a stop knows the
+// instruction it stopped at has already run.
+static bool stepped = false;
+
+// Pre-Condition: None.
+// Post-Condition: Returns the index of the breakpoint at addr, or -1.
+static int find_breakpoint(address_type addr)
+{
+    for (int i = 0; i < num_breakpoints; i++)
+    {
+        if (breakpoints[i].addr == addr) return i;
+    }
+    return -1;
+}
+
+// Pre-Condition: None.
+// Post-Condition: Returns the trap instruction that marks a breakpoint.
+static bin_instr_t trap_instr()
+{
+    bin_instr_t trap;
+    memset(&trap, 0, sizeof(trap));
+    trap.syscall.op = OTHC_O;
+    trap.syscall.func = SYS_F;
+    trap.syscall.code = BREAKPOINT_SC;
+    return trap;
+}
+
+bin_instr_t debugger_original_instr(address_type addr)
+{
+    int i = find_breakpoint(addr);
+    if (i >= 0) return breakpoints[i].original;
+    return vm_memory->instrs[addr];
+}
+
+// Pre-Condition: None.
+// Post-Condition: Patches a breakpoint in at addr, unless one is there.
+static void set_breakpoint(address_type addr)
+{
+    if (addr >= num_instrs)
+    {
+        fprintf(stderr, "Address %u is not in the program text (0..%u)\n", addr, num_instrs - 1);
+        return;
+    }
+    if (find_breakpoint(addr) >= 0) return;
+    if (num_breakpoints == MAX_BREAKPOINTS)
+    {
+        fprintf(stderr, "Too many breakpoints (at most %d)\n", MAX_BREAKPOINTS);
+        return;
+    }
+
+    breakpoints[num_breakpoints].addr = addr;
+    breakpoints[num_breakpoints].original = vm_memory->instrs[addr];
+    num_breakpoints++;
+    vm_memory->instrs[addr] = trap_instr();
+}
+
+// Pre-Condition: None.
+// Post-Condition: Puts back the original word at addr and forgets the
+// breakpoint there, if any.
+static void delete_breakpoint(address_type addr)
+{
+    int i = find_breakpoint(addr);
+    if (i < 0) return;
+
+    // Watchpoint traps are settled before the program stops, so the word
+    // here is the breakpoint's own trap.
+    vm_memory->instrs[addr] = breakpoints[i].original;
+    breakpoints[i] = breakpoints[--num_breakpoints];
+}
+
+// Pre-Condition: None.
+// Post-Condition: Prints the instruction at PC and the VM state.
+static void show_stop()
+{
+    printf("==>      %u: %s\n", PC, instruction_assembly_form(PC, debugger_original_instr(PC)));
+    print_state();
+}
+
+// Pre-Condition: PC is a text address.
+// Post-Condition: Executes the instruction at PC as if no breakpoint were
+// patched over it, tracing and recording it like any other. A watched
+// store it makes is reported right away, so no watchpoint trap is left
+// behind for the debugger to stop on.
+static void step_original()
+{
+    vm_step_instruction(debugger_original_instr(PC));
+    watch_settle(PC);
+}
+
+// Pre-Condition: The program is stopped.
+// Post-Condition: Reads and runs commands until one resumes the program.
+static void command_loop()
+{
+    char line[128];
+
+    while (true)
+    {
+        if (interactive)
+        {
+            fprintf(stderr, "(vm) ");
+            fflush(stderr);
+        }
+        fflush(stdout);
+
+        if (fgets(line, sizeof(line), command_file) == NULL) return;
+
+        char cmd = line[0];
+        unsigned int addr = 0;
+        bool has_addr = sscanf(line + 1, "%u", &addr) == 1;
+
+        switch (cmd)
+        {
+            case 'b':
+                if (has_addr) set_breakpoint(addr);
+                break;
+            case 'd':
+                if (has_addr) delete_breakpoint(addr);
+                break;
+            case 'l':
+                for (int i = 0; i < num_breakpoints; i++)
+                {
+                    printf("breakpoint at %u: %s\n", breakpoints[i].addr,
+                           instruction_assembly_form(breakpoints[i].addr, breakpoints[i].original));
+                }
+                break;
+            case 'p':
+                show_stop();
+                break;
+            case 's':
+                step_original();
+                stepped = true;
+                show_stop();
+                break;
+            case 'c':
+                return;
+            case 'q':
+                exit(EXIT_SUCCESS);
+            case '\n':
+            case '#':
+                break;
+            default:
+                fprintf(stderr, "Unknown debugger command: %s", line);
+                break;
+        }
+    }
+}
+
+// Pre-Condition: The trap at PC was just executed and PC points back at it.
+// Post-Condition: Shows the stop, runs commands, and then executes the
+// original instruction so the breakpoint stays armed for the next hit.
+static void on_breakpoint()
+{
+    // A watchpoint's trap goes first, even where a breakpoint is set: it
+    // reports the store and puts the breakpoint's trap back.
+    if (watch_settle(PC) && find_breakpoint(PC) < 0) return;
+
+    // Other traps patched in by someone else are theirs.
+    if (find_breakpoint(PC) < 0 && previous_hook != NULL)
+    {
+        previous_hook();
+        return;
+    }
+
+    if (DEBUG) printf("DEBUG: breakpoint hit at %u\n", PC);
+
+    show_stop();
+    stepped = false;
+    command_loop();
+
+    // Step over the patched word, unless a step command already ran it.
+    // Then PC is wherever the steps left it, and a breakpoint there stops
+    // the program again as soon as it resumes.
+    if (!stepped && find_breakpoint(PC) >= 0) step_original();
+}
+
+void debugger_start(FILE* commands)
+{
+    command_file = commands;
+    interactive = isatty(fileno(commands));
+    previous_hook = vm_breakpoint_hook;
+    vm_breakpoint_hook = on_breakpoint;
+
+    command_loop();
+}
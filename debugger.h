@@ -0,0 +1,26 @@
+#ifndef _DEBUGGER_H
+#define _DEBUGGER_H
+#include <stdio.h>
+#include <stdbool.h>
+#include "machine.h"
+
+// Most breakpoints that can be set at once.
+#define MAX_BREAKPOINTS 64
+
+// Pre-Condition: A program has been loaded and commands is open for reading.
+// Post-Condition: Installs the debugger and reads commands from commands
+// until one starts the program. Commands are:
+//   b ADDR  set a breakpoint        d ADDR  delete a breakpoint
+//   l       list breakpoints        p       print the VM state
+//   s       step one instruction    c       continue
+//   q       quit
+// Once commands run out the program no longer stops, but each breakpoint
+// hit still prints the VM state.
+extern void debugger_start(FILE* commands);
+
+// Pre-Condition: addr is a text address.
+// Post-Condition: Returns the instruction at addr as the program sees it,
+// looking through any breakpoint patched over it.
+extern bin_instr_t debugger_original_instr(address_type addr);
+
+#endif
@@ -0,0 +1,438 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "disasm.h"
+#include "machine.h"
+#include "instruction.h"
+#include "utilities.h"
+
+#define DEBUG 0
+
+// Growable output buffer.
+typedef struct
+{
+    char* text;
+    size_t len;
+    size_t cap;
+} text_buffer;
+
+// Assembly form of one instruction encoding, kept in the table's arena.
+typedef struct
+{
+    uint32_t word;
+    uint32_t offset;
+    uint32_t len;
+    bool used;
+} form_entry;
+
+// Assembly forms already made for encodings whose form does not depend
+// on their address. Generated programs repeat a few encodings many times.
+typedef struct
+{
+    form_entry* entries;
+    uint32_t mask;
+    text_buffer arena;
+} form_table;
+
+// What newline writes, captured once so it can be copied into buffers.
+static char newline_text[8];
+static size_t newline_len = 0;
+
+// True if instruction_print writes "%6u: " before the assembly form and a
+// newline after it, so lines can be built without it.
+static bool fast_lines = false;
+
+static void reserve(text_buffer* buf, size_t more)
+{
+    if (buf->len + more <= buf->cap) return;
+
+    while (buf->len + more > buf->cap)
+    {
+        buf->cap = buf->cap == 0 ? 65536 : buf->cap * 2;
+    }
+    buf->text = realloc(buf->text, buf->cap);
+    if (buf->text == NULL)
+    {
+        bail_with_error("Unable to allocate memory for the disassembly!");
+    }
+}
+
+static void append(text_buffer* buf, const char* text, size_t len)
+{
+    reserve(buf, len);
+    memcpy(buf->text + buf->len, text, len);
+    buf->len += len;
+}
+
+// Pre-Condition: None.
+// Post-Condition: Appends v right-aligned in width characters, like
+// printf's %*lld. Returns the number of characters appended.
+static size_t append_int(text_buffer* buf, long long v, int width)
+{
+    char digits[24];
+    int n = 0;
+    unsigned long long mag = v < 0 ? 0ull - (unsigned long long) v : (unsigned long long) v;
+    do
+    {
+        digits[n++] = (char) ('0' + mag % 10);
+        mag /= 10;
+    } while (mag > 0);
+    if (v < 0) digits[n++] = '-';
+
+    int pad = width > n ? width - n : 0;
+    size_t total = pad + n;
+    reserve(buf, total);
+    memset(buf->text + buf->len, ' ', pad);
+    buf->len += pad;
+    while (n > 0) buf->text[buf->len++] = digits[--n];
+    return total;
+}
+
+// Pre-Condition: f is open for writing and print writes to it.
+// Post-Condition: Runs print on a memory stream and returns what it wrote
+// in a malloc'd string, setting *len to its length.
+static char* capture(void (*print)(FILE* f, address_type addr), address_type addr, size_t* len)
+{
+    char* text = NULL;
+    FILE* f = open_memstream(&text, len);
+    if (f == NULL)
+    {
+        bail_with_error("Unable to allocate memory for the disassembly!");
+    }
+    print(f, addr);
+    fclose(f);
+    return text;
+}
+
+static void print_newline(FILE* f, address_type addr)
+{
+    (void) addr;
+    newline(f);
+}
+
+static void print_instr(FILE* f, address_type addr)
+{
+    instruction_print(f, addr, vm_memory->instrs[addr]);
+}
+
+// Pre-Condition: None.
+// Post-Condition: Returns true if the assembly form of instr is the same
+// at every address.
+static bool form_is_fixed(bin_instr_t instr)
+{
+    switch (instruction_type(instr))
+    {
+        case comp_instr_type:
+        case syscall_instr_type:
+            return true;
+        case immed_instr_type:
+            return instr.immed.op < BEQ_O;
+        default:
+            return false;
+    }
+}
+
+// Pre-Condition: addr < num_instrs.
+// Post-Condition: Appends the line instruction_print would write for the
+// instruction at addr.
+static void append_line(text_buffer* buf, form_table* forms, address_type addr)
+{
+    bin_instr_t instr = vm_memory->instrs[addr];
+
+    if (!fast_lines)
+    {
+        size_t len;
+        char* line = capture(print_instr, addr, &len);
+        append(buf, line, len);
+        free(line);
+        return;
+    }
+
+    append_int(buf, addr, 6);
+    append(buf, ": ", 2);
+
+    if (!form_is_fixed(instr))
+    {
+        const char* form = instruction_assembly_form(addr, instr);
+        append(buf, form, strlen(form));
+    }
+    else
+    {
+        uint32_t word;
+        memcpy(&word, &instr, sizeof(word));
+        uint32_t slot = (word * 2654435761u) & forms->mask;
+        while (forms->entries[slot].used && forms->entries[slot].word != word)
+        {
+            slot = (slot + 1) & forms->mask;
+        }
+
+        form_entry* entry = &forms->entries[slot];
+        if (!entry->used)
+        {
+            const char* form = instruction_assembly_form(addr, instr);
+            entry->used = true;
+            entry->word = word;
+            entry->offset = forms->arena.len;
+            entry->len = strlen(form);
+            append(&forms->arena, form, entry->len);
+        }
+        append(buf, forms->arena.text + entry->offset, entry->len);
+    }
+
+    append(buf, "\n", 1);
+}
+
+// Pre-Condition: first <= last <= num_instrs.
+// Post-Condition: Appends the lines of the instructions from first up to
+// but not including last.
+static void append_instrs(text_buffer* buf, address_type first, address_type last)
+{
+    form_table forms;
+    uint32_t size = 1;
+    while (size < 2 * (last - first)) size *= 2;
+    forms.entries = calloc(size, sizeof(form_entry));
+    forms.mask = size - 1;
+    forms.arena = (text_buffer) { NULL, 0, 0 };
+    if (forms.entries == NULL)
+    {
+        bail_with_error("Unable to allocate memory for the disassembly!");
+    }
+
+    reserve(buf, (size_t) (last - first) * 32);
+    for (address_type addr = first; addr < last; addr++)
+    {
+        append_line(buf, &forms, addr);
+    }
+
+    free(forms.entries);
+    free(forms.arena.text);
+}
+
+// Pre-Condition: Global data has been loaded.
+// Post-Condition: Appends what print_global_data writes.
+static void append_globals(text_buffer* buf)
+{
+    int global_start = GPR[GP];
+    int global_end = GPR[SP] - 1;
+
+    int num_chars = 0;
+    bool printing_dots = false;
+
+    // "%11s     " of "...".
+    static const char dots[] = "        ...     ";
+
+    for (int i = global_start; i <= global_end; i++)
+    {
+        if (vm_memory->words[i] != 0)
+        {
+            if (printing_dots)
+            {
+                num_chars = 0;
+                printing_dots = false;
+            }
+
+            num_chars += append_int(buf, i, 8);
+            append(buf, ": ", 2);
+            num_chars += 2 + append_int(buf, vm_memory->words[i], 0);
+            append(buf, "\t", 1);
+            num_chars++;
+        }
+        else if (!printing_dots)
+        {
+            num_chars += append_int(buf, i, 8);
+            append(buf, ": 0\t", 4);
+            num_chars += 4;
+
+            if (vm_memory->words[i + 1] == 0 && i + 1 <= global_end)
+            {
+                if (num_chars > MAX_PRINT_WIDTH)
+                {
+                    append(buf, newline_text, newline_len);
+                    num_chars = 0;
+                }
+
+                append(buf, dots, sizeof(dots) - 1);
+                num_chars += sizeof(dots) - 1;
+                printing_dots = true;
+            }
+        }
+
+        if (num_chars >= MAX_PRINT_WIDTH)
+        {
+            append(buf, newline_text, newline_len);
+            num_chars = 0;
+        }
+    }
+
+    append(buf, newline_text, newline_len);
+}
+
+// Pre-Condition: None.
+// Post-Condition: Records how newline and instruction_print format text.
+static void calibrate()
+{
+    size_t len;
+    char* text = capture(print_newline, 0, &len);
+    if (len > sizeof(newline_text))
+    {
+        bail_with_error("Unexpectedly long newline!");
+    }
+    memcpy(newline_text, text, len);
+    newline_len = len;
+    free(text);
+
+    // Check the line format on the first and last instructions.
+    fast_lines = true;
+    address_type probes[2] = { 0, num_instrs > 0 ? num_instrs - 1 : 0 };
+    for (int i = 0; i < 2 && num_instrs > 0; i++)
+    {
+        char* expected = capture(print_instr, probes[i], &len);
+
+        text_buffer line = { NULL, 0, 0 };
+        form_table none = { NULL, 0, { NULL, 0, 0 } };
+        if (form_is_fixed(vm_memory->instrs[probes[i]]))
+        {
+            none.entries = calloc(1, sizeof(form_entry));
+            if (none.entries == NULL)
+            {
+                bail_with_error("Unable to allocate memory for the disassembly!");
+            }
+        }
+        append_line(&line, &none, probes[i]);
+
+        if (line.len != len || memcmp(line.text, expected, len) != 0) fast_lines = false;
+        free(none.entries);
+        free(none.arena.text);
+        free(line.text);
+        free(expected);
+    }
+
+    if (DEBUG) printf("DEBUG: %s disassembly lines\n", fast_lines ? "fast" : "captured");
+}
+
+// Pre-Condition: fd is open.
+// Post-Condition: Writes all len bytes of text. Returns false on failure.
+static bool write_all(int fd, const char* text, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t n = write(fd, text, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        text += n;
+        len -= n;
+    }
+    return true;
+}
+
+// Pre-Condition: fd is open.
+// Post-Condition: Appends everything read from fd until end of file.
+// Returns false on a read error.
+static bool read_all(int fd, text_buffer* buf)
+{
+    while (true)
+    {
+        reserve(buf, 65536);
+        ssize_t n = read(fd, buf->text + buf->len, buf->cap - buf->len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) return false;
+        if (n == 0) return true;
+        buf->len += n;
+    }
+}
+
+// Pre-Condition: out has been flushed.
+// Post-Condition: Writes the instructions to out, disassembling chunks of
+// them in num_workers worker processes at once. A chunk whose worker
+// could not start or failed is disassembled here instead.
+static void print_instrs_parallel(FILE* out, int num_workers)
+{
+    pid_t pids[DISASM_MAX_WORKERS];
+    int fds[DISASM_MAX_WORKERS];
+    address_type bounds[DISASM_MAX_WORKERS + 1];
+
+    for (int w = 0; w <= num_workers; w++)
+    {
+        bounds[w] = (address_type) ((unsigned long long) num_instrs * w / num_workers);
+    }
+
+    for (int w = 0; w < num_workers; w++)
+    {
+        int pipe_fds[2];
+        pids[w] = -1;
+        fds[w] = -1;
+        if (pipe(pipe_fds) != 0) continue;
+
+        pids[w] = fork();
+        if (pids[w] == 0)
+        {
+            close(pipe_fds[0]);
+            text_buffer buf = { NULL, 0, 0 };
+            append_instrs(&buf, bounds[w], bounds[w + 1]);
+            _exit(write_all(pipe_fds[1], buf.text, buf.len) ? EXIT_SUCCESS : EXIT_FAILURE);
+        }
+
+        close(pipe_fds[1]);
+        if (pids[w] < 0) close(pipe_fds[0]);
+        else fds[w] = pipe_fds[0];
+    }
+
+    // Collect each chunk whole before writing it, so a failed worker can
+    // be replaced without leaving part of its chunk in the output.
+    text_buffer buf = { NULL, 0, 0 };
+    for (int w = 0; w < num_workers; w++)
+    {
+        buf.len = 0;
+        bool ok = false;
+        if (pids[w] > 0)
+        {
+            int status;
+            ok = read_all(fds[w], &buf);
+            close(fds[w]);
+            ok = waitpid(pids[w], &status, 0) == pids[w] && ok
+                 && WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS;
+        }
+        if (!ok)
+        {
+            if (DEBUG) printf("DEBUG: disassembling chunk %d serially\n", w);
+            buf.len = 0;
+            append_instrs(&buf, bounds[w], bounds[w + 1]);
+        }
+        fwrite(buf.text, 1, buf.len, out);
+    }
+    free(buf.text);
+}
+
+void disasm_print_program(FILE* out)
+{
+    instruction_print_table_heading(out);
+    calibrate();
+
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    long num_workers = num_instrs / DISASM_CHUNK_MIN;
+    if (num_workers > cpus) num_workers = cpus;
+    if (num_workers > DISASM_MAX_WORKERS) num_workers = DISASM_MAX_WORKERS;
+
+    if (num_workers >= 2)
+    {
+        // Workers must not inherit unwritten output.
+        fflush(out);
+        print_instrs_parallel(out, num_workers);
+    }
+    else
+    {
+        text_buffer buf = { NULL, 0, 0 };
+        append_instrs(&buf, 0, num_instrs);
+        fwrite(buf.text, 1, buf.len, out);
+        free(buf.text);
+    }
+
+    text_buffer buf = { NULL, 0, 0 };
+    append_globals(&buf);
+    fwrite(buf.text, 1, buf.len, out);
+    free(buf.text);
+}
@@ -0,0 +1,20 @@
+#ifndef _DISASM_H
+#define _DISASM_H
+#include <stdio.h>
+
+// Fewest instructions worth disassembling in a separate worker.
+#define DISASM_CHUNK_MIN 4096
+
+// Most workers disassembling at once.
+#define DISASM_MAX_WORKERS 16
+
+// Pre-Condition: Instructions and global data have been loaded into
+// memory.
+// Post-Condition: Writes exactly what printing the table heading, every
+// instruction with instruction_print and the global data with
+// print_global_data would, but formats it into large buffers first.
+// Large text segments are split into chunks disassembled by worker
+// processes at once and written out in order.
+extern void disasm_print_program(FILE* out);
+
+#endif
@@ -0,0 +1,113 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "guard.h"
+#include "machine.h"
+
+#define DEBUG 0
+
+// Every memory index is a signed 32-bit word_type, so no access can land
+// more than 2^31 words (8 GiB) away from the start of memory.
+#define GUARD_BYTES ((size_t) 1 << 33)
+
+static bool guarded = false;
+static struct sigaction previous_action;
+
+// Word address and PC of the last access into a guard region.
+static long long fault_word = 0;
+static address_type fault_pc = 0;
+
+// Pre-Condition: on_guard_fault has recorded a fault and left the handler.
+// Post-Condition: Describes the fault in vm_fault_message.
+static void describe_guard_fault()
+{
+    snprintf(vm_fault_message, 256, "Memory access at address %lld is out of bounds (PC: %u)!",
+             fault_word, fault_pc);
+}
+
+static void on_guard_fault(int sig, siginfo_t* info, void* uctx)
+{
+    uintptr_t base = (uintptr_t) vm_memory;
+    uintptr_t addr = (uintptr_t) info->si_addr;
+
+    bool in_guard = guarded && addr >= base - GUARD_BYTES && addr < base + sizeof(union mem_u) + GUARD_BYTES
+        && !(addr >= base && addr < base + sizeof(union mem_u));
+
+    if (in_guard)
+    {
+        // The faulting instruction was already fetched, so it is at PC - 1.
+        // Nothing here may use stdio, which the fault may have interrupted,
+        // so the fault is described once vm_run_for has left the handler.
+        fault_word = ((long long) addr - (long long) base) / (long long) sizeof(word_type);
+        fault_pc = PC - 1;
+        vm_signal_fault(describe_guard_fault);
+
+        // No program is running to fault.
+        static const char message[] = "VM memory was accessed out of bounds outside a running program!\n";
+        write(STDERR_FILENO, message, sizeof(message) - 1);
+        _exit(EXIT_FAILURE);
+    }
+
+    // Not ours: hand the fault to whoever was installed before us.
+    if (previous_action.sa_flags & SA_SIGINFO)
+    {
+        previous_action.sa_sigaction(sig, info, uctx);
+    }
+    else if (previous_action.sa_handler != SIG_IGN && previous_action.sa_handler != SIG_DFL)
+    {
+        previous_action.sa_handler(sig);
+    }
+    else
+    {
+        signal(sig, SIG_DFL);
+    }
+}
+
+// Pre-Condition: None.
+// Post-Condition: Maps an inaccessible region of len bytes at start,
+// unless something else is already mapped there. Returns whether it did.
+static bool reserve(char* start, size_t len)
+{
+    void* mapped = mmap(start, len, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED_NOREPLACE,
+                        -1, 0);
+    if (mapped == (void*) start) return true;
+    if (mapped != MAP_FAILED) munmap(mapped, len);
+    return false;
+}
+
+bool guard_memory_enable()
+{
+    if (guarded) return true;
+
+    // Memory stays where it is. The page after it, which held
+    // end_of_memory, becomes the start of the upper guard region.
+    char* base = (char*) vm_memory;
+    char* end = base + sizeof(union mem_u);
+    if (!reserve(base - GUARD_BYTES, GUARD_BYTES)) return false;
+    munmap(end, sysconf(_SC_PAGESIZE));
+    if (!reserve(end, GUARD_BYTES))
+    {
+        munmap(base - GUARD_BYTES, GUARD_BYTES);
+        mmap(end, sysconf(_SC_PAGESIZE), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE,
+             -1, 0);
+        return false;
+    }
+    guarded = true;
+    vm_memory_guarded = true;
+
+    // SA_NODEFER lets vm_signal_fault longjmp out of the handler into
+    // vm_run_for without leaving SIGSEGV blocked.
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_sigaction = on_guard_fault;
+    action.sa_flags = SA_SIGINFO | SA_NODEFER;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGSEGV, &action, &previous_action);
+
+    if (DEBUG) printf("DEBUG: guarded memory at %p\n", (void*) vm_memory);
+    return true;
+}
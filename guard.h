@@ -0,0 +1,13 @@
+#ifndef _GUARD_H
+#define _GUARD_H
+#include <stdbool.h>
+
+// Pre-Condition: No program has been loaded yet.
+// Post-Condition: Surrounds memory, which stays at its fixed address,
+// with inaccessible regions covering every address a word index can
+// reach, and turns any access outside memory into a VM fault naming the
+// PC and the address. Returns false if the
+// address space could not be reserved.
+extern bool guard_memory_enable();
+
+#endif
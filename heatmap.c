@@ -0,0 +1,100 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "heatmap.h"
+#include "machine.h"
+#include "utilities.h"
+
+#define DEBUG 0
+
+// Side arrays aligned with memory: word a was read reads[a] times.
+static unsigned long long reads[MEMORY_SIZE_IN_WORDS];
+static unsigned long long writes[MEMORY_SIZE_IN_WORDS];
+static unsigned long long fetches[MEMORY_SIZE_IN_WORDS];
+
+static const char* heatmap_path = NULL;
+static void (*previous_hook)(vm_access_kind kind, address_type addr) = NULL;
+
+// Pre-Condition: addr is inside memory.
+// Post-Condition: Counts the access and passes it on to any other observer.
+static void on_access(vm_access_kind kind, address_type addr)
+{
+    if (kind == ACCESS_READ) reads[addr]++;
+    else if (kind == ACCESS_WRITE) writes[addr]++;
+    else fetches[addr]++;
+
+    if (previous_hook != NULL) previous_hook(kind, addr);
+}
+
+// Pre-Condition: None.
+// Post-Condition: Writes count as a 32-bit word, saturating.
+static bool write_count(FILE* out, unsigned long long count)
+{
+    uint32_t value = count > UINT32_MAX ? UINT32_MAX : (uint32_t) count;
+    return fwrite(&value, sizeof(value), 1, out) == 1;
+}
+
+// Pre-Condition: out is open for writing.
+// Post-Condition: Writes the counters as CSV, skipping untouched words.
+static bool write_csv(FILE* out)
+{
+    fprintf(out, "address,region,reads,writes,fetches\n");
+    for (address_type a = 0; a < MEMORY_SIZE_IN_WORDS; a++)
+    {
+        if (reads[a] == 0 && writes[a] == 0 && fetches[a] == 0) continue;
+        fprintf(out, "%u,%s,%llu,%llu,%llu\n", a, vm_region_name(vm_region_of(a)),
+                reads[a], writes[a], fetches[a]);
+    }
+    return !ferror(out);
+}
+
+// Pre-Condition: out is open for writing.
+// Post-Condition: Writes the binary heatmap described in heatmap.h.
+static bool write_binary(FILE* out)
+{
+    uint32_t header[6] = { HEATMAP_VERSION, MEMORY_SIZE_IN_WORDS, num_instrs,
+                           vm_data_start, num_globals, vm_stack_bottom };
+    bool ok = fwrite(HEATMAP_MAGIC, 1, 4, out) == 4
+              && fwrite(header, sizeof(header), 1, out) == 1;
+
+    const unsigned long long* counters[3] = { reads, writes, fetches };
+    for (int c = 0; c < 3 && ok; c++)
+    {
+        for (address_type a = 0; a < MEMORY_SIZE_IN_WORDS && ok; a++)
+        {
+            ok = write_count(out, counters[c][a]);
+        }
+    }
+    return ok;
+}
+
+// Pre-Condition: None.
+// Post-Condition: Writes the heatmap. Registered with atexit, since the
+// program ends by exiting.
+static void heatmap_write()
+{
+    FILE* out = fopen(heatmap_path, "wb");
+    if (out == NULL)
+    {
+        fprintf(stderr, "Unable to create heatmap file %s!\n", heatmap_path);
+        return;
+    }
+
+    size_t len = strlen(heatmap_path);
+    bool csv = len >= 4 && strcmp(heatmap_path + len - 4, ".csv") == 0;
+    bool ok = csv ? write_csv(out) : write_binary(out);
+
+    if (fclose(out) != 0 || !ok)
+    {
+        fprintf(stderr, "Unable to write heatmap file %s!\n", heatmap_path);
+    }
+}
+
+void heatmap_enable(const char* path)
+{
+    heatmap_path = path;
+    previous_hook = vm_access_hook;
+    vm_access_hook = on_access;
+    atexit(heatmap_write);
+}
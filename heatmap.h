@@ -0,0 +1,20 @@
+#ifndef _HEATMAP_H
+#define _HEATMAP_H
+
+// Binary heatmaps start with this, then the header fields and the counters.
+#define HEATMAP_MAGIC "SRMH"
+#define HEATMAP_VERSION 1
+
+// Pre-Condition: A program has been loaded. path can be created.
+// Post-Condition: Counts reads, writes and instruction fetches of every
+// memory word while the program runs, and writes them to path when it
+// ends. A path ending in .csv gets one line per word that was touched:
+// address, region (text, data, stack or other), reads, writes, fetches.
+// Any other path gets the compact binary form: HEATMAP_MAGIC, then
+// version, number of words, text length, data start, data length and
+// stack bottom, then the reads, writes and fetches of every word, all as
+// 32-bit unsigned integers in host byte order. Larger counts are written
+// as UINT32_MAX.
+extern void heatmap_enable(const char* path);
+
+#endif
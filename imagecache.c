@@ -0,0 +1,234 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "imagecache.h"
+#include "machine.h"
+#include "utilities.h"
+
+#define DEBUG 0
+
+// Set in the flags of an image whose program passed verify_program.
+#define IMAGE_VERIFIED 1
+
+// Changes whenever the in-memory layout an image depends on does.
+#define IMAGE_LAYOUT_STAMP ((uint32_t) (sizeof(bin_instr_t) << 24 | sizeof(word_type) << 16 \
+                                        | sizeof(BOFHeader) << 8 | MEMORY_SIZE_IN_WORDS >> 12))
+
+// Start of every image. The instructions follow it, then num_instrs + 1
+// block lengths, then num_globals words of global data.
+typedef struct
+{
+    char magic[4];
+    uint32_t version;
+    uint32_t layout;
+    uint32_t flags;
+    uint64_t bof_hash;
+    uint64_t bof_size;
+    int32_t text_start;
+    int32_t data_start;
+    int32_t stack_bottom;
+    uint32_t num_instrs;
+    uint32_t num_globals;
+    uint32_t unused;
+    uint64_t payload_hash;
+} image_header;
+
+const char* image_cache_dir = NULL;
+bool image_cache_verified = false;
+
+// Hash and size of the BOF last looked up, which names its image.
+static uint64_t bof_hash = 0;
+static uint64_t bof_size = 0;
+static bool have_key = false;
+
+// Starting value of a 64-bit FNV-1a hash.
+#define HASH_START 14695981039346656037ull
+
+// Pre-Condition: hash is HASH_START or the hash of the bytes before these.
+// Post-Condition: Returns the 64-bit FNV-1a hash continued over the len
+// bytes at bytes.
+static uint64_t hash_bytes(uint64_t hash, const void* bytes, size_t len)
+{
+    const unsigned char* b = bytes;
+    for (size_t i = 0; i < len; i++)
+    {
+        hash ^= b[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+// Pre-Condition: have_key is set.
+// Post-Condition: Writes the path of the image to path.
+static void image_path(char* path, size_t size)
+{
+    snprintf(path, size, "%s/%016llx-%llu.img", image_cache_dir,
+             (unsigned long long) bof_hash, (unsigned long long) bof_size);
+}
+
+// Pre-Condition: None.
+// Post-Condition: Returns the size of an image with these lengths.
+static size_t image_size(uint32_t instrs, uint32_t globals)
+{
+    return sizeof(image_header) + (size_t) instrs * sizeof(bin_instr_t)
+           + ((size_t) instrs + 1) * sizeof(unsigned int) + (size_t) globals * sizeof(word_type);
+}
+
+// Pre-Condition: bytes holds size bytes of a file.
+// Post-Condition: Returns true if it is a whole image of the BOF last
+// looked up, made by this version of the VM. The key only names the BOF,
+// so the payload is checked against its own hash before its contents (and
+// its verified flag) are trusted.
+static bool image_valid(const unsigned char* bytes, size_t size)
+{
+    if (size < sizeof(image_header)) return false;
+
+    const image_header* h = (const image_header*) bytes;
+    return memcmp(h->magic, IMAGE_CACHE_MAGIC, sizeof(h->magic)) == 0
+           && h->version == IMAGE_CACHE_VERSION && h->layout == IMAGE_LAYOUT_STAMP
+           && h->bof_hash == bof_hash && h->bof_size == bof_size
+           && h->num_instrs <= MEMORY_SIZE_IN_WORDS && h->num_globals <= MEMORY_SIZE_IN_WORDS
+           && h->data_start >= 0 && (uint64_t) h->data_start + h->num_globals <= MEMORY_SIZE_IN_WORDS
+           && size == image_size(h->num_instrs, h->num_globals)
+           && hash_bytes(HASH_START, h + 1, size - sizeof(*h)) == h->payload_hash;
+}
+
+bool image_cache_load(BOFFILE bof)
+{
+    // The image is named after the file's bytes, which are hashed where
+    // the page cache holds them rather than read into a copy. The stream
+    // itself is not touched, so it stays at its start.
+    struct stat bof_st;
+    if (fstat(fileno(bof.fileptr), &bof_st) != 0)
+    {
+        bail_with_error("Unable to read %s!", bof.filename);
+    }
+    bof_size = bof_st.st_size;
+    bof_hash = HASH_START;
+    if (bof_size > 0)
+    {
+        void* bytes = mmap(NULL, bof_size, PROT_READ, MAP_PRIVATE, fileno(bof.fileptr), 0);
+        if (bytes == MAP_FAILED)
+        {
+            bail_with_error("Unable to read %s!", bof.filename);
+        }
+        bof_hash = hash_bytes(HASH_START, bytes, bof_size);
+        munmap(bytes, bof_size);
+    }
+    have_key = true;
+
+    char path[4096];
+    image_path(path, sizeof(path));
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return false;
+
+    struct stat st;
+    void* map = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size > 0)
+    {
+        map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    if (map == MAP_FAILED) return false;
+
+    if (!image_valid(map, st.st_size))
+    {
+        // Left over from another version; the store that follows replaces it.
+        if (DEBUG) printf("DEBUG: ignoring stale image %s\n", path);
+        munmap(map, st.st_size);
+        return false;
+    }
+
+    const image_header* h = map;
+    const bin_instr_t* instrs = (const bin_instr_t*) (h + 1);
+    const unsigned int* lengths = (const unsigned int*) (instrs + h->num_instrs);
+    const word_type* data = (const word_type*) (lengths + h->num_instrs + 1);
+
+    BOFHeader header;
+    memset(&header, 0, sizeof(header));
+    header.text_start_address = h->text_start;
+    header.text_length = h->num_instrs;
+    header.data_start_address = h->data_start;
+    header.data_length = h->num_globals;
+    header.stack_bottom_addr = h->stack_bottom;
+
+    init(header);
+    invariant_check();
+
+    num_instrs = h->num_instrs;
+    num_globals = h->num_globals;
+    memcpy(vm_memory->instrs, instrs, num_instrs * sizeof(bin_instr_t));
+    memcpy(&vm_memory->words[h->data_start], data, num_globals * sizeof(word_type));
+
+    // Block lengths are never written, so they are used from the mapping,
+    // which stays mapped for the life of the VM.
+    block_lengths = (unsigned int*) lengths;
+    image_cache_verified = (h->flags & IMAGE_VERIFIED) != 0;
+
+    if (DEBUG) printf("DEBUG: loaded %s from image %s\n", bof.filename, path);
+    return true;
+}
+
+// Pre-Condition: have_key is set and the program has not run.
+// Post-Condition: Writes the loaded program's image with the given flags
+// to a temporary file and renames it into place.
+static void publish(uint32_t flags)
+{
+    // An unusable cache only costs speed, so creating it may fail quietly.
+    mkdir(image_cache_dir, 0777);
+
+    image_header h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, IMAGE_CACHE_MAGIC, sizeof(h.magic));
+    h.version = IMAGE_CACHE_VERSION;
+    h.layout = IMAGE_LAYOUT_STAMP;
+    h.flags = flags;
+    h.bof_hash = bof_hash;
+    h.bof_size = bof_size;
+    h.text_start = PC;
+    h.data_start = vm_data_start;
+    h.stack_bottom = vm_stack_bottom;
+    h.num_instrs = num_instrs;
+    h.num_globals = num_globals;
+    h.payload_hash = hash_bytes(HASH_START, vm_memory->instrs, num_instrs * sizeof(bin_instr_t));
+    h.payload_hash = hash_bytes(h.payload_hash, block_lengths, (num_instrs + 1) * sizeof(unsigned int));
+    h.payload_hash = hash_bytes(h.payload_hash, &vm_memory->words[vm_data_start], num_globals * sizeof(word_type));
+
+    char path[4096], temp[4096 + 32];
+    image_path(path, sizeof(path));
+    snprintf(temp, sizeof(temp), "%s.%ld.tmp", path, (long) getpid());
+
+    FILE* out = fopen(temp, "wb");
+    if (out == NULL) return;
+
+    bool ok = fwrite(&h, sizeof(h), 1, out) == 1
+              && fwrite(vm_memory->instrs, sizeof(bin_instr_t), num_instrs, out) == num_instrs
+              && fwrite(block_lengths, sizeof(unsigned int), num_instrs + 1, out) == num_instrs + 1
+              && fwrite(&vm_memory->words[vm_data_start], sizeof(word_type), num_globals, out) == num_globals;
+    if (fclose(out) != 0) ok = false;
+
+    if (!ok || rename(temp, path) != 0)
+    {
+        if (DEBUG) printf("DEBUG: unable to publish image %s: %s\n", path, strerror(errno));
+        unlink(temp);
+    }
+}
+
+void image_cache_store()
+{
+    if (!have_key) return;
+    publish(0);
+}
+
+void image_cache_mark_verified()
+{
+    if (image_cache_dir == NULL || !have_key || image_cache_verified) return;
+    publish(IMAGE_VERIFIED);
+    image_cache_verified = true;
+}
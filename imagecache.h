@@ -0,0 +1,41 @@
+#ifndef _IMAGECACHE_H
+#define _IMAGECACHE_H
+#include <stdbool.h>
+#include "bof.h"
+
+// Cached images start with this, then the version and the layout stamp.
+#define IMAGE_CACHE_MAGIC "SRMI"
+#define IMAGE_CACHE_VERSION 2
+
+// Directory of cached images, or NULL when caching is off.
+extern const char* image_cache_dir;
+
+// True if the program was loaded from an image that passed verify_program.
+extern bool image_cache_verified;
+
+// Each image is named after a hash and the size of the BOF's bytes. It
+// holds a fixed header (magic, version, a stamp of the VM's layout, flags,
+// the hash and size again, the registers and lengths the BOF header gave,
+// and a hash of everything after the header), then the decoded
+// instructions, their block lengths and the initial global data, laid out
+// to be used straight from an mmap. Images are written to a temporary
+// file and renamed into place, so runners sharing the directory only ever
+// see whole images.
+
+// Pre-Condition: bof is open at its start. image_cache_dir is set.
+// Post-Condition: If the directory holds an image of bof's bytes, loads
+// it into memory like load_bof and returns true. Otherwise leaves bof at
+// its start and returns false.
+extern bool image_cache_load(BOFFILE bof);
+
+// Pre-Condition: image_cache_load just returned false and the program has
+// since been loaded but not run.
+// Post-Condition: Publishes an image of the loaded program.
+extern void image_cache_store();
+
+// Pre-Condition: The loaded program passed verify_program and has not run.
+// Post-Condition: Republishes its image marked as verified, so that later
+// runs can skip verification. Does nothing when caching is off.
+extern void image_cache_mark_verified();
+
+#endif
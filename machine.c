@@ -1,16 +1,45 @@
 // Daniel Landsman
 #include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <setjmp.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/mman.h>
 #include "machine.h"
 #include "machine_types.h"
 #include "instruction.h"
 #include "bof.h"
 #include "regname.h"
 #include "utilities.h"
+#include "compact.h"
+#include "imagecache.h"
+#include "disasm.h"
 
-#define MAX_PRINT_WIDTH 59
 #define DEBUG 0
 
-union mem_u memory;
+// The page after memory is mapped with it. Unless it is a guard page, its
+// first word is set to end_of_memory by vm_run_for, so that a program
+// running straight off the end of memory faults there.
+static bin_instr_t* const memory_end = (bin_instr_t*) (VM_MEMORY_ADDRESS + sizeof(union mem_u));
+bool vm_memory_guarded = false;
+
+// A system call with no valid code.
+static const bin_instr_t end_of_memory = { .syscall = { .op = OTHC_O, .func = SYS_F, .code = 0 } };
+
+// Pre-Condition: Runs before main.
+// Post-Condition: Maps zeroed memory and the page after it at
+// VM_MEMORY_ADDRESS, bailing out if that address is taken.
+__attribute__((constructor)) static void map_memory()
+{
+    size_t len = sizeof(union mem_u) + sysconf(_SC_PAGESIZE);
+    void* mapped = mmap((void*) VM_MEMORY_ADDRESS, len, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+    if (mapped != (void*) VM_MEMORY_ADDRESS)
+    {
+        bail_with_error("Unable to map VM memory at its fixed address!");
+    }
+}
 word_type GPR[NUM_REGISTERS];
 address_type PC = 0;
 word_type HI = 0;
@@ -19,12 +48,68 @@ unsigned int num_instrs = 0;
 unsigned int num_globals = 0;
 bool trace_program = true;
 bool started_tracing = false;
+bool program_verified = false;
+bool vm_quiet = false;
+address_type vm_data_start = 0;
+address_type vm_stack_bottom = 0;
+unsigned int* block_lengths = NULL;
+unsigned long long vm_instr_count = 0;
+int vm_exit_code = 0;
+char vm_fault_message[256];
+bool vm_input_pending = false;
+
+static int read_stdin_char(void)
+{
+    return getc(stdin);
+}
+
+int (*vm_read_char)(void) = read_stdin_char;
+void (*vm_breakpoint_hook)(void) = NULL;
+void (*vm_access_hook)(vm_access_kind kind, address_type addr) = NULL;
+bool (*vm_trace_filter)(address_type pc, bin_instr_t instr) = NULL;
+void (*vm_trace_hook)(bin_instr_t instr, bool with_state) = NULL;
+void (*vm_trace_finish)(void) = NULL;
+void (*vm_transfer_hook)(address_type pc, bin_instr_t instr) = NULL;
+void (*vm_coverage_hook)(address_type first, address_type last, address_type next) = NULL;
+
+// One flight recorder entry: the state just before an instruction ran.
+typedef struct
+{
+    address_type pc;
+    bin_instr_t instr;
+    word_type sp;
+    word_type fp;
+    word_type top;
+} flight_entry;
+
+// Ring of the last FLIGHT_RECORDER_SIZE instructions executed, always
+// recorded so that a fault can show how the program got there.
+static flight_entry flight_record[FLIGHT_RECORDER_SIZE];
+static unsigned long long flight_count = 0;
+
+// Where vm_fault and vm_exit return to while vm_run_for is running.
+static jmp_buf vm_escape;
+static bool vm_catching = false;
+
+// Describes a fault vm_signal_fault escaped a signal handler for, once
+// vm_run_for is back in normal context.
+static void (*signal_fault)(void) = NULL;
 
 // Pre-Condition: bof represents a valid binary object file.
 // Post-Condition: Loads the file's instructions and global data
 // into memory and initializes registers.
 void load_bof(BOFFILE bof) //
 {
+    // A cached image of the same bytes needs no decoding at all.
+    if (image_cache_dir != NULL && image_cache_load(bof)) return;
+
+    // Compact files carry their own header and are decoded in one pass.
+    if (compact_detect(bof))
+    {
+        compact_load(bof);
+        if (image_cache_dir != NULL) image_cache_store();
+        return;
+    }
 
     // Open header for reading
     BOFHeader bHeader = bof_read_header(bof);
@@ -47,6 +132,7 @@ void load_bof(BOFFILE bof) //
     // Load program global data
     load_globals(bof, bHeader);
 
+    if (image_cache_dir != NULL) image_cache_store();
 }
 
 // Pre-Condition: header represents a valid BOF header.
@@ -63,12 +149,14 @@ void init(BOFHeader header) {
     // Set all memory to 0
     for (int i = 0; i < MEMORY_SIZE_IN_WORDS; i++)
     {
-        memory.words[i] = 0;
+        vm_memory->words[i] = 0;
     }
 
     // Set GP, FP, and SP registers appropriately
     GPR[GP] = header.data_start_address;
     GPR[FP] = GPR[SP] = header.stack_bottom_addr;
+    vm_data_start = header.data_start_address;
+    vm_stack_bottom = header.stack_bottom_addr;
 
     // Properly initialize special registers
     PC = header.text_start_address;
@@ -83,42 +171,42 @@ void invariant_check()
     // Check if 0 is <= global pointer
     if (!(0 <= GPR[GP]))
     {
-        bail_with_error("Global data starting address (%d) is less than 0!",
+        vm_fault("Global data starting address (%d) is less than 0!",
                         GPR[GP]);
     }
 
     // Check if global pointer < stack pointer
     if (!(GPR[GP] < GPR[SP]))
     {
-        bail_with_error("Global data starting address (%d) is not less than the stack top address (%d)!",
+        vm_fault("Global data starting address (%d) is not less than the stack top address (%d)!",
                         GPR[GP], GPR[SP]);
     }
 
     // Check if stack pointer <= frame pointer
     if (!(GPR[SP] <= GPR[FP]))
     {
-        bail_with_error("Stack top address (%d) is not less than or equal to the stack bottom address (%d)!",
+        vm_fault("Stack top address (%d) is not less than or equal to the stack bottom address (%d)!",
                         GPR[SP], GPR[FP]);
     }
 
     // Check that framep pointer < memory size
     if (!(GPR[FP] < MEMORY_SIZE_IN_WORDS))
     {
-        bail_with_error("Stack bottom address (%d) is not less than the memory size (%d)!",
+        vm_fault("Stack bottom address (%d) is not less than the memory size (%d)!",
                         GPR[FP], MEMORY_SIZE_IN_WORDS);
     }
 
     // Check that 0 <= program counter
     if (!(0 <= PC))
     {
-        bail_with_error("Program counter (%u) is less than zero!",
+        vm_fault("Program counter (%u) is less than zero!",
                         PC);
     }
 
     // Check that program counter < memory size
     if (!(PC < MEMORY_SIZE_IN_WORDS))
     {
-        bail_with_error("Program counter (%u) is not less than the memory size (%d)!",
+        vm_fault("Program counter (%u) is not less than the memory size (%d)!",
                         PC, MEMORY_SIZE_IN_WORDS);
     }
 
@@ -135,7 +223,62 @@ void load_instrs(BOFFILE bof, BOFHeader header)
     // Loop through number of instructions, adding to memory array
     for (int i = 0; i < num_instrs; i++) 
     {
-        memory.instrs[i] = instruction_read(bof);
+        vm_memory->instrs[i] = instruction_read(bof);
+    }
+
+    compute_block_lengths();
+}
+
+// Pre-Condition: None.
+// Post-Condition: Returns true if instr may continue anywhere other than
+// the next address (branches, jumps, system calls and invalid opcodes).
+static bool ends_block(bin_instr_t instr)
+{
+    switch (instruction_type(instr))
+    {
+        case comp_instr_type:
+            return false;
+
+        case other_comp_instr_type:
+            return instr.othc.func == JMP_F || instr.othc.func == CSI_F
+                || instr.othc.func == JREL_F;
+
+        case immed_instr_type:
+            return instr.immed.op >= BEQ_O && instr.immed.op <= BNE_O;
+
+        default:
+            return true;
+    }
+}
+
+// Block length table of the last program loaded, reused by the next load
+// so that reloading does not leak. paging.c keeps a copy for each image.
+static unsigned int* block_table = NULL;
+static unsigned int block_table_size = 0;
+
+// Pre-Condition: Instructions have been loaded into program memory.
+// Post-Condition: Fills in block_lengths for the loaded text, reusing the
+// table of the previous load. The table is not updated if the program
+// later stores into its text.
+void compute_block_lengths()
+{
+    if (block_table_size < num_instrs + 1)
+    {
+        unsigned int* grown = realloc(block_table, (num_instrs + 1) * sizeof(unsigned int));
+        if (grown == NULL)
+        {
+            bail_with_error("Unable to allocate block length table!");
+        }
+        block_table = grown;
+        block_table_size = num_instrs + 1;
+    }
+    block_lengths = block_table;
+
+    block_lengths[num_instrs] = 1;
+    for (int i = (int) num_instrs - 1; i >= 0; i--)
+    {
+        if (ends_block(vm_memory->instrs[i]) || i == (int) num_instrs - 1) block_lengths[i] = 1;
+        else block_lengths[i] = block_lengths[i + 1] + 1;
     }
 }
 
@@ -154,7 +297,7 @@ void load_globals(BOFFILE bof, BOFHeader header)
     // Loop through number of global data values, adding to memory array using offset.
     for (int i = 0; i < num_globals; i++)
     {
-        memory.words[i + offset] = bof_read_word(bof);
+        vm_memory->words[i + offset] = bof_read_word(bof);
     }
 }
 
@@ -164,14 +307,10 @@ void load_globals(BOFFILE bof, BOFHeader header)
 // data in program without executing instructions (-p option).
 void vm_print_program(FILE* out)
 {
-    if (DEBUG) printf("DEBUG: printing table heading\n");
-    instruction_print_table_heading(out);
-    if (DEBUG) printf("DEBUG: printing instructions\n");
-    print_all_instrs(out);
-    if (DEBUG) printf("DEBUG: printing global data\n");
-    print_global_data(out);
-    // need to figure out how to print global data, see disasm files for some guidance
-    // and check .lst files for what we need to match
+    // Same output as the heading, print_all_instrs and print_global_data,
+    // formatted in bulk.
+    if (DEBUG) printf("DEBUG: printing program\n");
+    disasm_print_program(out);
 }
 
 // Pre-Condition: Instructions have been properly loaded into program memory.
@@ -180,15 +319,17 @@ void print_all_instrs(FILE* out)
 {
     for (int i = 0; i < num_instrs; i++)
     {
-        instruction_print(out, i, memory.instrs[i]);
+        instruction_print(out, i, vm_memory->instrs[i]);
     }
 }
 
 //Fix the print global function so that the spacing matches the desired output.
-void print_global_data(FILE* out)
+// Pre-Condition: regs and words hold a register set and memory image.
+// Post-Condition: Prints the global data they describe to out.
+static void print_global_data_of(FILE* out, const word_type* regs, const word_type* words)
 {
-    int global_start = GPR[GP];
-    int global_end = GPR[SP] - 1;
+    int global_start = regs[GP];
+    int global_end = regs[SP] - 1;
 
     int num_chars = 0;
     bool printing_dots = false;
@@ -197,7 +338,7 @@ void print_global_data(FILE* out)
 
     for (int i = global_start; i <= global_end; i++)
     {
-        if (memory.words[i] != 0)
+        if (words[i] != 0)
         {
             if (printing_dots)
             {
@@ -205,16 +346,16 @@ void print_global_data(FILE* out)
                 printing_dots = false;
             }
 
-            num_chars += fprintf(out, "%8d: %d\t", i, memory.words[i]);
+            num_chars += fprintf(out, "%8d: %d\t", i, words[i]);
         }
         else
         {
             if (!printing_dots)
             {
-                if (memory.words[i + 1] == 0 && i + 1 <= global_end)
+                if (words[i + 1] == 0 && i + 1 <= global_end)
                 {
 
-                    num_chars += fprintf(out, "%8d: %d\t", i, memory.words[i]);
+                    num_chars += fprintf(out, "%8d: %d\t", i, words[i]);
 
                     if (num_chars > MAX_PRINT_WIDTH)
                     {
@@ -229,7 +370,7 @@ void print_global_data(FILE* out)
                 else
                 {
 
-                    num_chars += fprintf(out, "%8d: %d\t", i, memory.words[i]);
+                    num_chars += fprintf(out, "%8d: %d\t", i, words[i]);
                 }
             }
         }
@@ -248,34 +389,39 @@ void print_global_data(FILE* out)
 
 }
 
-void print_AR(FILE* out)
+void print_global_data(FILE* out)
 {
-    printf("\n");
+    print_global_data_of(out, GPR, vm_memory->words);
+}
 
-    int AR_start = GPR[SP];
-    int AR_end = GPR[FP];
+// Pre-Condition: regs and words hold a register set and memory image.
+// Post-Condition: Prints the activation record they describe to out.
+static void print_AR_of(FILE* out, const word_type* regs, const word_type* words)
+{
+    int AR_start = regs[SP];
+    int AR_end = regs[FP];
 
     int num_chars = 0;
     bool printing_dots = false;
     
     for (int i = AR_start; i <= AR_end; i++)
     {
-        if (memory.words[i] != 0 || i == AR_start || i == AR_end)
+        if (words[i] != 0 || i == AR_start || i == AR_end)
         {
             if (printing_dots)
             {
                 num_chars = 0;
                 printing_dots = false;
             }
-            num_chars += fprintf(out, "%8d: %d\t", i, memory.words[i]);
+            num_chars += fprintf(out, "%8d: %d\t", i, words[i]);
         }
         else
         {
             if (!printing_dots)
             {
-                if (i + 1 <= AR_end && memory.words[i + 1] == 0)
+                if (i + 1 <= AR_end && words[i + 1] == 0)
                 {
-                    num_chars += fprintf(out, "%8d: %d\t", i, memory.words[i]);
+                    num_chars += fprintf(out, "%8d: %d\t", i, words[i]);
                     if (num_chars > MAX_PRINT_WIDTH)
                     {
                         newline(out);
@@ -287,7 +433,7 @@ void print_AR(FILE* out)
                 }
                 else
                 {
-                    num_chars += fprintf(out, "%8d: %d\t", i, memory.words[i]);
+                    num_chars += fprintf(out, "%8d: %d\t", i, words[i]);
                 }
             }
         }
@@ -305,6 +451,12 @@ void print_AR(FILE* out)
     }
 }
 
+void print_AR(FILE* out)
+{
+    printf("\n");
+    print_AR_of(out, GPR, vm_memory->words);
+}
+
 void trace_instruction(bin_instr_t instr)
 {
     //Print current instruction
@@ -314,43 +466,103 @@ void trace_instruction(bin_instr_t instr)
     print_state();
 }
 
+// Pre-Condition: instr just ran and is traced.
+// Post-Condition: Prints its line, followed by the state if with_state,
+// or hands it to vm_trace_hook.
+static void trace_line(bin_instr_t instr, bool with_state)
+{
+    if (vm_trace_hook != NULL) vm_trace_hook(instr, with_state);
+    else if (with_state) trace_instruction(instr);
+    else printf("==>      %d: %s\n", PC - 1, instruction_assembly_form(PC - 1, instr));
+}
+
+// Pre-Condition: instr just ran from pc and tracing is on.
+// Post-Condition: Traces it as trace_line does, unless vm_trace_filter
+// leaves it out. Kept out of vm_step so that the untraced path stays small
+// enough to inline.
+static void trace_step(address_type pc, bin_instr_t instr, bool with_state)
+{
+    if (vm_trace_filter == NULL || vm_trace_filter(pc, instr))
+    {
+        trace_line(instr, with_state);
+    }
+}
+
 void print_state()
+{
+    print_state_of(stdout, PC, GPR, HI, LO, vm_memory->words);
+}
+
+void print_state_of(FILE* out, address_type pc, const word_type* regs, word_type hi, word_type lo,
+                    const word_type* words)
 {
     //Print PC with HI and LO registers if necessary.
-    if (HI == 0 && LO == 0) printf("%8s: %d\n", "PC", PC);
-    else printf("%8s: %d   HI: %d   LO: %d\n", "PC", PC, HI, LO);
+    if (hi == 0 && lo == 0) fprintf(out, "%8s: %d\n", "PC", pc);
+    else fprintf(out, "%8s: %d   HI: %d   LO: %d\n", "PC", pc, hi, lo);
 
     //Print GPRs
 
     // Top row
-    printf("GPR[%s]: %-5d GPR[%s]: %-5d GPR[%s]: %-5d GPR[%s]: %-5d GPR[%s]: %-5d\n", 
-            regname_get(GP), GPR[GP], regname_get(SP), GPR[SP], regname_get(FP), GPR[FP],
-            regname_get(3), GPR[3], regname_get(4), GPR[4]);
+    fprintf(out, "GPR[%s]: %-5d GPR[%s]: %-5d GPR[%s]: %-5d GPR[%s]: %-5d GPR[%s]: %-5d\n", 
+            regname_get(GP), regs[GP], regname_get(SP), regs[SP], regname_get(FP), regs[FP],
+            regname_get(3), regs[3], regname_get(4), regs[4]);
 
     // Bottom row
-    printf("GPR[%s]: %-5d GPR[%s]: %-5d GPR[%s]: %-5d\n",
-    regname_get(5), GPR[5], regname_get(6), GPR[6], regname_get(RA), GPR[RA]);
+    fprintf(out, "GPR[%s]: %-5d GPR[%s]: %-5d GPR[%s]: %-5d\n",
+    regname_get(5), regs[5], regname_get(6), regs[6], regname_get(RA), regs[RA]);
 
     //Print Memory
-    print_global_data(stdout);
-    print_AR(stdout);
-    //printf("%d: %d ...\n", GPR[GP], memory.words[GPR[GP]]);
-    //printf("%d: %d\n", GPR[SP], memory.words[GPR[SP]]);
+    print_global_data_of(out, regs, words);
+    fprintf(out, "\n");
+    print_AR_of(out, regs, words);
 
     // Print newline
-    printf("\n");
+    fprintf(out, "\n");
 }
 
 bin_instr_t fetch_instruction()
 {
-    bin_instr_t instr = memory.instrs[PC];
+    bin_instr_t instr = vm_memory->instrs[PC];
     PC++;
     return instr;
 }
 
-// Fetch-execute cycle
-void execute_instruction(bin_instr_t instr)
+// Pre-Condition: The program was verified and just made a dynamic jump.
+// Post-Condition: Faults unless PC is inside the verified text.
+static void check_verified_target()
+{
+    if (PC >= num_instrs)
+    {
+        vm_fault("Jump target (%u) is outside the verified program text!", PC);
+    }
+}
+
+// Pre-Condition: addr is the word a store is about to write.
+// Post-Condition: Returns addr, faulting first if verified is set and the
+// store would write into the program text, which must stay as verified.
+static inline int store_address(int addr, const bool verified)
+{
+    if (verified && (unsigned int) addr < num_instrs)
+    {
+        vm_fault("Store into the verified program text at address %d (PC: %u)!", addr, PC - 1);
+    }
+    return addr;
+}
+
+// What an instruction did besides its own work, returned by execute so
+// that callers check only what it may have broken.
+#define EXEC_REGISTERS 1 // changed a register the invariants cover
+#define EXEC_TRANSFER 2  // may have left the straight-line block it is in
+#define EXEC_STEP 4      // set for every instruction
+
+// Fetch-execute cycle. With verified set, the program must have passed
+// verify_program: static branches need no range check, and since stores
+// into the text fault, every instruction keeps a verified encoding and
+// the error arms are left out. Returns the EXEC_ flags that apply to
+// instr.
+static inline int execute(bin_instr_t instr, const bool verified)
 {
+    int effects = EXEC_STEP;
 
     instr_type type = instruction_type(instr);
 
@@ -369,65 +581,67 @@ void execute_instruction(bin_instr_t instr)
                     break;
 
                 case ADD_F:
-                    memory.words[GPR[t] + machine_types_formOffset(ot)] = 
-                    memory.words[GPR[SP]] + (memory.words[GPR[s] + machine_types_formOffset(os)]);
+                    vm_memory->words[store_address(GPR[t] + machine_types_formOffset(ot), verified)] = 
+                    vm_memory->words[GPR[SP]] + (vm_memory->words[GPR[s] + machine_types_formOffset(os)]);
                     break;
 
                 case SUB_F:
-                    memory.words[GPR[t] + machine_types_formOffset(ot)] = 
-                    memory.words[GPR[SP]] - (memory.words[GPR[s] + machine_types_formOffset(os)]);
+                    vm_memory->words[store_address(GPR[t] + machine_types_formOffset(ot), verified)] = 
+                    vm_memory->words[GPR[SP]] - (vm_memory->words[GPR[s] + machine_types_formOffset(os)]);
                     break;
 
                 case CPW_F:
-                    memory.words[GPR[t] + machine_types_formOffset(ot)] = 
-                    memory.words[GPR[s] + machine_types_formOffset(os)];
+                    vm_memory->words[store_address(GPR[t] + machine_types_formOffset(ot), verified)] = 
+                    vm_memory->words[GPR[s] + machine_types_formOffset(os)];
                     break;
 
                 case AND_F:
-                    memory.uwords[GPR[t] + machine_types_formOffset(ot)] =
-                    memory.uwords[GPR[SP]] & (memory.uwords[GPR[s] + machine_types_formOffset(os)]);
+                    vm_memory->uwords[store_address(GPR[t] + machine_types_formOffset(ot), verified)] =
+                    vm_memory->uwords[GPR[SP]] & (vm_memory->uwords[GPR[s] + machine_types_formOffset(os)]);
                     break;
 
                 case BOR_F:
-                    memory.uwords[GPR[t] + machine_types_formOffset(ot)] =
-                    memory.uwords[GPR[SP]] | (memory.uwords[GPR[s] + machine_types_formOffset(os)]);
+                    vm_memory->uwords[store_address(GPR[t] + machine_types_formOffset(ot), verified)] =
+                    vm_memory->uwords[GPR[SP]] | (vm_memory->uwords[GPR[s] + machine_types_formOffset(os)]);
                     break;
 
                 case NOR_F:
-                    memory.uwords[GPR[t] + machine_types_formOffset(ot)] =
-                    ~(memory.uwords[GPR[SP]] | (memory.uwords[GPR[s] + machine_types_formOffset(os)]));
+                    vm_memory->uwords[store_address(GPR[t] + machine_types_formOffset(ot), verified)] =
+                    ~(vm_memory->uwords[GPR[SP]] | (vm_memory->uwords[GPR[s] + machine_types_formOffset(os)]));
                     break;
 
                 case XOR_F:
-                    memory.uwords[GPR[t] + machine_types_formOffset(ot)] =
-                    memory.uwords[GPR[SP]] ^ (memory.uwords[GPR[s] + machine_types_formOffset(os)]);
+                    vm_memory->uwords[store_address(GPR[t] + machine_types_formOffset(ot), verified)] =
+                    vm_memory->uwords[GPR[SP]] ^ (vm_memory->uwords[GPR[s] + machine_types_formOffset(os)]);
                     break;
 
                 case LWR_F:
-                    GPR[t] = memory.words[GPR[s] + machine_types_formOffset(os)];
+                    GPR[t] = vm_memory->words[GPR[s] + machine_types_formOffset(os)];
+                    effects |= EXEC_REGISTERS;
                     break;
 
                 case SWR_F:
-                    memory.words[GPR[t] + machine_types_formOffset(ot)] = GPR[s];
+                    vm_memory->words[store_address(GPR[t] + machine_types_formOffset(ot), verified)] = GPR[s];
                     break;
 
                 case SCA_F:
-                    memory.words[GPR[t] + machine_types_formOffset(ot)] = 
+                    vm_memory->words[store_address(GPR[t] + machine_types_formOffset(ot), verified)] = 
                     (GPR[s] + machine_types_formOffset(os));
                     break;
 
                 case LWI_F:
-                    memory.words[GPR[t] + machine_types_formOffset(ot)] =
-                    memory.words[memory.words[GPR[s] + machine_types_formOffset(os)]];
+                    vm_memory->words[store_address(GPR[t] + machine_types_formOffset(ot), verified)] =
+                    vm_memory->words[vm_memory->words[GPR[s] + machine_types_formOffset(os)]];
                     break;
 
                 case NEG_F:
-                    memory.words[GPR[t] + machine_types_formOffset(ot)] =
-                    -memory.words[GPR[s] + machine_types_formOffset(os)];
+                    vm_memory->words[store_address(GPR[t] + machine_types_formOffset(ot), verified)] =
+                    -vm_memory->words[GPR[s] + machine_types_formOffset(os)];
                     break;
 
                 default:
-                    bail_with_error("Computational function code (%d) is invalid!", instr.comp.func);
+                    if (verified) __builtin_unreachable();
+                    vm_fault("Computational function code (%d) is invalid!", instr.comp.func);
                     break;
             }
             break;
@@ -442,21 +656,23 @@ void execute_instruction(bin_instr_t instr)
             switch(func_1) 
             {
                 case LIT_F:
-                    memory.words[GPR[reg] + machine_types_formOffset(offset)] =
+                    vm_memory->words[store_address(GPR[reg] + machine_types_formOffset(offset), verified)] =
                     machine_types_sgnExt(arg);
                     break;
                 
                 case ARI_F:
                     GPR[reg] = (GPR[reg] + machine_types_sgnExt(arg));
+                    effects |= EXEC_REGISTERS;
                     break;
 
                 case SRI_F:
                     GPR[reg] = (GPR[reg] - machine_types_sgnExt(arg));
+                    effects |= EXEC_REGISTERS;
                     break;
 
                 case MUL_F:
-                    long long int res = memory.words[GPR[SP]] * 
-                    (memory.words[GPR[reg] + machine_types_formOffset(offset)]);
+                    long long int res = vm_memory->words[GPR[SP]] * 
+                    (vm_memory->words[GPR[reg] + machine_types_formOffset(offset)]);
 
                     LO = (res & 0xFFFFFFFF);
                     HI = (res >> 32);
@@ -464,45 +680,50 @@ void execute_instruction(bin_instr_t instr)
 
                 case DIV_F:
 
-                    if (memory.words[GPR[reg] + machine_types_formOffset(offset)] == 0) {
-                        bail_with_error("Division by 0 encountered!");
+                    if (vm_memory->words[GPR[reg] + machine_types_formOffset(offset)] == 0) {
+                        vm_fault("Division by 0 encountered!");
                     }
 
-                    LO = memory.words[GPR[SP]] / 
-                    (memory.words[GPR[reg] + machine_types_formOffset(offset)]);
-                    HI = memory.words[GPR[SP]] % 
-                    (memory.words[GPR[reg] + machine_types_formOffset(offset)]);
+                    LO = vm_memory->words[GPR[SP]] / 
+                    (vm_memory->words[GPR[reg] + machine_types_formOffset(offset)]);
+                    HI = vm_memory->words[GPR[SP]] % 
+                    (vm_memory->words[GPR[reg] + machine_types_formOffset(offset)]);
                     break;
 
                 case CFHI_F:
-                    memory.words[GPR[reg] + machine_types_formOffset(offset)] = HI;
+                    vm_memory->words[store_address(GPR[reg] + machine_types_formOffset(offset), verified)] = HI;
                     break;
 
                 case CFLO_F:
-                    memory.words[GPR[reg] + machine_types_formOffset(offset)] = LO;
+                    vm_memory->words[store_address(GPR[reg] + machine_types_formOffset(offset), verified)] = LO;
                     break;
 
                 case SLL_F:
-                    memory.uwords[GPR[reg] + machine_types_formOffset(offset)] = 
-                    memory.uwords[GPR[SP]] << arg;
+                    vm_memory->uwords[store_address(GPR[reg] + machine_types_formOffset(offset), verified)] = 
+                    vm_memory->uwords[GPR[SP]] << arg;
                     break;
 
                 case SRL_F:
-                    memory.uwords[GPR[reg] + machine_types_formOffset(offset)] =
-                    memory.uwords[GPR[SP]] >> arg;
+                    vm_memory->uwords[store_address(GPR[reg] + machine_types_formOffset(offset), verified)] =
+                    vm_memory->uwords[GPR[SP]] >> arg;
                     break;
 
                 case JMP_F:
-                    PC = memory.uwords[GPR[reg] + machine_types_formOffset(offset)];
+                    PC = vm_memory->uwords[GPR[reg] + machine_types_formOffset(offset)];
+                    if (verified) check_verified_target();
+                    effects |= EXEC_TRANSFER;
                     break;
 
                 case CSI_F:
                     GPR[RA] = PC;
-                    PC = memory.words[GPR[reg] + machine_types_formOffset(offset)];
+                    PC = vm_memory->words[GPR[reg] + machine_types_formOffset(offset)];
+                    if (verified) check_verified_target();
+                    effects |= EXEC_TRANSFER;
                     break;
 
                 case JREL_F:
                     PC = ((PC - 1) + machine_types_formOffset(arg));
+                    effects |= EXEC_TRANSFER;
                     break;
 
                 case SYS_F:
@@ -512,7 +733,8 @@ void execute_instruction(bin_instr_t instr)
                     break;
 
                 default:
-                    bail_with_error("Other computational function code (%hu) is invalid!", instr.othc.func);
+                    if (verified) __builtin_unreachable();
+                    vm_fault("Other computational function code (%hu) is invalid!", instr.othc.func);
                     break;
             }
         break;
@@ -524,78 +746,86 @@ void execute_instruction(bin_instr_t instr)
             switch (instr.immed.op) 
             {
                 case ADDI_O:
-                    memory.words[GPR[instr.immed.reg] + machine_types_formOffset(instr.immed.offset)] =
-                    (memory.words[GPR[instr.immed.reg] + machine_types_formOffset(instr.immed.offset)]) +
+                    vm_memory->words[store_address(GPR[instr.immed.reg] + machine_types_formOffset(instr.immed.offset), verified)] =
+                    (vm_memory->words[GPR[instr.immed.reg] + machine_types_formOffset(instr.immed.offset)]) +
                     machine_types_sgnExt(immediate); //instr.immed.immed
                     break;
 
                 case ANDI_O:
-                    memory.uwords[GPR[instr.immed.reg] + machine_types_formOffset(instr.immed.offset)] =
-                    (memory.uwords[GPR[instr.immed.reg] + machine_types_formOffset(instr.immed.offset)]) &
+                    vm_memory->uwords[store_address(GPR[instr.immed.reg] + machine_types_formOffset(instr.immed.offset), verified)] =
+                    (vm_memory->uwords[GPR[instr.immed.reg] + machine_types_formOffset(instr.immed.offset)]) &
                     machine_types_zeroExt(immediate); //instr.immed.immed
                     break;
 
                 case BORI_O:
-                    memory.uwords[GPR[instr.immed.reg] + machine_types_formOffset(instr.immed.offset)] =
-                    (memory.uwords[GPR[instr.immed.reg] + machine_types_formOffset(instr.immed.offset)]) |
+                    vm_memory->uwords[store_address(GPR[instr.immed.reg] + machine_types_formOffset(instr.immed.offset), verified)] =
+                    (vm_memory->uwords[GPR[instr.immed.reg] + machine_types_formOffset(instr.immed.offset)]) |
                     machine_types_zeroExt(immediate); //instr.immed.immed
                     break;
 
                 case XORI_O:
-                    memory.uwords[GPR[instr.immed.reg] + machine_types_formOffset(instr.immed.offset)] =
-                    (memory.uwords[GPR[instr.immed.reg] + machine_types_formOffset(instr.immed.offset)]) ^
+                    vm_memory->uwords[store_address(GPR[instr.immed.reg] + machine_types_formOffset(instr.immed.offset), verified)] =
+                    (vm_memory->uwords[GPR[instr.immed.reg] + machine_types_formOffset(instr.immed.offset)]) ^
                     machine_types_zeroExt(immediate); //instr.immed.immed
                     break;
 
                 case BEQ_O:
-                    if (memory.words[GPR[SP]] == memory.words[GPR[instr.immed.reg] + machine_types_formOffset(instr.immed.offset)])
+                    if (vm_memory->words[GPR[SP]] == vm_memory->words[GPR[instr.immed.reg] + machine_types_formOffset(instr.immed.offset)])
                     {
                         PC = (PC - 1) + machine_types_formOffset(immediate); //instr.immed.immed
                     }
+                    effects |= EXEC_TRANSFER;
                     break;
 
                 case BGEZ_O:
-                    if (memory.words[GPR[instr.immed.reg] + machine_types_formOffset(instr.immed.offset)] >= 0)
+                    if (vm_memory->words[GPR[instr.immed.reg] + machine_types_formOffset(instr.immed.offset)] >= 0)
                     {
                         PC = (PC - 1) + machine_types_formOffset(immediate); //instr.immed.immed
                     }
+                    effects |= EXEC_TRANSFER;
                     break;
 
                 case BGTZ_O:
-                    if (memory.words[GPR[instr.immed.reg] + machine_types_formOffset(instr.immed.offset)] > 0)
+                    if (vm_memory->words[GPR[instr.immed.reg] + machine_types_formOffset(instr.immed.offset)] > 0)
                     {
                         PC = (PC - 1) + machine_types_formOffset(immediate); //instr.immed.immed
                     }
+                    effects |= EXEC_TRANSFER;
                     break;
 
                 case BLEZ_O:
-                    if (memory.words[GPR[instr.immed.reg] + machine_types_formOffset(instr.immed.offset)] <= 0)
+                    if (vm_memory->words[GPR[instr.immed.reg] + machine_types_formOffset(instr.immed.offset)] <= 0)
                     {
                         PC = (PC - 1) + machine_types_formOffset(immediate); //instr.immed.immed
                     }
+                    effects |= EXEC_TRANSFER;
                     break;
 
                 case BLTZ_O:
-                    if (memory.words[GPR[instr.immed.reg] + machine_types_formOffset(instr.immed.offset)] < 0)
+                    if (vm_memory->words[GPR[instr.immed.reg] + machine_types_formOffset(instr.immed.offset)] < 0)
                     {
                         PC = (PC - 1) + machine_types_formOffset(immediate); //instr.immed.immed
                     }
+                    effects |= EXEC_TRANSFER;
                     break;
 
                 case BNE_O:
-                    if (memory.words[GPR[SP]] != memory.words[GPR[instr.immed.reg] + machine_types_formOffset(instr.immed.offset)])
+                    if (vm_memory->words[GPR[SP]] != vm_memory->words[GPR[instr.immed.reg] + machine_types_formOffset(instr.immed.offset)])
                     {
                         PC = (PC - 1) + machine_types_formOffset(immediate); //instr.immed.immed
                     }
+                    effects |= EXEC_TRANSFER;
                     break;
 
                 default:
-                    bail_with_error("Immediate instruction opcode (%d) is invalid!", instr.immed.op);
+                    if (verified) __builtin_unreachable();
+                    vm_fault("Immediate instruction opcode (%d) is invalid!", instr.immed.op);
             }
             break;
 
         case jump_instr_type:
 
+            effects |= EXEC_TRANSFER;
             switch(instr.jump.op) 
             {
                 case JMPA_O:
@@ -607,9 +837,11 @@ void execute_instruction(bin_instr_t instr)
                     break;
                 case RTN_O:
                     PC = GPR[RA];
+                    if (verified) check_verified_target();
                     break;
                 default:
-                    bail_with_error("Jump instruction opcode (%d) is invalid!", instr.jump.op);
+                    if (verified) __builtin_unreachable();
+                    vm_fault("Jump instruction opcode (%d) is invalid!", instr.jump.op);
             }
         break;
 
@@ -618,30 +850,54 @@ void execute_instruction(bin_instr_t instr)
             reg_num_type r = instr.syscall.reg;
             offset_type o = instr.syscall.offset;
             syscall_type code = instruction_syscall_number(instr);
+            effects |= EXEC_TRANSFER;
+
+            if (instr.syscall.code == BREAKPOINT_SC)
+            {
+                PC--;
+                if (vm_breakpoint_hook == NULL)
+                {
+                    vm_fault("Breakpoint trap at PC %u with no debugger attached!", PC);
+                }
+                // The trap is not part of the program, so don't trace it
+                // or keep it in the flight recorder.
+                started_tracing = true;
+                flight_count--;
+                vm_breakpoint_hook();
+                break;
+            }
 
             switch(code) 
             {
                 case exit_sc:
                     if (trace_program)
                     {
-                        printf("==>      %d: %s\n", PC - 1, instruction_assembly_form(PC - 1, instr));
+                        trace_step(PC - 1, instr, false);
                     }
-                    exit(machine_types_sgnExt(o));
+                    vm_exit(machine_types_sgnExt(o));
                     break;
 
                 case print_str_sc:
-                    memory.words[GPR[SP]] = 
-                    printf("%s", (char*)&memory.words[GPR[r] + machine_types_formOffset(o)]);
+                    vm_memory->words[store_address(GPR[SP], verified)] = 
+                    printf("%s", (char*)&vm_memory->words[GPR[r] + machine_types_formOffset(o)]);
                     break;
 
                 case print_char_sc:
-                    memory.words[GPR[SP]] = 
-                    fputc(memory.words[GPR[r] + machine_types_formOffset(o)], stdout);
+                    vm_memory->words[store_address(GPR[SP], verified)] = 
+                    fputc(vm_memory->words[GPR[r] + machine_types_formOffset(o)], stdout);
                     break;
 
                 case read_char_sc:
-                    memory.words[GPR[r] + machine_types_formOffset(o)] =
-                    getc(stdin);
+                    int ch = vm_read_char();
+                    if (ch == VM_INPUT_PENDING)
+                    {
+                        // Park: re-execute this instruction when resumed.
+                        PC--;
+                        vm_input_pending = true;
+                        if (vm_catching) longjmp(vm_escape, VM_YIELDED + 1);
+                        vm_fault("Input is not available for read_char at PC %u!", PC);
+                    }
+                    vm_memory->words[store_address(GPR[r] + machine_types_formOffset(o), verified)] = ch;
                     break;
 
                 case start_tracing_sc:
@@ -650,20 +906,257 @@ void execute_instruction(bin_instr_t instr)
 
                 case stop_tracing_sc:
                     trace_program = false;
-                    printf("==>      %d: %s\n", PC - 1, instruction_assembly_form(PC - 1, instr));
+                    trace_line(instr, false);
                     break;
 
                 default:
-                    bail_with_error("System call instruction code (%d) is invalid!", instr.syscall.code);
+                    if (verified) __builtin_unreachable();
+                    vm_fault("System call instruction code (%d) is invalid!", instr.syscall.code);
             }
         break;
 
         case error_instr_type:
-            bail_with_error("Opcode (%hu) is invalid!", instr.comp.op);
+            if (verified) __builtin_unreachable();
+            vm_fault("Opcode (%hu) is invalid!", instr.comp.op);
+            break;
+    }
+
+    return effects;
+}
+
+// Pre-Condition: None.
+// Post-Condition: Reports an access to vm_access_hook if addr is in memory.
+static void report_access(vm_access_kind kind, word_type addr)
+{
+    if (0 <= addr && addr < MEMORY_SIZE_IN_WORDS) vm_access_hook(kind, addr);
+}
+
+// Pre-Condition: instr is the instruction at PC and has not run yet.
+// Post-Condition: Reports the fetch of instr and every word it will read
+// or write to vm_access_hook, in the order execute touches them.
+static void report_accesses(bin_instr_t instr)
+{
+    vm_access_hook(ACCESS_FETCH, PC);
+
+    switch (instruction_type(instr))
+    {
+        case comp_instr_type:
+        {
+            word_type dst = GPR[instr.comp.rt] + machine_types_formOffset(instr.comp.ot);
+            word_type src = GPR[instr.comp.rs] + machine_types_formOffset(instr.comp.os);
+
+            switch (instr.comp.func)
+            {
+                case ADD_F:
+                case SUB_F:
+                case AND_F:
+                case BOR_F:
+                case NOR_F:
+                case XOR_F:
+                    report_access(ACCESS_READ, GPR[SP]);
+                    report_access(ACCESS_READ, src);
+                    report_access(ACCESS_WRITE, dst);
+                    break;
+                case CPW_F:
+                case NEG_F:
+                    report_access(ACCESS_READ, src);
+                    report_access(ACCESS_WRITE, dst);
+                    break;
+                case LWR_F:
+                    report_access(ACCESS_READ, src);
+                    break;
+                case SWR_F:
+                case SCA_F:
+                    report_access(ACCESS_WRITE, dst);
+                    break;
+                case LWI_F:
+                    report_access(ACCESS_READ, src);
+                    if (0 <= src && src < MEMORY_SIZE_IN_WORDS)
+                    {
+                        report_access(ACCESS_READ, vm_memory->words[src]);
+                    }
+                    report_access(ACCESS_WRITE, dst);
+                    break;
+            }
+            break;
+        }
+
+        case other_comp_instr_type:
+        {
+            word_type addr = GPR[instr.othc.reg] + machine_types_formOffset(instr.othc.offset);
+
+            switch (instr.othc.func)
+            {
+                case LIT_F:
+                case CFHI_F:
+                case CFLO_F:
+                    report_access(ACCESS_WRITE, addr);
+                    break;
+                case MUL_F:
+                case DIV_F:
+                    report_access(ACCESS_READ, GPR[SP]);
+                    report_access(ACCESS_READ, addr);
+                    break;
+                case SLL_F:
+                case SRL_F:
+                    report_access(ACCESS_READ, GPR[SP]);
+                    report_access(ACCESS_WRITE, addr);
+                    break;
+                case JMP_F:
+                case CSI_F:
+                    report_access(ACCESS_READ, addr);
+                    break;
+            }
+            break;
+        }
+
+        case immed_instr_type:
+        {
+            word_type addr = GPR[instr.immed.reg] + machine_types_formOffset(instr.immed.offset);
+
+            switch (instr.immed.op)
+            {
+                case ADDI_O:
+                case ANDI_O:
+                case BORI_O:
+                case XORI_O:
+                    report_access(ACCESS_READ, addr);
+                    report_access(ACCESS_WRITE, addr);
+                    break;
+                case BEQ_O:
+                case BNE_O:
+                    report_access(ACCESS_READ, GPR[SP]);
+                    report_access(ACCESS_READ, addr);
+                    break;
+                default:
+                    report_access(ACCESS_READ, addr);
+                    break;
+            }
+            break;
+        }
+
+        case syscall_instr_type:
+        {
+            word_type addr = GPR[instr.syscall.reg] + machine_types_formOffset(instr.syscall.offset);
+
+            switch (instruction_syscall_number(instr))
+            {
+                case print_str_sc:
+                    // Every word up to the one holding the terminating NUL.
+                    for (word_type a = addr; 0 <= a && a < MEMORY_SIZE_IN_WORDS; a++)
+                    {
+                        report_access(ACCESS_READ, a);
+                        if (memchr(&vm_memory->words[a], '\0', sizeof(word_type)) != NULL) break;
+                    }
+                    report_access(ACCESS_WRITE, GPR[SP]);
+                    break;
+                case print_char_sc:
+                    report_access(ACCESS_READ, addr);
+                    report_access(ACCESS_WRITE, GPR[SP]);
+                    break;
+                case read_char_sc:
+                    report_access(ACCESS_WRITE, addr);
+                    break;
+                default:
+                    break;
+            }
+            break;
+        }
+
+        default:
             break;
     }
 }
 
+vm_region vm_region_of(address_type addr)
+{
+    if (addr < num_instrs) return REGION_TEXT;
+    if (addr >= vm_data_start && addr < vm_data_start + num_globals) return REGION_DATA;
+    if (addr >= vm_data_start + num_globals && addr <= vm_stack_bottom) return REGION_STACK;
+    return REGION_OTHER;
+}
+
+const char* vm_region_name(vm_region region)
+{
+    static const char* names[NUM_REGIONS] = { "text", "data", "stack", "other" };
+    return names[region];
+}
+
+void execute_instruction(bin_instr_t instr)
+{
+    execute(instr, false);
+}
+
+void execute_verified_instruction(bin_instr_t instr)
+{
+    execute(instr, true);
+}
+
+// Pre-Condition: instr was just fetched, so PC is one past it.
+// Post-Condition: Records it in the flight recorder and returns its
+// address.
+static inline address_type record_flight(bin_instr_t instr)
+{
+    flight_entry* entry = &flight_record[flight_count++ & (FLIGHT_RECORDER_SIZE - 1)];
+    entry->pc = PC - 1;
+    entry->instr = instr;
+    entry->sp = GPR[SP];
+    entry->fp = GPR[FP];
+    entry->top = vm_memory->words[GPR[SP]];
+    return entry->pc;
+}
+
+// Pre-Condition: A program has been loaded into memory, and verified if
+// verified is set.
+// Post-Condition: Fetches and executes one instruction, tracing it, and
+// returns its EXEC_ flags. The invariants are checked afterwards if it has
+// any of the flags in check. With observed set, its accesses are reported
+// to vm_access_hook first.
+static inline int vm_step(const bool verified, const bool observed, const int check)
+{
+    if (observed) report_accesses(vm_memory->instrs[PC]);
+
+    bin_instr_t cur_instr = fetch_instruction();
+    address_type pc = record_flight(cur_instr);
+
+    int effects = execute(cur_instr, verified);
+    if (trace_program && started_tracing == false && !vm_quiet) trace_step(pc, cur_instr, true);
+    started_tracing = false;
+    if ((effects & EXEC_TRANSFER) && vm_transfer_hook != NULL) vm_transfer_hook(pc, cur_instr);
+    if (effects & check) invariant_check();
+    return effects;
+}
+
+void vm_step_instruction(bin_instr_t instr)
+{
+    PC++;
+    address_type pc = record_flight(instr);
+
+    int effects = execute(instr, false);
+    if (trace_program && !vm_quiet) trace_step(pc, instr, true);
+    if ((effects & EXEC_TRANSFER) && vm_transfer_hook != NULL) vm_transfer_hook(pc, instr);
+    invariant_check();
+}
+
+// Invariants to check after each instruction. Verified transfers check
+// their own targets, and inside the text only registers and transfers can
+// break an invariant.
+#define CHECK_ALWAYS EXEC_STEP
+#define CHECK_VERIFIED EXEC_REGISTERS
+#define CHECK_IN_TEXT (EXEC_REGISTERS | EXEC_TRANSFER)
+
+// Pre-Condition: The block at PC lies inside the text and ends in a
+// control transfer.
+// Post-Condition: Runs it. Only its last instruction can leave it, so the
+// loop ends on that instruction's own transfer rather than on a count. A
+// program that stores over the transfer keeps going to the next one, as
+// block_lengths is not updated.
+static inline void vm_run_block(const bool verified)
+{
+    int check = verified ? CHECK_VERIFIED : CHECK_IN_TEXT;
+    while (!(vm_step(verified, false, check) & EXEC_TRANSFER));
+}
+
 void vm_run_program()
 {
     if (trace_program)
@@ -673,14 +1166,189 @@ void vm_run_program()
 
     invariant_check();
 
-    bin_instr_t cur_instr;
-
+    // Faults, including those a signal handler reports, come back here
+    // out of vm_run_for, so they are reported outside the handler.
     while (true)
     {
-        cur_instr = fetch_instruction();
-        execute_instruction(cur_instr);
-        if (trace_program && started_tracing == false) trace_instruction(cur_instr);
-        started_tracing = false;
-        invariant_check();
+        vm_status status = vm_run_for(ULLONG_MAX);
+        if (status == VM_EXITED) exit(vm_exit_code);
+        if (status == VM_FAULTED)
+        {
+            if (vm_trace_finish != NULL) vm_trace_finish();
+            fflush(stdout);
+            print_flight_record(stderr);
+            bail_with_error("%s", vm_fault_message);
+        }
+    }
+}
+
+vm_status vm_run_for(unsigned long long n)
+{
+    volatile address_type block_start = PC;
+    volatile unsigned long long block_len = 0;
+    vm_input_pending = false;
+
+    // vm_fault and vm_exit land here with the status plus one.
+    int escape = setjmp(vm_escape);
+    if (escape != 0)
+    {
+        vm_catching = false;
+        if (signal_fault != NULL)
+        {
+            signal_fault();
+            signal_fault = NULL;
+        }
+        // Exact unless a fault came from the invariant check after a jump.
+        if (PC >= block_start) vm_instr_count += PC - block_start;
+        if (vm_coverage_hook != NULL && PC > block_start && block_len > 0)
+        {
+            address_type last = PC - 1;
+            if (last >= block_start + block_len) last = block_start + block_len - 1;
+            vm_coverage_hook(block_start, last, PC);
+        }
+        return (vm_status) (escape - 1);
+    }
+    vm_catching = true;
+    if (!vm_memory_guarded) *memory_end = end_of_memory;
+
+    while (n > 0)
+    {
+        // Charge a whole straight-line block at once so that only
+        // control transfers pay for the budget check.
+        unsigned long long len = (PC < num_instrs) ? block_lengths[PC] : 1;
+        unsigned long long before = flight_count;
+
+        block_start = PC;
+        block_len = len;
+        if (vm_access_hook != NULL)
+        {
+            // Observed runs report every access, so only they pay for it.
+            if (len > n) len = n;
+            block_len = len;
+            for (unsigned long long i = 0; i < len; i++)
+            {
+                vm_step(false, true, CHECK_ALWAYS);
+            }
+        }
+        else if (len <= n && PC + len < num_instrs)
+        {
+            vm_run_block(program_verified);
+        }
+        else
+        {
+            // The last block of the text, anything outside it, or the
+            // part of a block the budget covers is counted out instead.
+            if (len > n) len = n;
+            block_len = len;
+            for (unsigned long long i = 0; i < len; i++)
+            {
+                vm_step(program_verified, false, program_verified ? CHECK_VERIFIED : CHECK_ALWAYS);
+            }
+        }
+
+        // Every step leaves an entry in the flight recorder.
+        unsigned long long ran = flight_count - before;
+        n -= (ran < n) ? ran : n;
+        vm_instr_count += ran;
+        // A trap that only gave back the word it was patched over ran
+        // nothing.
+        if (vm_coverage_hook != NULL && ran > 0) vm_coverage_hook(block_start, block_start + ran - 1, PC);
     }
+
+    vm_catching = false;
+    return VM_YIELDED;
+}
+
+void vm_fault(const char* fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(vm_fault_message, 256, fmt, args);
+    va_end(args);
+
+    if (vm_catching) longjmp(vm_escape, VM_FAULTED + 1);
+
+    fflush(stdout);
+    print_flight_record(stderr);
+    bail_with_error("%s", vm_fault_message);
+}
+
+void vm_signal_fault(void (*describe)(void))
+{
+    if (!vm_catching) return;
+    signal_fault = describe;
+    longjmp(vm_escape, VM_FAULTED + 1);
+}
+
+void print_flight_record(FILE* out)
+{
+    unsigned long long first = 0;
+    if (flight_count > FLIGHT_RECORDER_SIZE) first = flight_count - FLIGHT_RECORDER_SIZE;
+    if (flight_count == 0) return;
+
+    fprintf(out, "Last %llu instructions executed:\n", flight_count - first);
+    for (unsigned long long i = first; i < flight_count; i++)
+    {
+        flight_entry* entry = &flight_record[i & (FLIGHT_RECORDER_SIZE - 1)];
+        fprintf(out, "==>      %d: %s\n", entry->pc, instruction_assembly_form(entry->pc, entry->instr));
+        fprintf(out, "GPR[%s]: %-5d GPR[%s]: %-5d memory[%d]: %d\n",
+                regname_get(SP), entry->sp, regname_get(FP), entry->fp, entry->sp, entry->top);
+    }
+}
+
+void clear_flight_record(void)
+{
+    flight_count = 0;
+}
+
+void vm_exit(int code)
+{
+    vm_exit_code = code;
+    if (vm_catching) longjmp(vm_escape, VM_EXITED + 1);
+    exit(code);
+}
+
+void vm_save_context(vm_context* ctx)
+{
+    if (ctx->mem == NULL)
+    {
+        ctx->mem = malloc(sizeof(union mem_u));
+        if (ctx->mem == NULL)
+        {
+            bail_with_error("Unable to allocate memory for a saved VM context!");
+        }
+    }
+
+    memcpy(ctx->mem, vm_memory, sizeof(union mem_u));
+    vm_save_registers(ctx);
+}
+
+void vm_restore_context(const vm_context* ctx)
+{
+    memcpy(vm_memory, ctx->mem, sizeof(union mem_u));
+    vm_restore_registers(ctx);
+}
+
+void vm_save_registers(vm_context* ctx)
+{
+    memcpy(ctx->GPR, GPR, sizeof(GPR));
+    ctx->HI = HI;
+    ctx->LO = LO;
+    ctx->PC = PC;
+    ctx->num_instrs = num_instrs;
+    ctx->num_globals = num_globals;
+    ctx->block_lengths = block_lengths;
+    ctx->trace_program = trace_program;
+}
+
+void vm_restore_registers(const vm_context* ctx)
+{
+    memcpy(GPR, ctx->GPR, sizeof(GPR));
+    HI = ctx->HI;
+    LO = ctx->LO;
+    PC = ctx->PC;
+    num_instrs = ctx->num_instrs;
+    num_globals = ctx->num_globals;
+    block_lengths = ctx->block_lengths;
+    trace_program = ctx->trace_program;
 }
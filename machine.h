@@ -7,13 +7,26 @@
 
 #define MEMORY_SIZE_IN_WORDS 32768
 
+// Width after which printed global data and stack wrap to a new line.
+#define MAX_PRINT_WIDTH 59
+
 // Memory
-extern union mem_u
+union mem_u
 {
 word_type words[MEMORY_SIZE_IN_WORDS];
 uword_type uwords[MEMORY_SIZE_IN_WORDS];
 bin_instr_t instrs[MEMORY_SIZE_IN_WORDS];
-} memory;
+};
+
+// Memory is mapped at this fixed, page-aligned address before main runs,
+// so every access is to a constant address rather than through a pointer
+// that stores could change. In safe mode guard.c reserves the address
+// space on either side of it.
+#define VM_MEMORY_ADDRESS 0x100000000000ull
+static union mem_u* const vm_memory = (union mem_u*) VM_MEMORY_ADDRESS;
+
+// Set by guard.c once the page after memory is part of a guard region.
+extern bool vm_memory_guarded;
 
 // General purpose registers
 extern word_type GPR[NUM_REGISTERS];
@@ -30,6 +43,69 @@ extern unsigned int num_globals;
 
 extern bool trace_program;
 
+// Set once verify_program has accepted the loaded program, so that it
+// runs without the checks the verifier made redundant.
+extern bool program_verified;
+
+// Set while re-executing history the user has already seen, so that
+// instructions are not traced again.
+extern bool vm_quiet;
+
+// Result of running a program for a bounded number of instructions.
+typedef enum { VM_YIELDED, VM_EXITED, VM_FAULTED } vm_status;
+
+// Returned by vm_read_char when no input character is available yet.
+#define VM_INPUT_PENDING (-2)
+
+// Number of straight-line instructions starting at each text address,
+// up to and including the next instruction that may transfer control.
+extern unsigned int* block_lengths;
+
+// Total number of instructions executed by vm_run_for.
+extern unsigned long long vm_instr_count;
+
+// Exit code of the program after vm_run_for returns VM_EXITED.
+extern int vm_exit_code;
+
+// Message describing the error after vm_run_for returns VM_FAULTED.
+extern char vm_fault_message[];
+
+// True if the last VM_YIELDED was caused by read_char_sc finding no input.
+extern bool vm_input_pending;
+
+// Input source for read_char_sc. Returns the next character, EOF, or
+// VM_INPUT_PENDING. Defaults to reading from stdin.
+extern int (*vm_read_char)(void);
+
+// System call code reserved for the trap instruction a debugger patches
+// over an instruction to set a breakpoint there.
+#define BREAKPOINT_SC 2045
+
+// Called when a breakpoint trap executes, with PC pointing at the trap.
+// NULL unless a debugger is installed.
+extern void (*vm_breakpoint_hook)(void);
+
+// Pre-Condition: PC points at a trap and instr is the instruction the
+// trap was patched over.
+// Post-Condition: Executes instr as if it had been fetched from PC,
+// recording it in the flight recorder and tracing it like any other
+// instruction.
+extern void vm_step_instruction(bin_instr_t instr);
+
+// Saved copy of a loaded program's state, so it can be resumed later.
+typedef struct
+{
+    union mem_u* mem;
+    word_type GPR[NUM_REGISTERS];
+    word_type HI;
+    word_type LO;
+    address_type PC;
+    unsigned int num_instrs;
+    unsigned int num_globals;
+    unsigned int* block_lengths;
+    bool trace_program;
+} vm_context;
+
 // Pre-Condition: bof represents a valid binary object file.
 // Post-Condition: Loads the file's instructions and global data
 // into memory and initializes registers.
@@ -48,6 +124,11 @@ extern void invariant_check();
 // Post-Condition: Loads instructions from the BOF into program memory
 extern void load_instrs(BOFFILE bof, BOFHeader header);
 
+// Pre-Condition: Instructions have been loaded into program memory.
+// Post-Condition: Fills in block_lengths for the loaded text, reusing the
+// table of the previous load.
+extern void compute_block_lengths();
+
 // Pre-Condition: bof and header are a valid binary object file and header, respectively
 // Post-Condition: Loads global data from the BOF into program memory
 extern void load_globals(BOFFILE bof, BOFHeader header);
@@ -73,8 +154,128 @@ extern bin_instr_t fetch_instruction();
 
 extern void execute_instruction(bin_instr_t instr);
 
+// Pre-Condition: The loaded program passed verify_program.
+// Post-Condition: Executes instr without range checking static branch
+// targets.
+extern void execute_verified_instruction(bin_instr_t instr);
+
 extern void print_state();
 
+// Pre-Condition: regs holds NUM_REGISTERS registers and words a whole
+// memory image.
+// Post-Condition: Prints to out what print_state would if the machine
+// were in the state they describe. Touches no VM globals, so it can be
+// used to format a copy of the state from another thread.
+extern void print_state_of(FILE* out, address_type pc, const word_type* regs, word_type hi, word_type lo,
+                           const word_type* words);
+
 extern void vm_run_program();
 
+// Kinds of memory access reported to vm_access_hook.
+typedef enum { ACCESS_FETCH, ACCESS_READ, ACCESS_WRITE } vm_access_kind;
+
+// Called before each instruction runs, with PC still at the instruction,
+// once for its fetch and once for every word it will read or write.
+// Addresses outside memory are not reported. While this is set, vm_run_for
+// runs the program in a separate observed loop, so the normal loops pay
+// nothing for it.
+extern void (*vm_access_hook)(vm_access_kind kind, address_type addr);
+
+// Called after each instruction runs while tracing is on, with the
+// address it ran from. Only instructions it returns true for are traced.
+// NULL traces every instruction.
+extern bool (*vm_trace_filter)(address_type pc, bin_instr_t instr);
+
+// Called instead of printing the trace of each instruction that is
+// traced, after it runs, with PC one past it. with_state is false for an
+// instruction that exits or stops tracing, whose trace is only its line.
+// NULL traces with trace_instruction.
+extern void (*vm_trace_hook)(bin_instr_t instr, bool with_state);
+
+// Called before vm_run_program reports a fault, so that trace output
+// vm_trace_hook has queued comes out ahead of the report.
+extern void (*vm_trace_finish)(void);
+
+// Called after each instruction that may have transferred control, such
+// as a call or a return, with the address it ran from, whether or not
+// tracing is on. Straight-line instructions never pay for the check.
+extern void (*vm_transfer_hook)(address_type pc, bin_instr_t instr);
+
+// Called by vm_run_for after each straight-line run of instructions from
+// first to last, with next the address control went to after last.
+extern void (*vm_coverage_hook)(address_type first, address_type last, address_type next);
+
+// Where the loaded program's header put its data and stack.
+extern address_type vm_data_start;
+extern address_type vm_stack_bottom;
+
+// Regions of memory, as laid out by the BOF header.
+typedef enum { REGION_TEXT, REGION_DATA, REGION_STACK, REGION_OTHER } vm_region;
+#define NUM_REGIONS 4
+
+// Pre-Condition: A program has been loaded.
+// Post-Condition: Returns the region addr is in: the text, the global
+// data from vm_data_start, the stack between the data and
+// vm_stack_bottom, or none of them.
+extern vm_region vm_region_of(address_type addr);
+
+// Pre-Condition: None.
+// Post-Condition: Returns the name of region, such as "stack".
+extern const char* vm_region_name(vm_region region);
+
+// Number of most recent instructions the flight recorder keeps.
+// Must be a power of two.
+#define FLIGHT_RECORDER_SIZE 64
+
+// Pre-Condition: None.
+// Post-Condition: Prints the last instructions executed, oldest first,
+// with the stack and frame pointers and the top of the stack before each.
+// vm_fault prints this before reporting an error, and so does each caller
+// of vm_run_for that reports a fault it returned.
+extern void print_flight_record(FILE* out);
+
+// Pre-Condition: vm_run_for is not running.
+// Post-Condition: Empties the flight recorder, so that a fault in the next
+// run is not shown with instructions left over from an earlier one.
+extern void clear_flight_record(void);
+
+// Pre-Condition: A program has been loaded into memory.
+// Post-Condition: Executes at most n instructions and returns whether the
+// program yielded, exited or faulted. The budget is only checked at
+// control transfers, never inside straight-line code.
+extern vm_status vm_run_for(unsigned long long n);
+
+// Pre-Condition: fmt is a printf-style format string for the arguments.
+// Post-Condition: Reports a run-time error. Inside vm_run_for this makes it
+// return VM_FAULTED; otherwise the error is reported and the VM exits.
+extern void vm_fault(const char* fmt, ...);
+
+// Pre-Condition: Called from a signal handler, for a fault caused by the
+// running instruction. describe only touches VM globals.
+// Post-Condition: If vm_run_for is running, leaves the handler for it,
+// which then calls describe to fill in vm_fault_message and returns
+// VM_FAULTED. Otherwise returns.
+extern void vm_signal_fault(void (*describe)(void));
+
+// Pre-Condition: The program executed an exit system call.
+// Post-Condition: Makes vm_run_for return VM_EXITED, or exits the VM
+// with the given code if the program is not running under vm_run_for.
+extern void vm_exit(int code);
+
+// Pre-Condition: ctx->mem is NULL or points to a previously saved memory image.
+// Post-Condition: Copies the current VM state into ctx.
+extern void vm_save_context(vm_context* ctx);
+
+// Pre-Condition: ctx was filled in by vm_save_context.
+// Post-Condition: Makes the state saved in ctx the current VM state.
+extern void vm_restore_context(const vm_context* ctx);
+
+// Pre-Condition: None.
+// Post-Condition: Copies everything but memory into ctx.
+extern void vm_save_registers(vm_context* ctx);
+
+// Pre-Condition: ctx was filled in by vm_save_registers or vm_save_context.
+// Post-Condition: Restores everything but memory from ctx.
+extern void vm_restore_registers(const vm_context* ctx);
+
 #endif
\ No newline at end of file
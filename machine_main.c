@@ -8,10 +8,32 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
+#include <limits.h>
 #include "machine.h"
 #include "bof.h"
 #include "instruction.h"
 #include "utilities.h"
+#include "scheduler.h"
+#include "snapshot.h"
+#include "guard.h"
+#include "verify.h"
+#include "debugger.h"
+#include "watch.h"
+#include "checkpoint.h"
+#include "timetravel.h"
+#include "batch.h"
+#include "perfmodel.h"
+#include "cache.h"
+#include "heatmap.h"
+#include "compact.h"
+#include "server.h"
+#include "imagecache.h"
+#include "bench.h"
+#include "tracefilter.h"
+#include "asynctrace.h"
+#include "tracecmp.h"
+#include "cosim.h"
+#include "coverage.h"
 
 
 #define DEBUG 0
@@ -19,6 +41,43 @@
 void testPrint(int argcP, char* argvP[]);
 
 bool print_assembly = false;
+bool run_scheduled = false;
+unsigned long long sched_slice = SCHED_DEFAULT_SLICE;
+unsigned long long sched_limit = 0;
+bool run_inputs = false;
+bool run_batched = false;
+bool safe_mode = false;
+bool verify_first = false;
+const char* debug_commands = NULL;
+int num_watch_args = 0;
+char* watch_args[MAX_WATCHPOINTS];
+const char* checkpoint_path = NULL;
+const char* resume_path = NULL;
+unsigned long long checkpoint_every = 0;
+const char* timetravel_commands = NULL;
+unsigned long long timetravel_interval = TT_DEFAULT_INTERVAL;
+const char* cost_table = NULL;
+const char* cache_spec = NULL;
+const char* heatmap_path = NULL;
+const char* compact_path = NULL;
+const char* serve_path = NULL;
+int serve_workers = SERVER_DEFAULT_WORKERS;
+const char* request_path = NULL;
+bool run_bench = false;
+int bench_reps = BENCH_DEFAULT_REPS;
+const char* bench_baseline = NULL;
+const char* bench_save = NULL;
+bool filter_trace = false;
+bool async_trace = false;
+const char* compare_path = NULL;
+const char* expect_path = NULL;
+bool run_cosim = false;
+const char* coverage_path = NULL;
+bool report_coverage = false;
+const char* lcov_path = NULL;
+
+int run_each_input(const char* bof_name, int num_inputs, char* inputs[]);
+void usage(const char* name);
 
 int main(int argc, char* argv[])
 {
@@ -28,18 +87,308 @@ int main(int argc, char* argv[])
         testPrint(argc, argv);
     }
 
-    if (argc == 3 && strcmp(argv[1], "-p") == 0)
+    // Options come before the file name(s).
+    int arg = 1;
+    while (arg < argc && argv[arg][0] == '-')
+    {
+        if (strcmp(argv[arg], "-p") == 0)
+        {
+            print_assembly = true;
+            if (DEBUG) printf("DEBUG: Print mode activated\n");
+        }
+        else if (strcmp(argv[arg], "-s") == 0)
+        {
+            run_scheduled = true;
+        }
+        else if (strcmp(argv[arg], "-r") == 0)
+        {
+            run_inputs = true;
+        }
+        else if (strcmp(argv[arg], "-b") == 0)
+        {
+            run_batched = true;
+        }
+        else if (strcmp(argv[arg], "--safe") == 0)
+        {
+            safe_mode = true;
+        }
+        else if (strcmp(argv[arg], "-v") == 0)
+        {
+            verify_first = true;
+        }
+        else if (strcmp(argv[arg], "-d") == 0 && arg + 1 < argc)
+        {
+            debug_commands = argv[++arg];
+        }
+        else if (strcmp(argv[arg], "-w") == 0 && arg + 1 < argc && num_watch_args < MAX_WATCHPOINTS)
+        {
+            watch_args[num_watch_args++] = argv[++arg];
+        }
+        else if (strcmp(argv[arg], "--checkpoint") == 0 && arg + 1 < argc)
+        {
+            checkpoint_path = argv[++arg];
+        }
+        else if (strcmp(argv[arg], "--every") == 0 && arg + 1 < argc)
+        {
+            checkpoint_every = strtoull(argv[++arg], NULL, 10);
+        }
+        else if (strcmp(argv[arg], "--resume") == 0 && arg + 1 < argc)
+        {
+            resume_path = argv[++arg];
+        }
+        else if (strcmp(argv[arg], "-t") == 0 && arg + 1 < argc)
+        {
+            timetravel_commands = argv[++arg];
+        }
+        else if (strcmp(argv[arg], "--interval") == 0 && arg + 1 < argc)
+        {
+            timetravel_interval = strtoull(argv[++arg], NULL, 10);
+        }
+        else if (strcmp(argv[arg], "--model") == 0 && arg + 1 < argc)
+        {
+            cost_table = argv[++arg];
+        }
+        else if (strcmp(argv[arg], "--cache") == 0 && arg + 1 < argc)
+        {
+            cache_spec = argv[++arg];
+        }
+        else if (strcmp(argv[arg], "--heatmap") == 0 && arg + 1 < argc)
+        {
+            heatmap_path = argv[++arg];
+        }
+        else if (strcmp(argv[arg], "--compact") == 0 && arg + 1 < argc)
+        {
+            compact_path = argv[++arg];
+        }
+        else if (strcmp(argv[arg], "--serve") == 0 && arg + 1 < argc)
+        {
+            serve_path = argv[++arg];
+        }
+        else if (strcmp(argv[arg], "--workers") == 0 && arg + 1 < argc)
+        {
+            serve_workers = atoi(argv[++arg]);
+        }
+        else if (strcmp(argv[arg], "--request") == 0 && arg + 1 < argc)
+        {
+            request_path = argv[++arg];
+        }
+        else if (strcmp(argv[arg], "--image-cache") == 0 && arg + 1 < argc)
+        {
+            image_cache_dir = argv[++arg];
+        }
+        else if (strcmp(argv[arg], "--bench") == 0)
+        {
+            run_bench = true;
+        }
+        else if (strcmp(argv[arg], "--reps") == 0 && arg + 1 < argc)
+        {
+            bench_reps = atoi(argv[++arg]);
+        }
+        else if (strcmp(argv[arg], "--baseline") == 0 && arg + 1 < argc)
+        {
+            bench_baseline = argv[++arg];
+        }
+        else if (strcmp(argv[arg], "--save") == 0 && arg + 1 < argc)
+        {
+            bench_save = argv[++arg];
+        }
+        else if (strcmp(argv[arg], "--trace-range") == 0 && arg + 1 < argc)
+        {
+            int lo, hi;
+            int fields = sscanf(argv[++arg], "%d-%d", &lo, &hi);
+            if (fields == 1) hi = lo;
+            if (fields < 1 || lo < 0 || hi < lo || hi >= MEMORY_SIZE_IN_WORDS || !trace_add_range(lo, hi))
+            {
+                bail_with_error("Invalid trace range: %s", argv[arg]);
+            }
+            filter_trace = true;
+        }
+        else if (strcmp(argv[arg], "--trace-routine") == 0 && arg + 1 < argc)
+        {
+            int addr;
+            if (sscanf(argv[++arg], "%d", &addr) != 1 || addr < 0 || addr >= MEMORY_SIZE_IN_WORDS)
+            {
+                bail_with_error("Invalid trace routine: %s", argv[arg]);
+            }
+            trace_set_routine(addr);
+            filter_trace = true;
+        }
+        else if (strcmp(argv[arg], "--trace-first") == 0 && arg + 1 < argc)
+        {
+            trace_set_first(strtoull(argv[++arg], NULL, 10));
+            filter_trace = true;
+        }
+        else if (strcmp(argv[arg], "--trace-every") == 0 && arg + 1 < argc)
+        {
+            trace_set_every(strtoull(argv[++arg], NULL, 10));
+            filter_trace = true;
+        }
+        else if (strcmp(argv[arg], "--trace-when") == 0 && arg + 1 < argc)
+        {
+            if (!trace_set_condition(argv[++arg]))
+            {
+                bail_with_error("Invalid trace condition: %s", argv[arg]);
+            }
+            filter_trace = true;
+        }
+        else if (strcmp(argv[arg], "--async-trace") == 0)
+        {
+            async_trace = true;
+        }
+        else if (strcmp(argv[arg], "--compare") == 0 && arg + 1 < argc)
+        {
+            compare_path = argv[++arg];
+        }
+        else if (strcmp(argv[arg], "--expect") == 0 && arg + 1 < argc)
+        {
+            expect_path = argv[++arg];
+        }
+        else if (strcmp(argv[arg], "--cosim") == 0)
+        {
+            run_cosim = true;
+        }
+        else if (strcmp(argv[arg], "--coverage") == 0 && arg + 1 < argc)
+        {
+            coverage_path = argv[++arg];
+        }
+        else if (strcmp(argv[arg], "--coverage-report") == 0)
+        {
+            report_coverage = true;
+        }
+        else if (strcmp(argv[arg], "--lcov") == 0 && arg + 1 < argc)
+        {
+            lcov_path = argv[++arg];
+        }
+        else if (strcmp(argv[arg], "--slice") == 0 && arg + 1 < argc)
+        {
+            sched_slice = strtoull(argv[++arg], NULL, 10);
+        }
+        else if (strcmp(argv[arg], "--limit") == 0 && arg + 1 < argc)
+        {
+            sched_limit = strtoull(argv[++arg], NULL, 10);
+        }
+        else
+        {
+            bail_with_error("Unknown option: %s", argv[arg]);
+        }
+        arg++;
+    }
+
+    if (run_bench)
+    {
+        // The workloads are generated, so no BOF is needed.
+        return bench_run(bench_reps, bench_baseline, bench_save);
+    }
+
+    if (arg >= argc && resume_path == NULL)
+    {
+        usage(argv[0]);
+    }
+
+    if (compare_path != NULL)
+    {
+        // The argument is the trace to check, not a program.
+        return trace_compare_files(compare_path, argv[arg], stdout);
+    }
+
+    if (report_coverage)
+    {
+        // The arguments after the program are coverage files.
+        return coverage_report(argv[arg], argc - arg - 1, &argv[arg + 1], lcov_path, stdout);
+    }
+
+    if (expect_path != NULL)
+    {
+        trace_expect(expect_path);
+    }
+
+    if (coverage_path != NULL)
+    {
+        if (cache_spec != NULL || heatmap_path != NULL)
+        {
+            bail_with_error("Coverage cannot be collected with --cache or --heatmap!");
+        }
+        // A coverage file is keyed by the one program it covers.
+        if ((run_scheduled && argc - arg > 1) || serve_path != NULL)
+        {
+            bail_with_error("Coverage (--coverage) only applies to runs of one program!");
+        }
+        coverage_enable(coverage_path);
+    }
+
+    if (num_watch_args > 0 && (run_scheduled || run_inputs || run_batched || run_cosim
+                               || serve_path != NULL || request_path != NULL || resume_path != NULL))
+    {
+        bail_with_error("Watchpoints (-w) only apply to a single run of one program!");
+    }
+
+    if (filter_trace)
+    {
+        trace_filter_enable();
+    }
+
+    if (safe_mode && !guard_memory_enable())
+    {
+        bail_with_error("Unable to reserve guard regions for safe mode!");
+    }
+
+    if (request_path != NULL)
+    {
+        // The argument is an image number on the server, not a file.
+        return server_request_run(request_path, strtoul(argv[arg], NULL, 10), sched_limit);
+    }
+
+    if (serve_path != NULL)
+    {
+        server_run(serve_path, argc - arg, &argv[arg], serve_workers, verify_first);
+    }
+
+    if (run_scheduled)
+    {
+        // All instances share standard input; whichever reads first gets it.
+        for (int i = arg; i < argc; i++)
+        {
+            sched_add(argv[i], 0);
+        }
+        return sched_run(sched_slice, sched_limit) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    if (run_cosim)
+    {
+        return cosim_run(argv[arg], sched_limit);
+    }
+
+    if (run_batched)
+    {
+        return batch_run(argv[arg], argc - arg - 1, &argv[arg + 1]);
+    }
+
+    if (run_inputs)
+    {
+        return run_each_input(argv[arg], argc - arg - 1, &argv[arg + 1]);
+    }
+
+    if (resume_path != NULL)
     {
-        print_assembly = true;
-        if (DEBUG) printf("DEBUG: Print mode activated\n");
+        // The checkpoint holds the whole memory image, so no BOF is needed.
+        checkpoint_resume(resume_path);
+        if (cache_spec != NULL && !cache_enable(cache_spec))
+        {
+            bail_with_error("Invalid cache configuration: %s", cache_spec);
+        }
+        if (heatmap_path != NULL)
+        {
+            heatmap_enable(heatmap_path);
+        }
+        checkpoint_enable(checkpoint_path != NULL ? checkpoint_path : resume_path);
+        checkpoint_run(checkpoint_every);
     }
 
     BOFFILE bof;
 
-    if (print_assembly) bof = bof_read_open(argv[2]);
-    else bof = bof_read_open(argv[1]);
+    bof = bof_read_open(argv[arg]);
 
-    if (DEBUG) printf("arg2 is %s", argv[2]);
+    if (DEBUG) printf("file name is %s", argv[arg]);
     //BOFHeader headerTest = bof_read_header(bof);
     //printf("DEBUG: headerTest data length is %d\n", headerTest.data_length);
 
@@ -47,19 +396,190 @@ int main(int argc, char* argv[])
 
     load_bof(bof);
 
+    if (compact_path != NULL)
+    {
+        // Convert rather than run.
+        FILE* out = fopen(compact_path, "wb");
+        if (out == NULL || !compact_write(out) || fclose(out) != 0)
+        {
+            bail_with_error("Unable to write compact BOF %s!", compact_path);
+        }
+        return EXIT_SUCCESS;
+    }
+
+    if (verify_first && !print_assembly)
+    {
+        // An image that passed before need not be checked again.
+        char problem[256];
+        if (!image_cache_verified && !verify_program(problem, sizeof(problem)))
+        {
+            bail_with_error("%s: %s", argv[arg], problem);
+        }
+        program_verified = true;
+        image_cache_mark_verified();
+    }
+
+    for (int i = 0; i < num_watch_args && !print_assembly; i++)
+    {
+        int lo, hi;
+        int fields = sscanf(watch_args[i], "%d-%d", &lo, &hi);
+        if (fields == 1) hi = lo;
+        if (fields < 1 || lo < 0 || hi < lo || hi >= MEMORY_SIZE_IN_WORDS)
+        {
+            bail_with_error("Invalid watchpoint range: %s", watch_args[i]);
+        }
+        if (!watch_add(lo, hi))
+        {
+            bail_with_error("Unable to set watchpoint on %s!", watch_args[i]);
+        }
+    }
+
+    if (debug_commands != NULL && !print_assembly)
+    {
+        // Use /dev/tty as the command file to debug interactively.
+        FILE* commands = fopen(debug_commands, "r");
+        if (commands == NULL)
+        {
+            bail_with_error("Unable to open debugger command file %s!", debug_commands);
+        }
+        debugger_start(commands);
+    }
+
+    if (cache_spec != NULL && !print_assembly && !cache_enable(cache_spec))
+    {
+        bail_with_error("Invalid cache configuration: %s", cache_spec);
+    }
+
+    if (heatmap_path != NULL && !print_assembly)
+    {
+        heatmap_enable(heatmap_path);
+    }
+
     if (print_assembly)
     {
         vm_print_program(stdout);
     }
 
+    else if (timetravel_commands != NULL)
+    {
+        // Use /dev/tty as the command file to travel interactively.
+        FILE* commands = fopen(timetravel_commands, "r");
+        if (commands == NULL)
+        {
+            bail_with_error("Unable to open time-travel command file %s!", timetravel_commands);
+        }
+        timetravel_run(commands, timetravel_interval);
+    }
+
+    else if (cost_table != NULL)
+    {
+        model_load_costs(cost_table);
+        model_run(stderr);
+    }
+
+    else if (checkpoint_path != NULL)
+    {
+        checkpoint_enable(checkpoint_path);
+        checkpoint_run(checkpoint_every);
+    }
+
     else
     {
+        // The debugger can change memory behind the writer's back.
+        if (async_trace && trace_program && debug_commands == NULL)
+        {
+            async_trace_start();
+        }
         vm_run_program();
     }
 
     return EXIT_SUCCESS;
 }
 
+// Pre-Condition: bof_name names a valid binary object file and inputs
+// names num_inputs readable files.
+// Post-Condition: Loads the program once and runs it against each input
+// file as its standard input, resetting to the loaded state in between.
+// Returns EXIT_FAILURE if any run did not exit with code 0.
+int run_each_input(const char* bof_name, int num_inputs, char* inputs[])
+{
+    BOFFILE bof = bof_read_open(bof_name);
+    load_bof(bof);
+    bof_close(bof);
+
+    if (verify_first)
+    {
+        char problem[256];
+        if (!image_cache_verified && !verify_program(problem, sizeof(problem)))
+        {
+            bail_with_error("%s: %s", bof_name, problem);
+        }
+        program_verified = true;
+        image_cache_mark_verified();
+    }
+
+    vm_snapshot snap;
+    snapshot_take(&snap);
+
+    int result = EXIT_SUCCESS;
+    for (int i = 0; i < num_inputs; i++)
+    {
+        if (i > 0) snapshot_reset(&snap);
+
+        if (freopen(inputs[i], "r", stdin) == NULL)
+        {
+            bail_with_error("Unable to open input file %s!", inputs[i]);
+        }
+
+        if (trace_program) print_state();
+        clear_flight_record();
+        vm_status status = vm_run_for(ULLONG_MAX);
+        fflush(stdout);
+
+        if (status == VM_FAULTED)
+        {
+            print_flight_record(stderr);
+            fprintf(stderr, "%s: %s\n", inputs[i], vm_fault_message);
+            result = EXIT_FAILURE;
+        }
+        else if (vm_exit_code != 0)
+        {
+            result = EXIT_FAILURE;
+        }
+    }
+
+    snapshot_release(&snap);
+    return result;
+}
+
+// Pre-Condition: None.
+// Post-Condition: Prints how to invoke the VM and exits.
+void usage(const char* name)
+{
+    bail_with_error("Usage: %s [options] file.bof\n"
+                    "       %s -p file.bof\n"
+                    "       %s -s [--slice N] [--limit N] file.bof ...\n"
+                    "       %s -r file.bof input ...\n"
+                    "       %s -b file.bof input ...\n"
+                    "       %s --resume checkpoint [--checkpoint file] [--every N]\n"
+                    "       %s -t commands [--interval N] file.bof\n"
+                    "       %s --compact out.bofz file.bof\n"
+                    "       %s --serve socket [--workers N] [-v] file.bof ...\n"
+                    "       %s --request socket [--limit N] image < input\n"
+                    "       %s --bench [--reps N] [--baseline file] [--save file]\n"
+                    "       %s --compare expected.out actual.out\n"
+                    "       %s --cosim [--limit N] file.bof\n"
+                    "       %s --coverage-report [--lcov out.info] file.bof run.cov ...\n"
+                    "Options: --safe, -v, -d commands, -w addr[-addr],\n"
+                    "         --checkpoint file [--every N], --model costs,\n"
+                    "         --cache default|level=size:ways:line,...,\n"
+                    "         --heatmap file[.csv], --image-cache dir,\n"
+                    "         --trace-range addr[-addr], --trace-routine addr,\n"
+                    "         --trace-first N, --trace-every N, --trace-when addr<op>value,\n"
+                    "         --async-trace, --expect expected.out, --coverage run.cov",
+                    name, name, name, name, name, name, name, name, name, name, name, name, name, name);
+}
+
 // we can remove this after we're done
 void testPrint(int argcP, char* argvP[])
 {
@@ -0,0 +1,115 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "mempage.h"
+#include "machine.h"
+#include "utilities.h"
+
+unsigned int mem_num_pages = 0;
+size_t mem_page_bytes = 0;
+
+// A clean page is kept read-only, so the first store to it faults and
+// lands in on_write_fault, which marks it dirty and makes it writable.
+static volatile sig_atomic_t dirty[MAX_MEM_PAGES];
+static bool tracking = false;
+static struct sigaction previous_action;
+
+static void on_write_fault(int sig, siginfo_t* info, void* uctx)
+{
+    uintptr_t base = (uintptr_t) vm_memory;
+    uintptr_t addr = (uintptr_t) info->si_addr;
+
+    if (tracking && addr >= base && addr < base + sizeof(union mem_u))
+    {
+        unsigned int page = (addr - base) / mem_page_bytes;
+        if (!dirty[page])
+        {
+            dirty[page] = 1;
+            mprotect((char*) vm_memory + page * mem_page_bytes, mem_page_bytes, PROT_READ | PROT_WRITE);
+            return;
+        }
+    }
+
+    // Not ours: hand the fault to whoever was installed before us.
+    if (previous_action.sa_flags & SA_SIGINFO)
+    {
+        previous_action.sa_sigaction(sig, info, uctx);
+    }
+    else if (previous_action.sa_handler != SIG_IGN && previous_action.sa_handler != SIG_DFL)
+    {
+        previous_action.sa_handler(sig);
+    }
+    else
+    {
+        signal(sig, SIG_DFL);
+    }
+}
+
+bool mempage_init()
+{
+    if (tracking) return true;
+
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    if ((uintptr_t) vm_memory % page_size != 0
+        || sizeof(union mem_u) % page_size != 0
+        || sizeof(union mem_u) / page_size > MAX_MEM_PAGES)
+    {
+        return false;
+    }
+
+    mem_page_bytes = page_size;
+    mem_num_pages = sizeof(union mem_u) / page_size;
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_sigaction = on_write_fault;
+    action.sa_flags = SA_SIGINFO | SA_NODEFER;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGSEGV, &action, &previous_action);
+
+    tracking = true;
+    return true;
+}
+
+void mempage_protect_all()
+{
+    for (unsigned int i = 0; i < mem_num_pages; i++)
+    {
+        dirty[i] = 0;
+    }
+    if (mprotect(vm_memory, sizeof(union mem_u), PROT_READ) != 0)
+    {
+        bail_with_error("Unable to write-protect VM memory for dirty page tracking!");
+    }
+}
+
+void mempage_unprotect_all()
+{
+    if (mprotect(vm_memory, sizeof(union mem_u), PROT_READ | PROT_WRITE) != 0)
+    {
+        bail_with_error("Unable to unprotect VM memory!");
+    }
+}
+
+void mempage_clean(unsigned int page)
+{
+    mprotect((char*) vm_memory + page * mem_page_bytes, mem_page_bytes, PROT_READ);
+    dirty[page] = 0;
+}
+
+bool mempage_is_dirty(unsigned int page)
+{
+    return !tracking || dirty[page];
+}
+
+void mempage_shutdown()
+{
+    if (!tracking) return;
+
+    mempage_unprotect_all();
+    sigaction(SIGSEGV, &previous_action, NULL);
+    tracking = false;
+}
@@ -0,0 +1,43 @@
+#ifndef _MEMPAGE_H
+#define _MEMPAGE_H
+#include <stdbool.h>
+#include <stddef.h>
+#include "machine.h"
+
+// Most host pages memory can be split into (4 KiB pages).
+#define MAX_MEM_PAGES (sizeof(union mem_u) / 4096)
+
+// Number of host pages memory is split into, and their size in bytes.
+// Zero until mempage_init succeeds.
+extern unsigned int mem_num_pages;
+extern size_t mem_page_bytes;
+
+// Pre-Condition: None.
+// Post-Condition: Installs the write fault handler used for dirty page
+// tracking. Returns false (and tracks nothing) if the host page size does
+// not evenly divide memory.
+extern bool mempage_init();
+
+// Pre-Condition: mempage_init returned true.
+// Post-Condition: Makes every page of memory read-only and clean.
+extern void mempage_protect_all();
+
+// Pre-Condition: mempage_init returned true.
+// Post-Condition: Makes every page of memory writable without marking
+// any of them dirty.
+extern void mempage_unprotect_all();
+
+// Pre-Condition: page < mem_num_pages.
+// Post-Condition: Makes the page read-only and clean again.
+extern void mempage_clean(unsigned int page);
+
+// Pre-Condition: None.
+// Post-Condition: Returns true if the page was written since it was last
+// cleaned, or if dirty tracking is not active.
+extern bool mempage_is_dirty(unsigned int page);
+
+// Pre-Condition: mempage_init returned true.
+// Post-Condition: Stops tracking, leaving all of memory writable.
+extern void mempage_shutdown();
+
+#endif
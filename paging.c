@@ -0,0 +1,209 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "paging.h"
+#include "machine.h"
+#include "mempage.h"
+#include "bof.h"
+#include "utilities.h"
+
+#define DEBUG 0
+
+// Page size used when dirty page tracking is not available.
+#define FALLBACK_PAGE_BYTES 4096
+
+static vm_image* images = NULL;
+static word_type* zero_page = NULL;
+static unsigned int num_pages = 0;
+static size_t page_bytes = 0;
+
+// Page each page of memory was last copied from or to, or NULL if unknown.
+// A clean page whose source matches the incoming one need not be copied.
+static word_type* resident[MAX_MEM_PAGES];
+
+// Pre-Condition: None.
+// Post-Condition: Chooses the page size and allocates the zero page.
+static void paging_init()
+{
+    if (zero_page != NULL) return;
+
+    if (mempage_init())
+    {
+        num_pages = mem_num_pages;
+        page_bytes = mem_page_bytes;
+        mempage_protect_all();
+    }
+    else
+    {
+        page_bytes = FALLBACK_PAGE_BYTES;
+        num_pages = sizeof(union mem_u) / page_bytes;
+    }
+
+    zero_page = calloc(1, page_bytes);
+    if (zero_page == NULL)
+    {
+        bail_with_error("Unable to allocate the shared zero page!");
+    }
+}
+
+// Pre-Condition: page < num_pages.
+// Post-Condition: Returns the address of the page within memory.
+static char* page_address(unsigned int page)
+{
+    return (char*) vm_memory + page * page_bytes;
+}
+
+// Pre-Condition: mem was attached to an image and page < num_pages.
+// Post-Condition: Returns true if mem owns its copy of the page.
+static bool is_private(const paged_mem* mem, unsigned int page)
+{
+    return mem->pages[page] != zero_page && mem->pages[page] != mem->image->pages[page];
+}
+
+vm_image* paging_load_image(const char* bof_name)
+{
+    for (vm_image* image = images; image != NULL; image = image->next)
+    {
+        if (strcmp(image->name, bof_name) == 0) return image;
+    }
+
+    paging_init();
+
+    BOFFILE bof = bof_read_open(bof_name);
+    load_bof(bof);
+    bof_close(bof);
+
+    vm_image* image = calloc(1, sizeof(vm_image));
+    if (image == NULL || (image->name = strdup(bof_name)) == NULL)
+    {
+        bail_with_error("Unable to allocate program image for %s!", bof_name);
+    }
+
+    for (unsigned int i = 0; i < num_pages; i++)
+    {
+        if (memcmp(page_address(i), zero_page, page_bytes) == 0)
+        {
+            image->pages[i] = zero_page;
+            continue;
+        }
+
+        image->pages[i] = malloc(page_bytes);
+        if (image->pages[i] == NULL)
+        {
+            bail_with_error("Unable to allocate program image for %s!", bof_name);
+        }
+        memcpy(image->pages[i], page_address(i), page_bytes);
+    }
+
+    vm_save_registers(&image->regs);
+    // The next load reuses the VM's block length table, so keep a copy.
+    image->regs.block_lengths = malloc((num_instrs + 1) * sizeof(unsigned int));
+    if (image->regs.block_lengths == NULL)
+    {
+        bail_with_error("Unable to allocate program image for %s!", bof_name);
+    }
+    memcpy(image->regs.block_lengths, block_lengths, (num_instrs + 1) * sizeof(unsigned int));
+    image->next = images;
+    images = image;
+
+    if (DEBUG) printf("DEBUG: loaded image for %s\n", bof_name);
+    return image;
+}
+
+void paging_attach(paged_mem* mem, vm_image* image)
+{
+    mem->image = image;
+    memcpy(mem->pages, image->pages, sizeof(mem->pages));
+    image->refs++;
+}
+
+void paging_swap_in(paged_mem* mem)
+{
+    bool unprotected = false;
+
+    for (unsigned int i = 0; i < num_pages; i++)
+    {
+        if (resident[i] == mem->pages[i] && !mempage_is_dirty(i)) continue;
+
+        // Only unprotect when something has to be copied, so that
+        // switching back to the same instance costs no system calls.
+        if (!unprotected && mem_num_pages > 0)
+        {
+            mempage_unprotect_all();
+            unprotected = true;
+        }
+        memcpy(page_address(i), mem->pages[i], page_bytes);
+        resident[i] = mem->pages[i];
+    }
+
+    if (unprotected) mempage_protect_all();
+}
+
+void paging_swap_out(paged_mem* mem)
+{
+    for (unsigned int i = 0; i < num_pages; i++)
+    {
+        if (!mempage_is_dirty(i)) continue;
+
+        if (!is_private(mem, i))
+        {
+            // Written back unchanged: keep sharing.
+            if (memcmp(page_address(i), mem->pages[i], page_bytes) == 0)
+            {
+                if (mem_num_pages > 0) mempage_clean(i);
+                resident[i] = mem->pages[i];
+                continue;
+            }
+
+            mem->pages[i] = malloc(page_bytes);
+            if (mem->pages[i] == NULL)
+            {
+                bail_with_error("Unable to allocate a private page for %s!", mem->image->name);
+            }
+        }
+
+        memcpy(mem->pages[i], page_address(i), page_bytes);
+        resident[i] = mem->pages[i];
+        if (mem_num_pages > 0) mempage_clean(i);
+    }
+}
+
+void paging_release(paged_mem* mem)
+{
+    for (unsigned int i = 0; i < num_pages; i++)
+    {
+        if (is_private(mem, i))
+        {
+            // Forget it so a later allocation at the same address is not
+            // mistaken for what memory holds.
+            for (unsigned int j = 0; j < num_pages; j++)
+            {
+                if (resident[j] == mem->pages[i]) resident[j] = NULL;
+            }
+            free(mem->pages[i]);
+        }
+        mem->pages[i] = NULL;
+    }
+
+    mem->image->refs--;
+}
+
+unsigned int paging_num_pages()
+{
+    return num_pages;
+}
+
+size_t paging_page_bytes()
+{
+    return page_bytes;
+}
+
+size_t paging_private_bytes(const paged_mem* mem)
+{
+    size_t bytes = 0;
+    for (unsigned int i = 0; i < num_pages; i++)
+    {
+        if (is_private(mem, i)) bytes += page_bytes;
+    }
+    return bytes;
+}
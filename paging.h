@@ -0,0 +1,62 @@
+#ifndef _PAGING_H
+#define _PAGING_H
+#include <stddef.h>
+#include "machine.h"
+#include "mempage.h"
+
+// Initial memory and registers of a loaded program. Its pages are shared
+// copy-on-write by every instance of the program, and pages that start
+// out all zero share a single zero page.
+typedef struct vm_image
+{
+    char* name;
+    word_type* pages[MAX_MEM_PAGES];
+    vm_context regs;
+    unsigned int refs;
+    struct vm_image* next;
+} vm_image;
+
+// Memory of an instance while it is not resident in memory. Each entry is
+// the image's page, the shared zero page, or a private page the instance
+// has written to.
+typedef struct
+{
+    vm_image* image;
+    word_type* pages[MAX_MEM_PAGES];
+} paged_mem;
+
+// Pre-Condition: bof_name names a valid binary object file.
+// Post-Condition: Returns the image for the program, loading it the
+// first time the name is seen. Leaves the VM state undefined.
+extern vm_image* paging_load_image(const char* bof_name);
+
+// Pre-Condition: image was returned by paging_load_image.
+// Post-Condition: Makes mem a fresh instance of the image that shares
+// all of its pages.
+extern void paging_attach(paged_mem* mem, vm_image* image);
+
+// Pre-Condition: mem was attached to an image.
+// Post-Condition: Makes memory hold mem's contents. Pages memory already
+// holds unchanged are not copied.
+extern void paging_swap_in(paged_mem* mem);
+
+// Pre-Condition: mem is the instance swapped in last.
+// Post-Condition: Copies the pages written since the swap in back into
+// mem, giving it private copies of them.
+extern void paging_swap_out(paged_mem* mem);
+
+// Pre-Condition: mem was attached to an image.
+// Post-Condition: Frees mem's private pages and drops its image reference.
+extern void paging_release(paged_mem* mem);
+
+// Pre-Condition: An image has been loaded.
+// Post-Condition: Return how many pages memory is split into and the
+// size of each in bytes.
+extern unsigned int paging_num_pages();
+extern size_t paging_page_bytes();
+
+// Pre-Condition: mem was attached to an image.
+// Post-Condition: Returns the bytes of page storage owned by mem alone.
+extern size_t paging_private_bytes(const paged_mem* mem);
+
+#endif
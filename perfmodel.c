@@ -0,0 +1,234 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "perfmodel.h"
+#include "machine.h"
+#include "instruction.h"
+#include "utilities.h"
+
+#define DEBUG 0
+
+#define MAX_COST_ENTRIES 64
+#define MAX_MNEMONIC_LENGTH 16
+
+typedef struct
+{
+    char name[MAX_MNEMONIC_LENGTH];
+    unsigned int cycles;
+} cost_entry;
+
+static cost_entry costs[MAX_COST_ENTRIES];
+static int num_costs = 0;
+static unsigned int default_cost = MODEL_DEFAULT_COST;
+static unsigned int taken_penalty = MODEL_DEFAULT_TAKEN_PENALTY;
+
+// Per instruction cost, and the cost of running from each address to the
+// end of its basic block, both indexed by address in the text.
+static unsigned int* instr_cost = NULL;
+static unsigned long long* block_cost = NULL;
+
+// Statistics per block, indexed by the address the block was entered at.
+// Index num_instrs collects anything run from outside the text.
+static unsigned long long* block_runs = NULL;
+static unsigned long long* block_instrs = NULL;
+static unsigned long long* block_cycles = NULL;
+
+// Where the program started, which begins a routine like a CALL target.
+static address_type entry_point = 0;
+
+void model_load_costs(const char* path)
+{
+    FILE* in = fopen(path, "r");
+    if (in == NULL)
+    {
+        bail_with_error("Unable to open cost table %s!", path);
+    }
+
+    char line[128];
+    int line_num = 0;
+    while (fgets(line, sizeof(line), in) != NULL)
+    {
+        line_num++;
+        char name[MAX_MNEMONIC_LENGTH];
+        unsigned int cycles;
+
+        if (line[0] == '#' || sscanf(line, "%15s", name) != 1) continue;
+        if (sscanf(line, "%15s %u", name, &cycles) != 2)
+        {
+            bail_with_error("%s:%d: expected a mnemonic and a cycle count", path, line_num);
+        }
+
+        if (strcmp(name, "default") == 0) default_cost = cycles;
+        else if (strcmp(name, "taken") == 0) taken_penalty = cycles;
+        else if (num_costs == MAX_COST_ENTRIES)
+        {
+            bail_with_error("%s:%d: too many entries in the cost table", path, line_num);
+        }
+        else
+        {
+            strcpy(costs[num_costs].name, name);
+            costs[num_costs].cycles = cycles;
+            num_costs++;
+        }
+    }
+
+    fclose(in);
+}
+
+// Pre-Condition: None.
+// Post-Condition: Returns the cost table's latency for instr.
+static unsigned int cost_of(bin_instr_t instr)
+{
+    const char* name = instruction_mnemonic(instr);
+    for (int i = 0; i < num_costs; i++)
+    {
+        if (strcmp(costs[i].name, name) == 0) return costs[i].cycles;
+    }
+    return default_cost;
+}
+
+// Pre-Condition: Instructions have been loaded and block_lengths computed.
+// Post-Condition: Notes the entry point and allocates the cost and
+// statistics tables. Costs are
+// taken from the loaded text, so stores into the text are not reflected.
+static void model_init()
+{
+    entry_point = PC;
+    instr_cost = malloc((num_instrs + 1) * sizeof(unsigned int));
+    block_cost = malloc((num_instrs + 1) * sizeof(unsigned long long));
+    block_runs = calloc(num_instrs + 1, sizeof(unsigned long long));
+    block_instrs = calloc(num_instrs + 1, sizeof(unsigned long long));
+    block_cycles = calloc(num_instrs + 1, sizeof(unsigned long long));
+    if (instr_cost == NULL || block_cost == NULL || block_runs == NULL
+        || block_instrs == NULL || block_cycles == NULL)
+    {
+        bail_with_error("Unable to allocate the performance model tables!");
+    }
+
+    instr_cost[num_instrs] = default_cost;
+    block_cost[num_instrs] = default_cost;
+    for (int i = (int) num_instrs - 1; i >= 0; i--)
+    {
+        instr_cost[i] = cost_of(vm_memory->instrs[i]);
+        block_cost[i] = instr_cost[i];
+        if (block_lengths[i] > 1) block_cost[i] += block_cost[i + 1];
+    }
+}
+
+// Pre-Condition: None.
+// Post-Condition: Returns the cost of the first ran instructions from start.
+static unsigned long long partial_cost(address_type start, unsigned long long ran)
+{
+    unsigned long long cycles = 0;
+    for (unsigned long long i = 0; i < ran; i++)
+    {
+        cycles += (start + i < num_instrs) ? instr_cost[start + i] : default_cost;
+    }
+    return cycles;
+}
+
+// Pre-Condition: model_init has been called.
+// Post-Condition: Marks the entry point and every static CALL target.
+static bool* find_routines()
+{
+    bool* starts = calloc(num_instrs + 1, sizeof(bool));
+    if (starts == NULL)
+    {
+        bail_with_error("Unable to allocate the routine table!");
+    }
+
+    if (entry_point < num_instrs) starts[entry_point] = true;
+    for (address_type i = 0; i < num_instrs; i++)
+    {
+        bin_instr_t instr = vm_memory->instrs[i];
+        if (instruction_type(instr) == jump_instr_type && instr.jump.op == CALL_O)
+        {
+            address_type target = machine_types_formAddress(i, instr.jump.addr);
+            if (target < num_instrs) starts[target] = true;
+        }
+    }
+    return starts;
+}
+
+// Pre-Condition: The program has finished running under the model.
+// Post-Condition: Writes the totals, the routines and the blocks to out.
+static void print_report(FILE* out)
+{
+    unsigned long long total_instrs = 0;
+    unsigned long long total_cycles = 0;
+    for (address_type i = 0; i <= num_instrs; i++)
+    {
+        total_instrs += block_instrs[i];
+        total_cycles += block_cycles[i];
+    }
+
+    fprintf(out, "Estimated cycles: %llu for %llu instructions (CPI %.2f)\n",
+            total_cycles, total_instrs,
+            total_instrs > 0 ? (double) total_cycles / total_instrs : 0.0);
+
+    // A block belongs to the closest routine entry at or before it.
+    bool* starts = find_routines();
+    fprintf(out, "%8s %14s %14s %7s\n", "Routine", "Instructions", "Cycles", "Share");
+    for (address_type r = 0; r < num_instrs; r++)
+    {
+        if (!starts[r]) continue;
+        unsigned long long instrs = 0;
+        unsigned long long cycles = 0;
+        for (address_type b = r; b < num_instrs && (b == r || !starts[b]); b++)
+        {
+            instrs += block_instrs[b];
+            cycles += block_cycles[b];
+        }
+        if (instrs == 0) continue;
+        fprintf(out, "%8u %14llu %14llu %6.2f%%\n", r, instrs, cycles,
+                100.0 * cycles / total_cycles);
+    }
+    free(starts);
+
+    fprintf(out, "%8s %14s %14s %14s\n", "Block", "Executions", "Instructions", "Cycles");
+    for (address_type b = 0; b <= num_instrs; b++)
+    {
+        if (block_runs[b] == 0) continue;
+        if (b == num_instrs) fprintf(out, "%8s", "other");
+        else fprintf(out, "%8u", b);
+        fprintf(out, " %14llu %14llu %14llu\n", block_runs[b], block_instrs[b], block_cycles[b]);
+    }
+}
+
+void model_run(FILE* report)
+{
+    model_init();
+
+    if (trace_program) print_state();
+
+    vm_status status = VM_YIELDED;
+    while (status == VM_YIELDED)
+    {
+        // One basic block per call, so the totals can be charged per block.
+        address_type start = PC;
+        unsigned long long len = (start < num_instrs) ? block_lengths[start] : 1;
+        unsigned long long before = vm_instr_count;
+
+        status = vm_run_for(len);
+
+        unsigned long long ran = vm_instr_count - before;
+        unsigned long long cycles = (ran == len && start < num_instrs)
+                                    ? block_cost[start] : partial_cost(start, ran);
+        if (status == VM_YIELDED && PC != start + len) cycles += taken_penalty;
+
+        address_type b = (start < num_instrs) ? start : num_instrs;
+        block_runs[b]++;
+        block_instrs[b] += ran;
+        block_cycles[b] += cycles;
+    }
+
+    fflush(stdout);
+    print_report(report);
+
+    if (status == VM_FAULTED)
+    {
+        print_flight_record(stderr);
+        bail_with_error("%s", vm_fault_message);
+    }
+    exit(vm_exit_code);
+}
@@ -0,0 +1,25 @@
+#ifndef _PERFMODEL_H
+#define _PERFMODEL_H
+#include <stdio.h>
+
+// Cycles charged to an instruction the cost table does not mention.
+#define MODEL_DEFAULT_COST 1
+
+// Extra cycles charged whenever control does not fall through to the next
+// instruction (a taken branch or any jump), for refetching the pipeline.
+#define MODEL_DEFAULT_TAKEN_PENALTY 2
+
+// Pre-Condition: path names a readable cost table. Each line is a
+// mnemonic as printed by -p and its latency in cycles, such as "MUL 4".
+// The names "default" and "taken" set the cost of unlisted instructions
+// and the taken-branch penalty. Lines starting with # are ignored.
+// Post-Condition: Replaces the cost table with the one in path.
+extern void model_load_costs(const char* path);
+
+// Pre-Condition: A program has been loaded.
+// Post-Condition: Runs the program, charging each instruction its cost
+// plus the taken-branch penalty, then writes the estimated cycles per
+// routine and per basic block to report. Exits like vm_run_program.
+extern void model_run(FILE* report);
+
+#endif
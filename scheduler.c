@@ -0,0 +1,173 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include "scheduler.h"
+#include "machine.h"
+#include "paging.h"
+#include "utilities.h"
+
+#define DEBUG 0
+
+static sched_task** tasks = NULL;
+static int num_tasks = 0;
+
+// Instance whose state is currently in the VM registers and memory.
+static sched_task* current = NULL;
+
+sched_task* sched_add(const char* bof_name, int input_fd)
+{
+    sched_task* task = calloc(1, sizeof(sched_task));
+    sched_task** grown = realloc(tasks, (num_tasks + 1) * sizeof(sched_task*));
+    if (task == NULL || grown == NULL)
+    {
+        bail_with_error("Unable to allocate scheduler instance for %s!", bof_name);
+    }
+    tasks = grown;
+    tasks[num_tasks++] = task;
+
+    vm_image* image = paging_load_image(bof_name);
+    paging_attach(&task->mem, image);
+    task->ctx = image->regs;
+
+    task->name = bof_name;
+    task->input_fd = input_fd;
+
+    if (DEBUG) printf("DEBUG: added instance %d for %s\n", num_tasks - 1, bof_name);
+    return task;
+}
+
+// Pre-Condition: None.
+// Post-Condition: Returns true if a read_char by task would not block.
+static bool input_ready(sched_task* task)
+{
+    if (task->input_pos < task->input_len || task->input_eof) return true;
+
+    struct pollfd pfd = { task->input_fd, POLLIN, 0 };
+    return poll(&pfd, 1, 0) > 0;
+}
+
+// Pre-Condition: current is the running instance.
+// Post-Condition: Returns its next input character, EOF, or
+// VM_INPUT_PENDING without blocking.
+static int sched_read_char(void)
+{
+    sched_task* task = current;
+
+    if (task->input_pos == task->input_len)
+    {
+        if (task->input_eof) return EOF;
+        if (!input_ready(task)) return VM_INPUT_PENDING;
+
+        ssize_t got = read(task->input_fd, task->input_buf, sizeof(task->input_buf));
+        if (got < 0 && (errno == EAGAIN || errno == EINTR)) return VM_INPUT_PENDING;
+        if (got <= 0)
+        {
+            task->input_eof = true;
+            return EOF;
+        }
+        task->input_pos = 0;
+        task->input_len = (int) got;
+    }
+
+    return (unsigned char) task->input_buf[task->input_pos++];
+}
+
+// Pre-Condition: At least one instance is parked and none can run.
+// Post-Condition: Blocks until some parked instance's input is readable.
+static void wait_for_input()
+{
+    struct pollfd* pfds = malloc(num_tasks * sizeof(struct pollfd));
+    if (pfds == NULL)
+    {
+        bail_with_error("Unable to allocate scheduler poll set!");
+    }
+
+    int n = 0;
+    for (int i = 0; i < num_tasks; i++)
+    {
+        if (!tasks[i]->done && tasks[i]->parked)
+        {
+            pfds[n].fd = tasks[i]->input_fd;
+            pfds[n].events = POLLIN;
+            pfds[n].revents = 0;
+            n++;
+        }
+    }
+
+    while (poll(pfds, n, -1) < 0 && errno == EINTR);
+    free(pfds);
+}
+
+int sched_run(unsigned long long slice, unsigned long long limit)
+{
+    int live = num_tasks;
+    int failures = 0;
+
+    vm_read_char = sched_read_char;
+
+    while (live > 0)
+    {
+        bool ran = false;
+
+        for (int i = 0; i < num_tasks; i++)
+        {
+            sched_task* task = tasks[i];
+            if (task->done) continue;
+            if (task->parked && !input_ready(task)) continue;
+            task->parked = false;
+
+            unsigned long long budget = slice;
+            if (limit != 0 && limit - task->instr_count < budget) budget = limit - task->instr_count;
+
+            current = task;
+            paging_swap_in(&task->mem);
+            vm_restore_registers(&task->ctx);
+            unsigned long long before = vm_instr_count;
+            // Keep only this slice, so a fault shows only this task.
+            clear_flight_record();
+            vm_status status = vm_run_for(budget);
+            task->instr_count += vm_instr_count - before;
+            vm_save_registers(&task->ctx);
+            paging_swap_out(&task->mem);
+            fflush(stdout);
+            ran = true;
+
+            if (status == VM_EXITED)
+            {
+                task->done = true;
+                task->exit_code = vm_exit_code;
+            }
+            else if (status == VM_FAULTED)
+            {
+                task->done = true;
+                task->exit_code = EXIT_FAILURE;
+                print_flight_record(stderr);
+                fprintf(stderr, "%s: %s\n", task->name, vm_fault_message);
+            }
+            else if (vm_input_pending)
+            {
+                task->parked = true;
+            }
+            else if (limit != 0 && task->instr_count >= limit)
+            {
+                task->done = true;
+                task->exit_code = EXIT_FAILURE;
+                fprintf(stderr, "%s: killed after %llu instructions\n", task->name, task->instr_count);
+            }
+
+            if (task->done)
+            {
+                live--;
+                if (task->exit_code != 0) failures++;
+                paging_release(&task->mem);
+            }
+        }
+
+        if (!ran && live > 0) wait_for_input();
+    }
+
+    current = NULL;
+    return failures;
+}
@@ -0,0 +1,40 @@
+#ifndef _SCHEDULER_H
+#define _SCHEDULER_H
+#include <stdbool.h>
+#include "machine.h"
+#include "paging.h"
+
+// Default number of instructions an instance runs before yielding.
+#define SCHED_DEFAULT_SLICE 10000
+
+// One VM instance managed by the scheduler.
+typedef struct
+{
+    const char* name;
+    vm_context ctx;
+    paged_mem mem;
+    int input_fd;
+    char input_buf[512];
+    int input_pos;
+    int input_len;
+    bool input_eof;
+    bool parked;
+    bool done;
+    int exit_code;
+    unsigned long long instr_count;
+} sched_task;
+
+// Pre-Condition: bof_name names a valid binary object file and input_fd is
+// an open file descriptor the program's read_char calls should read from.
+// Post-Condition: Adds a new instance of the program and returns it.
+// Instances of the same program share its loaded image.
+extern sched_task* sched_add(const char* bof_name, int input_fd);
+
+// Pre-Condition: Instances have been added with sched_add.
+// Post-Condition: Runs all instances round-robin, slice instructions at a
+// time, until every one has exited, faulted, or (if limit is nonzero) run
+// more than limit instructions. Returns the number of instances that did
+// not exit with code 0.
+extern int sched_run(unsigned long long slice, unsigned long long limit);
+
+#endif
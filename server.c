@@ -0,0 +1,392 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include "server.h"
+#include "machine.h"
+#include "paging.h"
+#include "verify.h"
+#include "utilities.h"
+
+#define DEBUG 0
+
+// A preloaded program. Its pages are loaded once by the parent and shared
+// with every worker.
+typedef struct
+{
+    const char* name;
+    vm_image* image;
+    bool verified;
+} server_image;
+
+static server_image images[MAX_SERVER_IMAGES];
+static int num_images = 0;
+
+// Standard input of the run in progress.
+static const unsigned char* input_bytes = NULL;
+static uint32_t input_len = 0;
+static uint32_t input_pos = 0;
+
+// Pre-Condition: A run is in progress.
+// Post-Condition: Returns the next byte of the request's input, or EOF.
+static int read_request_char(void)
+{
+    if (input_pos == input_len) return EOF;
+    return input_bytes[input_pos++];
+}
+
+// Pre-Condition: fd is open.
+// Post-Condition: Reads exactly len bytes into buf. Returns false if the
+// connection closed or failed first.
+static bool read_full(int fd, void* buf, size_t len)
+{
+    char* next = buf;
+    while (len > 0)
+    {
+        ssize_t n = read(fd, next, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        next += n;
+        len -= n;
+    }
+    return true;
+}
+
+// Pre-Condition: fd is open.
+// Post-Condition: Writes all len bytes of buf. Returns false on failure.
+static bool write_full(int fd, const void* buf, size_t len)
+{
+    const char* next = buf;
+    while (len > 0)
+    {
+        ssize_t n = write(fd, next, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        next += n;
+        len -= n;
+    }
+    return true;
+}
+
+// Pre-Condition: None.
+// Post-Condition: Returns the monotonic clock in nanoseconds.
+static uint64_t now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+// Pre-Condition: None.
+// Post-Condition: Leaves a traced instruction out of the run's output.
+static void skip_trace(bin_instr_t instr, bool with_state)
+{
+    (void) instr;
+    (void) with_state;
+}
+
+// Pre-Condition: fd is open. req has been read and input holds its input.
+// Post-Condition: Runs the requested image on a fresh copy of its memory
+// and writes the response to fd. Returns false if the reply failed.
+static bool serve_request(int fd, const server_request* req, const unsigned char* input)
+{
+    server_response resp;
+    memset(&resp, 0, sizeof(resp));
+
+    char* output = NULL;
+    size_t output_len = 0;
+    const char* message = "";
+
+    if (req->image >= (uint32_t) num_images)
+    {
+        resp.status = SERVER_BAD_REQUEST;
+        message = "No such image";
+    }
+    else
+    {
+        uint64_t start = now_ns();
+
+        // Only the pages the previous run dirtied are copied back in.
+        paged_mem mem;
+        paging_attach(&mem, images[req->image].image);
+        paging_swap_in(&mem);
+        vm_restore_registers(&mem.image->regs);
+        program_verified = images[req->image].verified;
+
+        input_bytes = input;
+        input_len = req->input_len;
+        input_pos = 0;
+        vm_instr_count = 0;
+
+        FILE* saved_stdout = stdout;
+        stdout = open_memstream(&output, &output_len);
+        if (stdout == NULL)
+        {
+            bail_with_error("Unable to capture the output of %s!", images[req->image].name);
+        }
+
+        // Each image keeps the tracing flag it was loaded with, and a run
+        // may have left it on, so every run starts untraced.
+        trace_program = false;
+        clear_flight_record();
+        vm_status status = vm_run_for(req->budget == 0 ? ULLONG_MAX : req->budget);
+
+        fclose(stdout);
+        stdout = saved_stdout;
+        paging_release(&mem);
+
+        // The client only gets the message; the record goes to the log.
+        if (status == VM_FAULTED)
+        {
+            print_flight_record(stderr);
+            fprintf(stderr, "%s: %s\n", images[req->image].name, vm_fault_message);
+        }
+
+        resp.status = status == VM_EXITED ? SERVER_EXITED
+                      : status == VM_FAULTED ? SERVER_FAULTED : SERVER_OUT_OF_BUDGET;
+        resp.exit_code = status == VM_EXITED ? vm_exit_code : 0;
+        if (status == VM_FAULTED) message = vm_fault_message;
+        resp.instructions = vm_instr_count;
+        resp.nanoseconds = now_ns() - start;
+    }
+
+    resp.output_len = output_len;
+    resp.message_len = strlen(message);
+
+    if (DEBUG) printf("DEBUG: image %u status %d after %llu instructions\n",
+                      req->image, resp.status, (unsigned long long) resp.instructions);
+
+    bool ok = write_full(fd, &resp, sizeof(resp))
+              && write_full(fd, output, output_len)
+              && write_full(fd, message, resp.message_len);
+    free(output);
+    return ok;
+}
+
+// Pre-Condition: fd is a connected client.
+// Post-Condition: Serves its requests until it closes the connection.
+static void serve_connection(int fd)
+{
+    unsigned char* input = NULL;
+    uint32_t input_cap = 0;
+    server_request req;
+
+    while (read_full(fd, &req, sizeof(req)))
+    {
+        if (req.input_len > input_cap)
+        {
+            free(input);
+            input_cap = req.input_len;
+            input = malloc(input_cap);
+            if (input == NULL)
+            {
+                bail_with_error("Unable to allocate %u bytes of request input!", input_cap);
+            }
+        }
+        if (!read_full(fd, input, req.input_len)) break;
+        if (!serve_request(fd, &req, input)) break;
+    }
+
+    free(input);
+}
+
+// Pre-Condition: listen_fd is a listening socket.
+// Post-Condition: Accepts and serves connections forever.
+static void worker_loop(int listen_fd)
+{
+    vm_read_char = read_request_char;
+
+    while (true)
+    {
+        int fd = accept(listen_fd, NULL, NULL);
+        if (fd < 0)
+        {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            bail_with_error("Unable to accept a connection: %s", strerror(errno));
+        }
+        serve_connection(fd);
+        close(fd);
+    }
+}
+
+// Pre-Condition: listen_fd is a listening socket.
+// Post-Condition: Starts a worker process serving it. Returns its pid.
+static pid_t start_worker(int listen_fd)
+{
+    pid_t pid = fork();
+    if (pid < 0)
+    {
+        bail_with_error("Unable to start a server worker: %s", strerror(errno));
+    }
+    if (pid == 0)
+    {
+        worker_loop(listen_fd);
+        exit(EXIT_FAILURE);
+    }
+    return pid;
+}
+
+void server_run(const char* socket_path, int count, char* bof_names[], int num_workers, bool verify)
+{
+    if (count > MAX_SERVER_IMAGES)
+    {
+        bail_with_error("A server holds at most %d images!", MAX_SERVER_IMAGES);
+    }
+
+    // A server answers with the program's output, never its trace.
+    vm_trace_hook = skip_trace;
+
+    for (int i = 0; i < count; i++)
+    {
+        images[i].name = bof_names[i];
+        images[i].image = paging_load_image(bof_names[i]);
+        images[i].verified = false;
+
+        // The program is still in memory right after loading.
+        if (verify)
+        {
+            char problem[256];
+            if (!verify_program(problem, sizeof(problem)))
+            {
+                bail_with_error("%s: %s", bof_names[i], problem);
+            }
+            images[i].verified = true;
+        }
+    }
+    num_images = count;
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(socket_path) >= sizeof(addr.sun_path))
+    {
+        bail_with_error("Socket path %s is too long!", socket_path);
+    }
+    strcpy(addr.sun_path, socket_path);
+
+    int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(socket_path);
+    if (listen_fd < 0 || bind(listen_fd, (struct sockaddr*) &addr, sizeof(addr)) != 0
+        || listen(listen_fd, SOMAXCONN) != 0)
+    {
+        bail_with_error("Unable to listen on %s: %s", socket_path, strerror(errno));
+    }
+
+    // A client hanging up must not kill the worker serving it.
+    signal(SIGPIPE, SIG_IGN);
+    fflush(stdout);
+
+    if (num_workers < 1) num_workers = 1;
+    pid_t* workers = malloc(num_workers * sizeof(pid_t));
+    if (workers == NULL)
+    {
+        bail_with_error("Unable to allocate the server workers!");
+    }
+    for (int i = 0; i < num_workers; i++)
+    {
+        workers[i] = start_worker(listen_fd);
+    }
+    fprintf(stderr, "Serving %d images on %s with %d workers\n", count, socket_path, num_workers);
+
+    // Replace any worker that dies, such as one that hit a fatal error.
+    while (true)
+    {
+        int status;
+        pid_t pid = wait(&status);
+        if (pid < 0)
+        {
+            if (errno == EINTR) continue;
+            bail_with_error("Unable to wait for server workers: %s", strerror(errno));
+        }
+        for (int i = 0; i < num_workers; i++)
+        {
+            if (workers[i] == pid)
+            {
+                fprintf(stderr, "Restarting server worker %d\n", (int) pid);
+                workers[i] = start_worker(listen_fd);
+            }
+        }
+    }
+}
+
+int server_request_run(const char* socket_path, uint32_t image, uint64_t budget)
+{
+    // Read all of standard input to send with the request.
+    unsigned char* input = NULL;
+    size_t len = 0, cap = 0;
+    int ch;
+    while ((ch = getchar()) != EOF)
+    {
+        if (len == cap)
+        {
+            cap = cap == 0 ? 4096 : cap * 2;
+            input = realloc(input, cap);
+            if (input == NULL)
+            {
+                bail_with_error("Unable to allocate memory for the request input!");
+            }
+        }
+        input[len++] = ch;
+    }
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", socket_path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr*) &addr, sizeof(addr)) != 0)
+    {
+        bail_with_error("Unable to connect to %s: %s", socket_path, strerror(errno));
+    }
+
+    server_request req = { image, (uint32_t) len, budget };
+    server_response resp;
+    if (!write_full(fd, &req, sizeof(req)) || !write_full(fd, input, len)
+        || !read_full(fd, &resp, sizeof(resp)))
+    {
+        bail_with_error("Request to %s failed!", socket_path);
+    }
+    free(input);
+
+    char* output = malloc(resp.output_len + resp.message_len + 1);
+    if (output == NULL || !read_full(fd, output, resp.output_len + resp.message_len))
+    {
+        bail_with_error("Reply from %s was cut short!", socket_path);
+    }
+    close(fd);
+
+    fwrite(output, 1, resp.output_len, stdout);
+    fflush(stdout);
+    output[resp.output_len + resp.message_len] = '\0';
+
+    fprintf(stderr, "%llu instructions in %.1f microseconds\n",
+            (unsigned long long) resp.instructions, resp.nanoseconds / 1000.0);
+
+    int result = EXIT_FAILURE;
+    switch (resp.status)
+    {
+        case SERVER_EXITED:
+            result = resp.exit_code;
+            break;
+        case SERVER_FAULTED:
+            fprintf(stderr, "%s\n", output + resp.output_len);
+            break;
+        case SERVER_OUT_OF_BUDGET:
+            fprintf(stderr, "Instruction budget exhausted\n");
+            break;
+        default:
+            fprintf(stderr, "Bad request: %s\n", output + resp.output_len);
+            break;
+    }
+    free(output);
+    return result;
+}
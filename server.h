@@ -0,0 +1,57 @@
+#ifndef _SERVER_H
+#define _SERVER_H
+#include <stdint.h>
+#include <stdbool.h>
+
+// Number of worker processes when none is given.
+#define SERVER_DEFAULT_WORKERS 4
+
+// Most images a server holds.
+#define MAX_SERVER_IMAGES 256
+
+// Statuses a run can end with.
+#define SERVER_EXITED 0
+#define SERVER_FAULTED 1
+#define SERVER_OUT_OF_BUDGET 2
+#define SERVER_BAD_REQUEST 3
+
+// A run request, followed by input_len bytes of standard input. A budget
+// of 0 runs until the program exits or faults. A connection may carry any
+// number of requests, one after another.
+typedef struct
+{
+    uint32_t image;
+    uint32_t input_len;
+    uint64_t budget;
+} server_request;
+
+// The reply to a request, followed by output_len bytes of standard output
+// and message_len bytes of fault message.
+typedef struct
+{
+    int32_t status;
+    int32_t exit_code;
+    uint64_t instructions;
+    uint64_t nanoseconds;
+    uint32_t output_len;
+    uint32_t message_len;
+} server_response;
+
+// Pre-Condition: bof_names names num_images valid binary object files.
+// Post-Condition: Loads each file once as image 0, 1, ... and serves run
+// requests on the Unix domain socket at socket_path with num_workers
+// worker processes, each starting every run from a fresh copy of the
+// image. Runs start with tracing off, and trace lines, including those of
+// a program that turns tracing on, are left out of the output. With verify
+// set, images must pass verify_program first. Does not return.
+extern void server_run(const char* socket_path, int num_images, char* bof_names[],
+                       int num_workers, bool verify);
+
+// Pre-Condition: A server is listening at socket_path.
+// Post-Condition: Runs image on the server with standard input as its
+// input, copies its output to standard output and its fault message to
+// standard error. Returns the program's exit code, or EXIT_FAILURE if it
+// did not exit.
+extern int server_request_run(const char* socket_path, uint32_t image, uint64_t budget);
+
+#endif
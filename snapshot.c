@@ -0,0 +1,60 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "snapshot.h"
+#include "machine.h"
+#include "mempage.h"
+#include "utilities.h"
+
+#define DEBUG 0
+
+void snapshot_take(vm_snapshot* snap)
+{
+    snap->ctx.mem = NULL;
+    vm_save_context(&snap->ctx);
+
+    // Without dirty tracking, reset falls back to copying everything.
+    snap->tracking = mempage_init();
+    if (snap->tracking) mempage_protect_all();
+}
+
+void snapshot_reset(vm_snapshot* snap)
+{
+    if (!snap->tracking)
+    {
+        vm_restore_context(&snap->ctx);
+        return;
+    }
+
+    // Copy back only the pages the last run wrote to.
+    for (unsigned int i = 0; i < mem_num_pages; i++)
+    {
+        if (mempage_is_dirty(i))
+        {
+            size_t start = i * mem_page_bytes;
+            memcpy((char*) vm_memory + start, (char*) snap->ctx.mem + start, mem_page_bytes);
+            mempage_clean(i);
+        }
+    }
+
+    vm_restore_registers(&snap->ctx);
+
+    if (DEBUG) printf("DEBUG: snapshot reset done\n");
+}
+
+void snapshot_release(vm_snapshot* snap)
+{
+    if (snap->tracking) mempage_shutdown();
+    free(snap->ctx.mem);
+    snap->ctx.mem = NULL;
+}
+
+unsigned int snapshot_dirty_pages()
+{
+    unsigned int count = 0;
+    for (unsigned int i = 0; i < mem_num_pages; i++)
+    {
+        if (mempage_is_dirty(i)) count++;
+    }
+    return count;
+}
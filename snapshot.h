@@ -0,0 +1,32 @@
+#ifndef _SNAPSHOT_H
+#define _SNAPSHOT_H
+#include <stdbool.h>
+#include "machine.h"
+
+// Initial state of a loaded program that it can be reset to.
+typedef struct
+{
+    vm_context ctx;
+    bool tracking;
+} vm_snapshot;
+
+// Pre-Condition: A program has been loaded and has not run yet.
+// Post-Condition: Captures the VM state in snap and starts tracking which
+// memory pages the program dirties from now on.
+extern void snapshot_take(vm_snapshot* snap);
+
+// Pre-Condition: snap was filled in by snapshot_take.
+// Post-Condition: Restores the VM state saved in snap. Only the pages
+// written since the last take or reset are copied back.
+extern void snapshot_reset(vm_snapshot* snap);
+
+// Pre-Condition: snap was filled in by snapshot_take.
+// Post-Condition: Stops dirty tracking and frees the saved state.
+extern void snapshot_release(vm_snapshot* snap);
+
+// Pre-Condition: None.
+// Post-Condition: Returns the number of pages dirtied since the last
+// take or reset.
+extern unsigned int snapshot_dirty_pages();
+
+#endif
@@ -0,0 +1,58 @@
+#ifndef _TEST_H
+#define _TEST_H
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+// Checks shared by the test_*.c programs. A failed check is reported with
+// its line and the test goes on, so one run shows every failure.
+
+static int test_failures = 0;
+
+#define CHECK(cond)                                                                      \
+    do                                                                                   \
+    {                                                                                    \
+        if (!(cond))                                                                     \
+        {                                                                                \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond);     \
+            test_failures++;                                                             \
+        }                                                                                \
+    } while (0)
+
+// Pre-Condition: None.
+// Post-Condition: Runs body in a child process and returns its exit
+// status, or -1 if it did not exit. Used for code that exits, such as a
+// program run or a load that bails out.
+static inline int test_in_child(void (*body)(void* arg), void* arg)
+{
+    fflush(stdout);
+    fflush(stderr);
+    pid_t pid = fork();
+    if (pid < 0) return -1;
+    if (pid == 0)
+    {
+        body(arg);
+        exit(EXIT_SUCCESS);
+    }
+
+    int status;
+    if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status)) return -1;
+    return WEXITSTATUS(status);
+}
+
+// Pre-Condition: None.
+// Post-Condition: Reports the outcome and returns the exit status.
+static inline int test_result(const char* name)
+{
+    if (test_failures == 0)
+    {
+        printf("%s: passed\n", name);
+        return EXIT_SUCCESS;
+    }
+    printf("%s: %d checks failed\n", name, test_failures);
+    return EXIT_FAILURE;
+}
+
+#endif
@@ -0,0 +1,62 @@
+#include <stdio.h>
+#include <string.h>
+#include "test.h"
+#include "builder.h"
+#include "machine.h"
+#include "machine_types.h"
+#include "instruction.h"
+
+int main()
+{
+    bof_builder* b = builder_create();
+    bof_label top = builder_new_label(b);
+    bof_label done = builder_new_label(b);
+    bof_label routine = builder_new_label(b);
+
+    // Backward and forward references to the same labels.
+    address_type lit = builder_othc(b, LIT_F, SP, 0, 3);
+    builder_place_label(b, top);
+    address_type forward = builder_branch(b, BLEZ_O, SP, 0, done);
+    address_type call = builder_jump_to(b, CALL_O, routine);
+    builder_immed(b, ADDI_O, SP, 0, -1);
+    address_type backward = builder_jump_to(b, JMPA_O, top);
+    builder_place_label(b, done);
+    address_type exit = builder_syscall(b, exit_sc, 0, 0);
+    builder_place_label(b, routine);
+    address_type rtn = builder_jump(b, RTN_O, 0);
+
+    address_type first = builder_add_word(b, 42);
+    address_type array = builder_reserve(b, 3);
+    address_type last = builder_add_word(b, -1);
+    builder_set_word(b, array + 1, 9);
+
+    CHECK(builder_here(b) == rtn + 1);
+    CHECK(first == BUILDER_DEFAULT_DATA_START);
+    CHECK(array == first + 1);
+    CHECK(last == array + 3);
+
+    builder_finish(b);
+    CHECK(b->instrs[forward].immed.immed == (int) (exit - forward));
+    CHECK(machine_types_formAddress(call, b->instrs[call].jump.addr) == rtn);
+    CHECK(machine_types_formAddress(backward, b->instrs[backward].jump.addr) == lit + 1);
+    CHECK(b->header.text_length == (int) rtn + 1);
+    CHECK(b->header.data_length == 5);
+
+    // Loading gives the same program, ready to run from the text start.
+    builder_load(b);
+    CHECK(num_instrs == rtn + 1);
+    CHECK(PC == 0);
+    CHECK(GPR[GP] == BUILDER_DEFAULT_DATA_START);
+    CHECK(GPR[SP] == BUILDER_DEFAULT_STACK_BOTTOM);
+    for (address_type a = 0; a < num_instrs; a++)
+    {
+        CHECK(memcmp(&vm_memory->instrs[a], &b->instrs[a], sizeof(bin_instr_t)) == 0);
+    }
+    CHECK(vm_memory->words[first] == 42);
+    CHECK(vm_memory->words[array] == 0);
+    CHECK(vm_memory->words[array + 1] == 9);
+    CHECK(vm_memory->words[last] == -1);
+
+    builder_free(b);
+    return test_result("test_builder");
+}
@@ -0,0 +1,136 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "test.h"
+#include "builder.h"
+#include "compact.h"
+#include "machine.h"
+#include "instruction.h"
+#include "bof.h"
+
+static char bof_path[64];
+static char compact_path[64];
+static char broken_path[64];
+
+// Pre-Condition: None.
+// Post-Condition: Writes a program using every instruction format,
+// negative fields, and global data with zero runs of several lengths.
+static void write_program()
+{
+    bof_builder* b = builder_create();
+    bof_label loop = builder_new_label(b);
+    builder_othc(b, LIT_F, SP, -1, -300);
+    builder_place_label(b, loop);
+    builder_comp(b, ADD_F, GP, 3, SP, -2);
+    builder_comp(b, SWR_F, FP, -255, 6, 0);
+    builder_othc(b, SRI_F, SP, 0, 2);
+    builder_immed(b, ADDI_O, SP, 0, -32768);
+    builder_immed(b, BORI_O, GP, 255, 65535);
+    builder_branch(b, BNE_O, SP, 1, loop);
+    builder_jump(b, CALL_O, 0);
+    builder_syscall(b, print_char_sc, SP, -1);
+    builder_syscall(b, exit_sc, 0, 5);
+
+    builder_add_word(b, 5);
+    builder_reserve(b, 3);
+    builder_add_word(b, -7);
+    builder_add_word(b, 100000);
+    builder_reserve(b, 300);
+    builder_add_word(b, -2147483647 - 1);
+    builder_reserve(b, 1);
+
+    builder_write(b, bof_path);
+    builder_free(b);
+}
+
+// Pre-Condition: path names a BOF, compact or not.
+// Post-Condition: Loads it.
+static void load_path(const char* path)
+{
+    BOFFILE bof = bof_read_open(path);
+    load_bof(bof);
+    bof_close(bof);
+}
+
+static void load_broken(void* arg)
+{
+    // The error it should bail out with is expected, so keep it quiet.
+    freopen("/dev/null", "w", stderr);
+    load_path(broken_path);
+}
+
+// Pre-Condition: compact_path holds a compact BOF.
+// Post-Condition: Writes its first len bytes to broken_path, with the
+// byte at flip (if less than len) changed.
+static void write_broken(long len, long flip)
+{
+    FILE* in = fopen(compact_path, "rb");
+    FILE* out = fopen(broken_path, "wb");
+    for (long i = 0; i < len; i++)
+    {
+        int c = fgetc(in);
+        if (c == EOF) break;
+        fputc(i == flip ? c ^ 0x10 : c, out);
+    }
+    fclose(in);
+    fclose(out);
+}
+
+int main()
+{
+    char dir[] = "/tmp/srm-test-XXXXXX";
+    if (mkdtemp(dir) == NULL)
+    {
+        perror("mkdtemp");
+        return EXIT_FAILURE;
+    }
+    snprintf(bof_path, sizeof(bof_path), "%s/prog.bof", dir);
+    snprintf(compact_path, sizeof(compact_path), "%s/prog.bofz", dir);
+    snprintf(broken_path, sizeof(broken_path), "%s/broken.bofz", dir);
+
+    write_program();
+    load_path(bof_path);
+
+    // What the ordinary loader produced, to compare the round trip with.
+    static union mem_u expected;
+    memcpy(&expected, vm_memory, sizeof(expected));
+    unsigned int expected_instrs = num_instrs;
+    unsigned int expected_globals = num_globals;
+    address_type expected_pc = PC;
+    word_type expected_gp = GPR[GP], expected_sp = GPR[SP], expected_fp = GPR[FP];
+
+    FILE* out = fopen(compact_path, "wb");
+    CHECK(out != NULL && compact_write(out));
+    CHECK(out != NULL && fclose(out) == 0);
+
+    memset(vm_memory, 0x5a, sizeof(*vm_memory));
+    load_path(compact_path);
+    CHECK(num_instrs == expected_instrs);
+    CHECK(num_globals == expected_globals);
+    CHECK(PC == expected_pc);
+    CHECK(GPR[GP] == expected_gp && GPR[SP] == expected_sp && GPR[FP] == expected_fp);
+    CHECK(memcmp(vm_memory->instrs, expected.instrs, num_instrs * sizeof(bin_instr_t)) == 0);
+    CHECK(memcmp(&vm_memory->words[GPR[GP]], &expected.words[expected_gp],
+                 num_globals * sizeof(word_type)) == 0);
+
+    // The compact form is smaller than the words it replaces.
+    FILE* in = fopen(compact_path, "rb");
+    fseek(in, 0, SEEK_END);
+    long size = ftell(in);
+    fclose(in);
+    CHECK(size < (long) (sizeof(BOFHeader) + (expected_instrs + expected_globals) * 4));
+
+    // Damaged and truncated files are refused rather than loaded.
+    write_broken(size, size / 2);
+    CHECK(test_in_child(load_broken, NULL) == EXIT_FAILURE);
+    write_broken(size - 5, size);
+    CHECK(test_in_child(load_broken, NULL) == EXIT_FAILURE);
+    write_broken(size, size);
+    CHECK(test_in_child(load_broken, NULL) == EXIT_SUCCESS);
+
+    unlink(bof_path);
+    unlink(compact_path);
+    unlink(broken_path);
+    rmdir(dir);
+    return test_result("test_compact");
+}
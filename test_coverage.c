@@ -0,0 +1,101 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "test.h"
+#include "builder.h"
+#include "coverage.h"
+#include "machine.h"
+#include "instruction.h"
+#include "bof.h"
+
+static char bof_path[64];
+static char first_path[64];
+static char second_path[64];
+
+// Pre-Condition: None.
+// Post-Condition: Writes a program that reads a character and branches
+// on whether it got one, so its input decides which way the branch goes.
+static void write_program()
+{
+    bof_builder* b = builder_create();
+    bof_label done = builder_new_label(b);
+    builder_syscall(b, read_char_sc, SP, 0);
+    builder_branch(b, BLTZ_O, SP, 0, done);
+    builder_comp(b, NOP_F, 0, 0, 0, 0);
+    builder_place_label(b, done);
+    builder_syscall(b, exit_sc, 0, 0);
+    builder_write(b, bof_path);
+    builder_free(b);
+}
+
+// Input for the next run, as returned by read_char.
+static int run_input;
+
+static int read_run_input(void)
+{
+    return run_input;
+}
+
+// Pre-Condition: arg is the coverage file to add to.
+// Post-Condition: Runs the program with coverage, exiting when it does.
+static void run(void* arg)
+{
+    BOFFILE bof = bof_read_open(bof_path);
+    load_bof(bof);
+    bof_close(bof);
+    trace_program = false;
+    vm_read_char = read_run_input;
+    coverage_enable(arg);
+    vm_run_program();
+}
+
+// Summary printed by the last call to report.
+static char summary[8192];
+
+// Pre-Condition: paths names num_paths coverage files of the program.
+// Post-Condition: Leaves their merged report in summary.
+static void report(int num_paths, char* paths[])
+{
+    FILE* out = fmemopen(summary, sizeof(summary), "w");
+    CHECK(coverage_report(bof_path, num_paths, paths, NULL, out) == EXIT_SUCCESS);
+    fclose(out);
+}
+
+int main()
+{
+    char dir[] = "/tmp/srm-test-XXXXXX";
+    if (mkdtemp(dir) == NULL)
+    {
+        perror("mkdtemp");
+        return EXIT_FAILURE;
+    }
+    snprintf(bof_path, sizeof(bof_path), "%s/prog.bof", dir);
+    snprintf(first_path, sizeof(first_path), "%s/first.cov", dir);
+    snprintf(second_path, sizeof(second_path), "%s/second.cov", dir);
+    write_program();
+
+    // At the end of input the branch is taken, skipping the NOP.
+    run_input = EOF;
+    CHECK(test_in_child(run, first_path) == EXIT_SUCCESS);
+    report(1, (char*[]) { first_path });
+    CHECK(strstr(summary, "Instructions run: 3 of 4") != NULL);
+    CHECK(strstr(summary, "Branches taken both ways: 0 of 1") != NULL);
+
+    // Runs into separate files add up when merged.
+    run_input = 'a';
+    CHECK(test_in_child(run, second_path) == EXIT_SUCCESS);
+    report(2, (char*[]) { first_path, second_path });
+    CHECK(strstr(summary, "Instructions run: 4 of 4") != NULL);
+    CHECK(strstr(summary, "Branches taken both ways: 1 of 1") != NULL);
+
+    // As do runs into the same file.
+    CHECK(test_in_child(run, first_path) == EXIT_SUCCESS);
+    report(1, (char*[]) { first_path });
+    CHECK(strstr(summary, "Branches taken both ways: 1 of 1") != NULL);
+
+    unlink(bof_path);
+    unlink(first_path);
+    unlink(second_path);
+    rmdir(dir);
+    return test_result("test_coverage");
+}
@@ -0,0 +1,99 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "test.h"
+#include "tracecmp.h"
+
+static char expected_path[64];
+static char actual_path[64];
+
+// A short trace in the VM's format.
+static const char* trace =
+    "      PC: 0\n"
+    "GPR[$gp]: 1024  GPR[$sp]: 4096  GPR[$fp]: 4096\n"
+    "    1024: 0\t        ...     \n"
+    "==>      0: LIT 12000411\n"
+    "      PC: 1\n"
+    "GPR[$gp]: 1024  GPR[$sp]: 4095  GPR[$fp]: 4096\n"
+    "    4095: 65\t    4096: 0\t\n"
+    "A==>      1: PCH 13ff004f\n"
+    "      PC: 2\n"
+    "GPR[$gp]: 1024  GPR[$sp]: 4095  GPR[$fp]: 4096\n";
+
+static void write_file(const char* path, const char* text)
+{
+    FILE* out = fopen(path, "w");
+    fputs(text, out);
+    fclose(out);
+}
+
+// Report written by the last call to compare.
+static char report[4096];
+
+// Pre-Condition: None.
+// Post-Condition: Compares trace against actual and returns the result,
+// leaving the report in report.
+static int compare(const char* actual)
+{
+    write_file(expected_path, trace);
+    write_file(actual_path, actual);
+
+    FILE* out = fmemopen(report, sizeof(report), "w");
+    int result = trace_compare_files(expected_path, actual_path, out);
+    fclose(out);
+    return result;
+}
+
+// Pre-Condition: None.
+// Post-Condition: Returns a copy of trace with its first occurrence of
+// from replaced by to. The copy is only valid until the next call.
+static const char* edited(const char* from, const char* to)
+{
+    static char copy[1024];
+    const char* at = strstr(trace, from);
+    snprintf(copy, sizeof(copy), "%.*s%s%s", (int) (at - trace), trace, to, at + strlen(from));
+    return copy;
+}
+
+int main()
+{
+    char dir[] = "/tmp/srm-test-XXXXXX";
+    if (mkdtemp(dir) == NULL)
+    {
+        perror("mkdtemp");
+        return EXIT_FAILURE;
+    }
+    snprintf(expected_path, sizeof(expected_path), "%s/expected.txt", dir);
+    snprintf(actual_path, sizeof(actual_path), "%s/actual.txt", dir);
+
+    CHECK(compare(trace) == EXIT_SUCCESS);
+    CHECK(report[0] == '\0');
+
+    // A register line, with the record of its instruction shown.
+    CHECK(compare(edited("GPR[$sp]: 4095", "GPR[$sp]: 4094")) == EXIT_FAILURE);
+    CHECK(strstr(report, "line 6,") != NULL);
+    CHECK(strstr(report, "a register line") != NULL);
+    CHECK(strstr(report, "LIT 12000411") != NULL);
+
+    CHECK(compare(edited("4095: 65", "4095: 66")) == EXIT_FAILURE);
+    CHECK(strstr(report, "a memory line") != NULL);
+
+    CHECK(compare(edited("PCH 13ff004f", "PCH 13ff0040")) == EXIT_FAILURE);
+    CHECK(strstr(report, "an instruction line") != NULL);
+
+    CHECK(compare(edited("A==>", "B==>")) == EXIT_FAILURE);
+    CHECK(strstr(report, "line 8,") != NULL);
+
+    // Before any instruction ran.
+    CHECK(compare(edited("PC: 0", "PC: 9")) == EXIT_FAILURE);
+    CHECK(strstr(report, "Before the first traced instruction") != NULL);
+
+    // A trace that stops early differs where it stops.
+    CHECK(compare(edited("      PC: 2\n", "")) == EXIT_FAILURE);
+    CHECK(strstr(report, "line 9,") != NULL);
+
+    unlink(expected_path);
+    unlink(actual_path);
+    rmdir(dir);
+    return test_result("test_tracecmp");
+}
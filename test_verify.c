@@ -0,0 +1,79 @@
+#include <stdio.h>
+#include <string.h>
+#include "test.h"
+#include "builder.h"
+#include "verify.h"
+#include "machine.h"
+#include "instruction.h"
+
+// Problem reported by the last call to verifies.
+static char problem[256];
+
+// Pre-Condition: b was returned by builder_create.
+// Post-Condition: Loads b's program, frees b and returns whether the
+// program passes verify_program.
+static bool verifies(bof_builder* b)
+{
+    builder_load(b);
+    builder_free(b);
+    problem[0] = '\0';
+    return verify_program(problem, sizeof(problem));
+}
+
+int main()
+{
+    // Straight-line code ending in exit.
+    bof_builder* b = builder_create();
+    builder_othc(b, LIT_F, SP, 0, 65);
+    builder_syscall(b, print_char_sc, SP, 0);
+    builder_syscall(b, exit_sc, 0, 0);
+    CHECK(verifies(b));
+
+    // A loop and a call, all inside the text.
+    b = builder_create();
+    bof_label loop = builder_new_label(b);
+    bof_label routine = builder_new_label(b);
+    builder_othc(b, LIT_F, SP, 0, 3);
+    builder_place_label(b, loop);
+    builder_jump_to(b, CALL_O, routine);
+    builder_immed(b, ADDI_O, SP, 0, -1);
+    builder_branch(b, BGTZ_O, SP, 0, loop);
+    builder_syscall(b, exit_sc, 0, 0);
+    builder_place_label(b, routine);
+    builder_jump(b, RTN_O, 0);
+    CHECK(verifies(b));
+
+    // A branch past the end of the text.
+    b = builder_create();
+    builder_immed(b, BEQ_O, SP, 0, 5);
+    builder_syscall(b, exit_sc, 0, 0);
+    CHECK(!verifies(b));
+    CHECK(strstr(problem, "address 0") != NULL);
+
+    // A jump outside the text.
+    b = builder_create();
+    builder_jump(b, JMPA_O, 100);
+    builder_syscall(b, exit_sc, 0, 0);
+    CHECK(!verifies(b));
+
+    // A computational function code that does not exist.
+    b = builder_create();
+    builder_comp(b, 4, SP, 0, SP, 0);
+    builder_syscall(b, exit_sc, 0, 0);
+    CHECK(!verifies(b));
+
+    // A system call code that does not exist.
+    b = builder_create();
+    builder_syscall(b, 7, 0, 0);
+    builder_syscall(b, exit_sc, 0, 0);
+    CHECK(!verifies(b));
+
+    // Execution that can fall off the end of the text.
+    b = builder_create();
+    builder_othc(b, LIT_F, SP, 0, 1);
+    builder_comp(b, NOP_F, 0, 0, 0, 0);
+    CHECK(!verifies(b));
+    CHECK(strstr(problem, "past the last instruction") != NULL);
+
+    return test_result("test_verify");
+}
@@ -0,0 +1,370 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "timetravel.h"
+#include "machine.h"
+#include "instruction.h"
+#include "utilities.h"
+
+#define DEBUG 0
+
+// Snapshots share pages that did not change since the snapshot before
+// them, so a snapshot costs only the pages the program wrote.
+#define TT_PAGE_WORDS 1024
+#define TT_NUM_PAGES (MEMORY_SIZE_IN_WORDS / TT_PAGE_WORDS)
+
+typedef struct
+{
+    unsigned int refs;
+    word_type words[TT_PAGE_WORDS];
+} tt_page;
+
+typedef struct
+{
+    unsigned long long count;
+    vm_context regs;
+    size_t input_pos;
+    tt_page* pages[TT_NUM_PAGES];
+} tt_snapshot;
+
+static tt_snapshot snapshots[MAX_TT_SNAPSHOTS];
+static int num_snapshots = 0;
+static unsigned long long interval = TT_DEFAULT_INTERVAL;
+
+// Furthest instruction count reached; output before it was already shown.
+static unsigned long long frontier = 0;
+// Set once the program has exited or faulted at the current position.
+static bool at_end = false;
+
+// Every character read so far, and how many of them the program has
+// consumed at the current position.
+static char* input_log = NULL;
+static size_t input_len = 0;
+static size_t input_cap = 0;
+static size_t input_pos = 0;
+static int (*previous_reader)(void) = NULL;
+
+static int saved_stdout = -1;
+
+// Pre-Condition: None.
+// Post-Condition: Returns logged input while replaying, otherwise reads
+// and logs a new character.
+static int replaying_read_char(void)
+{
+    if (input_pos < input_len) return (unsigned char) input_log[input_pos++];
+
+    int c = previous_reader();
+    if (c == EOF || c == VM_INPUT_PENDING) return c;
+
+    if (input_len == input_cap)
+    {
+        input_cap = input_cap == 0 ? 256 : input_cap * 2;
+        input_log = realloc(input_log, input_cap);
+        if (input_log == NULL)
+        {
+            bail_with_error("Unable to allocate the time-travel input log!");
+        }
+    }
+    input_log[input_len++] = (char) c;
+    input_pos = input_len;
+    return c;
+}
+
+// Pre-Condition: None.
+// Post-Condition: Output and tracing are discarded until quiet_end.
+static void quiet_begin()
+{
+    if (saved_stdout >= 0) return;
+    fflush(stdout);
+    saved_stdout = dup(STDOUT_FILENO);
+    int null_fd = open("/dev/null", O_WRONLY);
+    if (saved_stdout < 0 || null_fd < 0)
+    {
+        bail_with_error("Unable to silence output while replaying!");
+    }
+    dup2(null_fd, STDOUT_FILENO);
+    close(null_fd);
+    vm_quiet = true;
+}
+
+// Pre-Condition: None.
+// Post-Condition: Output goes to the real standard output again.
+static void quiet_end()
+{
+    if (saved_stdout < 0) return;
+    fflush(stdout);
+    dup2(saved_stdout, STDOUT_FILENO);
+    close(saved_stdout);
+    saved_stdout = -1;
+    vm_quiet = false;
+}
+
+// Pre-Condition: page was allocated by take_snapshot.
+// Post-Condition: Drops one reference to page, freeing it with the last.
+static void release_page(tt_page* page)
+{
+    if (--page->refs == 0) free(page);
+}
+
+// Pre-Condition: None.
+// Post-Condition: Halves the number of snapshots by doubling the interval
+// and dropping those that are no longer on it. The first is always kept.
+static void thin_snapshots()
+{
+    interval *= 2;
+    int kept = 0;
+    for (int i = 0; i < num_snapshots; i++)
+    {
+        if (i == 0 || snapshots[i].count % interval == 0)
+        {
+            snapshots[kept++] = snapshots[i];
+            continue;
+        }
+        for (int p = 0; p < TT_NUM_PAGES; p++)
+        {
+            release_page(snapshots[i].pages[p]);
+        }
+    }
+    num_snapshots = kept;
+    if (DEBUG) printf("DEBUG: time travel interval is now %llu\n", interval);
+}
+
+// Pre-Condition: The current position is past every snapshot taken.
+// Post-Condition: Records the current state as the newest snapshot.
+static void take_snapshot()
+{
+    if (num_snapshots == MAX_TT_SNAPSHOTS) thin_snapshots();
+
+    tt_snapshot* prev = num_snapshots > 0 ? &snapshots[num_snapshots - 1] : NULL;
+    tt_snapshot* snap = &snapshots[num_snapshots];
+    snap->count = vm_instr_count;
+    snap->input_pos = input_pos;
+    vm_save_registers(&snap->regs);
+
+    for (int p = 0; p < TT_NUM_PAGES; p++)
+    {
+        word_type* words = &vm_memory->words[p * TT_PAGE_WORDS];
+        if (prev != NULL && memcmp(prev->pages[p]->words, words, sizeof(prev->pages[p]->words)) == 0)
+        {
+            snap->pages[p] = prev->pages[p];
+            snap->pages[p]->refs++;
+            continue;
+        }
+        snap->pages[p] = malloc(sizeof(tt_page));
+        if (snap->pages[p] == NULL)
+        {
+            bail_with_error("Unable to allocate a time-travel snapshot!");
+        }
+        snap->pages[p]->refs = 1;
+        memcpy(snap->pages[p]->words, words, sizeof(snap->pages[p]->words));
+    }
+    num_snapshots++;
+}
+
+// Pre-Condition: At least one snapshot exists.
+// Post-Condition: Restores the latest snapshot taken at or before target.
+static void restore_before(unsigned long long target)
+{
+    int i = num_snapshots - 1;
+    while (i > 0 && snapshots[i].count > target) i--;
+
+    tt_snapshot* snap = &snapshots[i];
+    for (int p = 0; p < TT_NUM_PAGES; p++)
+    {
+        memcpy(&vm_memory->words[p * TT_PAGE_WORDS], snap->pages[p]->words, sizeof(snap->pages[p]->words));
+    }
+    vm_restore_registers(&snap->regs);
+    vm_instr_count = snap->count;
+    input_pos = snap->input_pos;
+    at_end = false;
+}
+
+// Pre-Condition: None.
+// Post-Condition: Runs up to n instructions, stopping early at the end
+// of the program. Output is discarded before the frontier.
+static void run_forward(unsigned long long n)
+{
+    while (n > 0 && !at_end)
+    {
+        unsigned long long len = n;
+        if (vm_instr_count < frontier)
+        {
+            quiet_begin();
+            if (frontier - vm_instr_count < len) len = frontier - vm_instr_count;
+        }
+        else
+        {
+            quiet_end();
+            // Stop on the interval so that a new snapshot can be taken.
+            unsigned long long next = (vm_instr_count / interval + 1) * interval;
+            if (next - vm_instr_count < len) len = next - vm_instr_count;
+        }
+
+        unsigned long long start = vm_instr_count;
+        vm_status status = vm_run_for(len);
+        n -= vm_instr_count - start;
+
+        if (vm_instr_count > frontier) frontier = vm_instr_count;
+        if (status != VM_YIELDED)
+        {
+            at_end = true;
+            quiet_end();
+            if (status == VM_FAULTED) printf("Program faulted: %s\n", vm_fault_message);
+            else printf("Program exited with code %d\n", vm_exit_code);
+        }
+        else if (vm_instr_count % interval == 0
+                 && vm_instr_count > snapshots[num_snapshots - 1].count)
+        {
+            take_snapshot();
+        }
+    }
+    quiet_end();
+}
+
+// Pre-Condition: None.
+// Post-Condition: Moves to instruction count target, going back through
+// the snapshots if it is behind the current position.
+static void go_to(unsigned long long target)
+{
+    if (target < vm_instr_count) restore_before(target);
+    run_forward(target - vm_instr_count);
+}
+
+// Address go_to_last_write is looking for, and whether the instruction
+// being replayed wrote to it.
+static address_type watched_addr = 0;
+static bool watched_written = false;
+static void (*previous_hook)(vm_access_kind kind, address_type addr) = NULL;
+
+// Pre-Condition: addr is inside memory.
+// Post-Condition: Notes a write to watched_addr and passes the access on
+// to any other observer.
+static void on_access(vm_access_kind kind, address_type addr)
+{
+    if (kind == ACCESS_WRITE && addr == watched_addr) watched_written = true;
+
+    if (previous_hook != NULL) previous_hook(kind, addr);
+}
+
+// Pre-Condition: addr is a valid memory address.
+// Post-Condition: Moves to just before the last instruction before the
+// current position that wrote to memory[addr], even if it stored the
+// value already there. Returns false and stays put if there is none.
+static bool go_to_last_write(address_type addr)
+{
+    unsigned long long here = vm_instr_count;
+    unsigned long long window_end = here;
+    unsigned long long found = ULLONG_MAX;
+
+    watched_addr = addr;
+    previous_hook = vm_access_hook;
+
+    // Search each snapshot interval, newest first, one instruction at a time.
+    while (found == ULLONG_MAX && window_end > 0)
+    {
+        restore_before(window_end - 1);
+        unsigned long long window_start = vm_instr_count;
+
+        quiet_begin();
+        vm_access_hook = on_access;
+        while (vm_instr_count < window_end && !at_end)
+        {
+            unsigned long long before = vm_instr_count;
+            watched_written = false;
+            if (vm_run_for(1) != VM_YIELDED) at_end = true;
+            if (watched_written) found = before;
+        }
+        vm_access_hook = previous_hook;
+        quiet_end();
+        window_end = window_start;
+    }
+
+    go_to(found != ULLONG_MAX ? found : here);
+    return found != ULLONG_MAX;
+}
+
+// Pre-Condition: None.
+// Post-Condition: Shows the current position and the VM state.
+static void show_position()
+{
+    printf("At instruction %llu\n", vm_instr_count);
+    if (!at_end && PC < MEMORY_SIZE_IN_WORDS)
+    {
+        printf("==>      %u: %s\n", PC, instruction_assembly_form(PC, vm_memory->instrs[PC]));
+    }
+    print_state();
+}
+
+void timetravel_run(FILE* commands, unsigned long long interval_start)
+{
+    bool interactive = isatty(fileno(commands));
+    char line[128];
+
+    if (interval_start > 0) interval = interval_start;
+    previous_reader = vm_read_char;
+    vm_read_char = replaying_read_char;
+    vm_instr_count = 0;
+    take_snapshot();
+    show_position();
+
+    while (true)
+    {
+        if (interactive)
+        {
+            fprintf(stderr, "(tt) ");
+            fflush(stderr);
+        }
+        fflush(stdout);
+
+        if (fgets(line, sizeof(line), commands) == NULL) return;
+
+        char cmd[8] = "";
+        unsigned long long arg = 0;
+        int fields = sscanf(line, "%7s %llu", cmd, &arg);
+        if (fields < 1 || cmd[0] == '#') continue;
+
+        if (strcmp(cmd, "s") == 0)
+        {
+            go_to(vm_instr_count + 1);
+        }
+        else if (strcmp(cmd, "rs") == 0)
+        {
+            if (vm_instr_count > 0) go_to(vm_instr_count - 1);
+        }
+        else if (strcmp(cmd, "g") == 0 && fields == 2)
+        {
+            go_to(arg);
+        }
+        else if (strcmp(cmd, "rw") == 0 && fields == 2 && arg < MEMORY_SIZE_IN_WORDS)
+        {
+            if (!go_to_last_write((address_type) arg))
+            {
+                printf("No earlier write to memory[%llu]\n", arg);
+            }
+        }
+        else if (strcmp(cmd, "pc") == 0 && fields == 2)
+        {
+            do
+            {
+                go_to(vm_instr_count + 1);
+            } while (!at_end && PC != arg);
+        }
+        else if (strcmp(cmd, "c") == 0)
+        {
+            go_to(ULLONG_MAX);
+        }
+        else if (strcmp(cmd, "q") == 0)
+        {
+            return;
+        }
+        else if (strcmp(cmd, "p") != 0)
+        {
+            fprintf(stderr, "Unknown time-travel command: %s", line);
+            continue;
+        }
+        show_position();
+    }
+}
@@ -0,0 +1,26 @@
+#ifndef _TIMETRAVEL_H
+#define _TIMETRAVEL_H
+#include <stdio.h>
+
+// Default number of instructions between history snapshots.
+#define TT_DEFAULT_INTERVAL 100000
+
+// Most snapshots kept. When there would be more, the interval doubles
+// and every other snapshot is dropped, so memory use stays bounded.
+#define MAX_TT_SNAPSHOTS 128
+
+// Pre-Condition: A program has been loaded and commands is open for reading.
+// Post-Condition: Runs the program under control of commands, recording
+// periodic snapshots and the input read so far so that it can go back in
+// time. Commands are:
+//   s         step one instruction      rs        step back one instruction
+//   g N       go to instruction count N
+//   rw ADDR   go back to the last instruction that wrote memory[ADDR]
+//   pc ADDR   run forward until PC is ADDR
+//   c         continue to the end       p         print the VM state
+//   q         quit
+// Going back restores the nearest earlier snapshot and re-executes from
+// there without tracing or repeating output. Returns at end of commands.
+extern void timetravel_run(FILE* commands, unsigned long long interval);
+
+#endif
@@ -0,0 +1,304 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "tracecmp.h"
+#include "utilities.h"
+
+#define DEBUG 0
+
+// Buffer of the stream that compares stdout as it is written.
+#define EXPECT_BUFFER_SIZE 65536
+
+// A file mapped for reading. Empty files have no mapping.
+typedef struct
+{
+    const char* data;
+    size_t len;
+} mapped_file;
+
+// The expected trace while stdout is compared against it.
+static mapped_file expected_trace = { NULL, 0 };
+// Bytes of output so far that matched it.
+static size_t matched = 0;
+static bool diverged = false;
+// Actual output from the first differing byte to the end of its line.
+static char actual_line[TRACECMP_MAX_LINE];
+static size_t actual_len = 0;
+
+static mapped_file map_file(const char* path)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        bail_with_error("Unable to open trace %s!", path);
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+    {
+        bail_with_error("Unable to read the size of trace %s!", path);
+    }
+
+    mapped_file f = { NULL, (size_t) st.st_size };
+    if (f.len > 0)
+    {
+        void* data = mmap(NULL, f.len, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED)
+        {
+            bail_with_error("Unable to map trace %s!", path);
+        }
+        madvise(data, f.len, MADV_SEQUENTIAL);
+        f.data = data;
+    }
+    close(fd);
+    return f;
+}
+
+// Pre-Condition: a and b hold at least len bytes.
+// Post-Condition: Returns the offset of the first byte at which they
+// differ, or len if they agree.
+static size_t first_difference(const char* a, const char* b, size_t len)
+{
+    // Whole blocks first, since memcmp compares many bytes per step.
+    size_t off = 0;
+    while (off < len)
+    {
+        size_t n = len - off < TRACECMP_BLOCK ? len - off : TRACECMP_BLOCK;
+        if (memcmp(a + off, b + off, n) != 0) break;
+        off += n;
+    }
+
+    // Then narrow the differing block down a word at a time.
+    while (off + sizeof(uint64_t) <= len)
+    {
+        uint64_t x, y;
+        memcpy(&x, a + off, sizeof(x));
+        memcpy(&y, b + off, sizeof(y));
+        if (x != y) break;
+        off += sizeof(x);
+    }
+    while (off < len && a[off] == b[off]) off++;
+    return off;
+}
+
+static size_t line_start(const char* text, size_t off)
+{
+    while (off > 0 && text[off - 1] != '\n') off--;
+    return off;
+}
+
+static size_t line_end(const char* text, size_t len, size_t off)
+{
+    const char* nl = off < len ? memchr(text + off, '\n', len - off) : NULL;
+    return nl != NULL ? (size_t) (nl - text) : len;
+}
+
+static unsigned long long count_lines(const char* text, size_t len)
+{
+    unsigned long long lines = 0;
+    for (const char* p = text; (p = memchr(p, '\n', text + len - p)) != NULL; p++)
+    {
+        lines++;
+    }
+    return lines;
+}
+
+static bool is_record_line(const char* line, size_t len)
+{
+    return memmem(line, len, "==>", 3) != NULL;
+}
+
+// Pre-Condition: line holds len bytes without a newline.
+// Post-Condition: Returns what part of the trace the line belongs to.
+static const char* line_kind(const char* line, size_t len)
+{
+    if (len == 0) return "blank";
+    if (is_record_line(line, len)) return "instruction";
+
+    size_t i = 0;
+    while (i < len && line[i] == ' ') i++;
+    if ((len - i >= 3 && strncmp(line + i, "PC:", 3) == 0)
+        || (len >= 4 && strncmp(line, "GPR[", 4) == 0))
+    {
+        return "register";
+    }
+
+    // Memory lines are "addr: value" pairs separated by tabs; listing
+    // lines are "addr: instruction".
+    size_t j = i;
+    while (j < len && isdigit((unsigned char) line[j])) j++;
+    if (j > i && j + 1 < len && line[j] == ':' && line[j + 1] == ' ')
+    {
+        return memchr(line, '\t', len) != NULL ? "memory" : "instruction";
+    }
+    return "output";
+}
+
+// Pre-Condition: The expected and actual traces agree on their first off
+// bytes. rest holds rest_len bytes of the actual trace from off to the
+// end of its line, and actual_ended is set if it has nothing at off.
+// Post-Condition: Writes where the traces diverge to out.
+static void report_divergence(FILE* out, const char* exp, size_t exp_len, size_t off,
+                              const char* rest, size_t rest_len, bool actual_ended)
+{
+    size_t start = line_start(exp, off);
+    size_t exp_end = line_end(exp, exp_len, off);
+    bool expected_ended = off >= exp_len;
+
+    // The line that starts the record of the instruction it belongs to.
+    size_t record = start;
+    bool have_record = false;
+    while (true)
+    {
+        if (is_record_line(exp + record, line_end(exp, exp_len, record) - record))
+        {
+            have_record = true;
+            break;
+        }
+        if (record == 0) break;
+        record = line_start(exp, record - 1);
+    }
+
+    // With no expected line left, classify the whole actual one instead.
+    const char* kind = line_kind(exp + start, exp_end - start);
+    if (expected_ended)
+    {
+        char* line = malloc(off - start + rest_len + 1);
+        if (line == NULL)
+        {
+            bail_with_error("Unable to allocate memory for the trace comparison!");
+        }
+        memcpy(line, exp + start, off - start);
+        memcpy(line + off - start, rest, rest_len);
+        kind = line_kind(line, off - start + rest_len);
+        free(line);
+    }
+    fprintf(out, "Traces differ at line %llu, byte %zu, on %s %s line.\n",
+            count_lines(exp, start) + 1, off, kind[0] == 'i' || kind[0] == 'o' ? "an" : "a", kind);
+    if (!have_record)
+    {
+        fprintf(out, "Before the first traced instruction:\n");
+    }
+
+    size_t context = start;
+    for (int n = 0; n < TRACECMP_CONTEXT_LINES && context > (have_record ? record : 0); n++)
+    {
+        context = line_start(exp, context - 1);
+    }
+    if (have_record && record < context)
+    {
+        size_t end = line_end(exp, exp_len, record);
+        fprintf(out, "  %.*s\n  ...\n", (int) (end - record), exp + record);
+    }
+    while (context < start)
+    {
+        size_t end = line_end(exp, exp_len, context);
+        fprintf(out, "  %.*s\n", (int) (end - context), exp + context);
+        context = end + 1;
+    }
+
+    fprintf(out, "Expected: %.*s%s\n", (int) (exp_end - start), exp + start,
+            expected_ended ? "<end of trace>" : "");
+    fprintf(out, "Actual:   %.*s%.*s%s\n", (int) (off - start), exp + start, (int) rest_len, rest,
+            actual_ended ? "<end of trace>" : "");
+
+    // Point at the first differing character, keeping tabs so it lines up.
+    fprintf(out, "          ");
+    for (size_t i = start; i < off; i++)
+    {
+        fputc(exp[i] == '\t' ? '\t' : ' ', out);
+    }
+    fprintf(out, "^\n");
+}
+
+int trace_compare_files(const char* expected, const char* actual, FILE* report)
+{
+    mapped_file exp = map_file(expected);
+    mapped_file act = map_file(actual);
+
+    size_t common = exp.len < act.len ? exp.len : act.len;
+    size_t off = first_difference(exp.data, act.data, common);
+    if (off == common && exp.len == act.len)
+    {
+        if (DEBUG) printf("DEBUG: %zu bytes match\n", common);
+        return EXIT_SUCCESS;
+    }
+
+    bool actual_ended = off >= act.len;
+    size_t rest_len = actual_ended ? 0 : line_end(act.data, act.len, off) - off;
+    report_divergence(report, exp.data, exp.len, off, act.data + off, rest_len, actual_ended);
+    return EXIT_FAILURE;
+}
+
+static void report_live(bool actual_ended)
+{
+    report_divergence(stderr, expected_trace.data, expected_trace.len, matched,
+                      actual_line, actual_len, actual_ended);
+    fflush(stderr);
+    // Exiting normally would flush stdout and compare it again.
+    _exit(EXIT_FAILURE);
+}
+
+// Pre-Condition: None.
+// Post-Condition: Compares size bytes written to stdout with the next
+// bytes of the expected trace, reporting once the line they differ on
+// has been seen.
+static ssize_t compare_write(void* cookie, const char* buf, size_t size)
+{
+    (void) cookie;
+    size_t done = 0;
+
+    if (!diverged)
+    {
+        size_t left = expected_trace.len - matched;
+        size_t same = first_difference(expected_trace.data + matched, buf, size < left ? size : left);
+        matched += same;
+        if (same == size) return size;
+        diverged = true;
+        done = same;
+    }
+
+    while (done < size)
+    {
+        char c = buf[done++];
+        if (c == '\n' || actual_len == TRACECMP_MAX_LINE) report_live(false);
+        actual_line[actual_len++] = c;
+    }
+    return size;
+}
+
+// Pre-Condition: trace_expect has run. Registered with atexit, since the
+// program ends by exiting.
+// Post-Condition: Reports output that diverged on its last line or ended
+// before the expected trace did.
+static void finish_expect()
+{
+    fflush(stdout);
+    if (diverged) report_live(false);
+    if (matched < expected_trace.len) report_live(true);
+}
+
+void trace_expect(const char* expected)
+{
+    expected_trace = map_file(expected);
+
+    cookie_io_functions_t io = { NULL, compare_write, NULL, NULL };
+    FILE* compared = fopencookie(NULL, "w", io);
+    if (compared == NULL)
+    {
+        bail_with_error("Unable to open a stream to compare output with %s!", expected);
+    }
+    setvbuf(compared, NULL, _IOFBF, EXPECT_BUFFER_SIZE);
+
+    fflush(stdout);
+    stdout = compared;
+    atexit(finish_expect);
+}
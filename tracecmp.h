@@ -0,0 +1,31 @@
+#ifndef _TRACECMP_H
+#define _TRACECMP_H
+#include <stdio.h>
+
+// Bytes compared at once before looking for the differing one.
+#define TRACECMP_BLOCK (1 << 20)
+
+// Most lines of the diverging record shown before the differing line.
+#define TRACECMP_CONTEXT_LINES 8
+
+// Most bytes of the differing actual line kept while output streams.
+#define TRACECMP_MAX_LINE 4096
+
+// Pre-Condition: expected and actual name readable files.
+// Post-Condition: Compares the two traces and writes nothing to report
+// if they are identical. Otherwise reports the first differing line,
+// whether it is an instruction, register, memory or output line, and the
+// trace record of the instruction it belongs to. Returns EXIT_SUCCESS if
+// the traces match and EXIT_FAILURE if not.
+extern int trace_compare_files(const char* expected, const char* actual, FILE* report);
+
+// Pre-Condition: expected names a readable file, and nothing has been
+// written to stdout yet.
+// Post-Condition: Compares everything written to stdout from now on
+// against expected as it is written, without keeping it. Once they
+// differ, the divergence is reported on stderr as trace_compare_files
+// would and the process exits with EXIT_FAILURE. Reports a trace that
+// ends early when the process exits.
+extern void trace_expect(const char* expected);
+
+#endif
@@ -0,0 +1,194 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "tracefilter.h"
+#include "machine.h"
+#include "instruction.h"
+
+#define DEBUG 0
+
+// Comparisons a memory condition can make.
+typedef enum { COND_EQ, COND_NE, COND_LT, COND_LE, COND_GT, COND_GE } trace_cond_op;
+
+static address_type range_lo[MAX_TRACE_RANGES];
+static address_type range_hi[MAX_TRACE_RANGES];
+static int num_ranges = 0;
+
+static bool have_routine = false;
+static address_type routine_addr = 0;
+// Calls into the routine, and calls made from it, not yet returned from.
+static unsigned long long routine_depth = 0;
+
+static bool have_condition = false;
+static address_type cond_addr = 0;
+static trace_cond_op cond_op = COND_EQ;
+static word_type cond_value = 0;
+
+static unsigned long long first_limit = 0;
+static unsigned long long every = 1;
+// Instructions that have passed the other filters so far.
+static unsigned long long passed = 0;
+
+// Set while the filters have turned tracing off for a stretch they leave
+// out entirely, so that it is turned back on where they pass again.
+static bool paused = false;
+// Set once --trace-first has traced all it will.
+static bool finished = false;
+
+bool trace_add_range(address_type lo, address_type hi)
+{
+    if (num_ranges == MAX_TRACE_RANGES) return false;
+    range_lo[num_ranges] = lo;
+    range_hi[num_ranges] = hi;
+    num_ranges++;
+    return true;
+}
+
+void trace_set_routine(address_type addr)
+{
+    have_routine = true;
+    routine_addr = addr;
+}
+
+void trace_set_first(unsigned long long n)
+{
+    first_limit = n;
+}
+
+void trace_set_every(unsigned long long n)
+{
+    every = n > 0 ? n : 1;
+}
+
+bool trace_set_condition(const char* spec)
+{
+    static const char* ops[] = { "==", "!=", "<=", ">=", "<", ">" };
+    static const trace_cond_op codes[] = { COND_EQ, COND_NE, COND_LE, COND_GE, COND_LT, COND_GT };
+
+    char* rest;
+    long addr = strtol(spec, &rest, 10);
+    if (rest == spec || addr < 0 || addr >= MEMORY_SIZE_IN_WORDS) return false;
+
+    for (size_t i = 0; i < sizeof(ops) / sizeof(ops[0]); i++)
+    {
+        size_t len = strlen(ops[i]);
+        if (strncmp(rest, ops[i], len) != 0) continue;
+
+        char* end;
+        long value = strtol(rest + len, &end, 10);
+        if (end == rest + len || *end != '\0') return false;
+
+        have_condition = true;
+        cond_addr = addr;
+        cond_op = codes[i];
+        cond_value = value;
+        return true;
+    }
+    return false;
+}
+
+// Pre-Condition: instr has just run and may have transferred control.
+// Post-Condition: Updates how deep inside the traced routine the program
+// is.
+static void follow_routine(bin_instr_t instr)
+{
+    instr_type type = instruction_type(instr);
+    bool call = (type == jump_instr_type && instr.jump.op == CALL_O)
+                || (type == other_comp_instr_type && instr.othc.func == CSI_F);
+    bool ret = type == jump_instr_type && instr.jump.op == RTN_O;
+
+    if (call && (routine_depth > 0 || PC == routine_addr)) routine_depth++;
+    else if (ret && routine_depth > 0) routine_depth--;
+}
+
+static bool condition_holds()
+{
+    word_type v = vm_memory->words[cond_addr];
+    switch (cond_op)
+    {
+        case COND_EQ: return v == cond_value;
+        case COND_NE: return v != cond_value;
+        case COND_LT: return v < cond_value;
+        case COND_LE: return v <= cond_value;
+        case COND_GT: return v > cond_value;
+        default: return v >= cond_value;
+    }
+}
+
+// Pre-Condition: instr has just run from pc.
+// Post-Condition: Returns true if it should be traced.
+static bool trace_filter(address_type pc, bin_instr_t instr)
+{
+    // The depth is updated after this, so a call into the routine is
+    // left out and the return from it is traced.
+    if (have_routine && routine_depth == 0) return false;
+
+    if (num_ranges > 0)
+    {
+        bool in_range = false;
+        for (int i = 0; i < num_ranges && !in_range; i++)
+        {
+            in_range = pc >= range_lo[i] && pc <= range_hi[i];
+        }
+        if (!in_range) return false;
+    }
+
+    if (have_condition && !condition_holds()) return false;
+
+    passed++;
+    if (first_limit > 0 && passed > first_limit)
+    {
+        // Nothing will be traced again, so let the rest run untraced.
+        trace_program = false;
+        finished = true;
+        return false;
+    }
+    return (passed - 1) % every == 0;
+}
+
+// Pre-Condition: Control has just reached pc by a transfer.
+// Post-Condition: Returns false if the routine and range filters leave
+// out every instruction up to the next transfer.
+static bool block_may_pass(address_type pc)
+{
+    if (have_routine && routine_depth == 0) return false;
+    if (num_ranges == 0) return true;
+
+    address_type last = pc < num_instrs ? pc + block_lengths[pc] - 1 : pc;
+    for (int i = 0; i < num_ranges; i++)
+    {
+        if (pc <= range_hi[i] && last >= range_lo[i]) return true;
+    }
+    return false;
+}
+
+// Pre-Condition: instr has just run from pc and may have transferred
+// control. Installed as vm_transfer_hook, so it sees every transfer,
+// traced or not, after the instruction is traced.
+// Post-Condition: Follows calls into the routine, and turns tracing off
+// for the straight-line run starting at PC if the filters leave all of it
+// out, so that it runs on the untraced block loop, or back on if not.
+static void on_transfer(address_type pc, bin_instr_t instr)
+{
+    (void) pc;
+    if (have_routine) follow_routine(instr);
+
+    // Once the program turns tracing off itself, it stays off until the
+    // program turns it on again.
+    if (instruction_type(instr) == syscall_instr_type
+        && instruction_syscall_number(instr) == stop_tracing_sc)
+    {
+        paused = false;
+    }
+    if (finished || !(trace_program || paused)) return;
+
+    paused = !block_may_pass(PC);
+    trace_program = !paused;
+}
+
+void trace_filter_enable()
+{
+    vm_trace_filter = trace_filter;
+    if (have_routine || num_ranges > 0) vm_transfer_hook = on_transfer;
+    if (DEBUG) printf("DEBUG: trace filter with %d ranges enabled\n", num_ranges);
+}
@@ -0,0 +1,49 @@
+#ifndef _TRACEFILTER_H
+#define _TRACEFILTER_H
+#include <stdbool.h>
+#include "machine.h"
+
+// Most traced address ranges at once.
+#define MAX_TRACE_RANGES 16
+
+// The filters below narrow which instructions are traced while tracing
+// is on. An instruction is traced only if it passes all of them; the
+// first and every counts apply to instructions the other filters passed.
+// The rest run without formatting any trace output. Where the range and
+// routine filters leave out everything up to the next control transfer,
+// tracing is turned off until then, so those stretches run untraced.
+
+// Pre-Condition: 0 <= lo <= hi < MEMORY_SIZE_IN_WORDS.
+// Post-Condition: Traces instructions at addresses lo..hi. With several
+// ranges, an instruction in any of them passes. Returns false if there
+// are already MAX_TRACE_RANGES.
+extern bool trace_add_range(address_type lo, address_type hi);
+
+// Pre-Condition: None.
+// Post-Condition: Traces only inside calls to the routine at addr,
+// including routines it calls, up to and including its return. Calls and
+// returns are followed even while tracing is off.
+extern void trace_set_routine(address_type addr);
+
+// Pre-Condition: None.
+// Post-Condition: Traces only the first n instructions that pass the
+// other filters.
+extern void trace_set_first(unsigned long long n);
+
+// Pre-Condition: n > 0.
+// Post-Condition: Traces only every nth instruction that passes the
+// other filters, starting with the first.
+extern void trace_set_every(unsigned long long n);
+
+// Pre-Condition: None.
+// Post-Condition: Parses spec as ADDR OP VALUE, where OP is one of ==,
+// !=, <, <=, > or >=, and traces only instructions after which the
+// memory word at ADDR compares with VALUE that way. Returns false if spec
+// is malformed.
+extern bool trace_set_condition(const char* spec);
+
+// Pre-Condition: At least one filter has been set.
+// Post-Condition: Installs the filters as vm_trace_filter.
+extern void trace_filter_enable();
+
+#endif
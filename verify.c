@@ -0,0 +1,141 @@
+#include <stdio.h>
+#include "verify.h"
+#include "machine.h"
+#include "machine_types.h"
+#include "instruction.h"
+
+#define DEBUG 0
+
+// Pre-Condition: None.
+// Post-Condition: Returns true if target is a valid text address.
+static bool in_text(long long target)
+{
+    return target >= 0 && target < (long long) num_instrs;
+}
+
+// Pre-Condition: instr is the instruction at addr.
+// Post-Condition: Returns NULL if instr is valid, otherwise a description
+// of what is wrong with it.
+static const char* check_instr(address_type addr, bin_instr_t instr)
+{
+    switch (instruction_type(instr))
+    {
+        case comp_instr_type:
+            switch (instr.comp.func)
+            {
+                case NOP_F: case ADD_F: case SUB_F: case CPW_F:
+                case AND_F: case BOR_F: case NOR_F: case XOR_F:
+                case LWR_F: case SWR_F: case SCA_F: case LWI_F: case NEG_F:
+                    return NULL;
+                default:
+                    return "invalid computational function code";
+            }
+
+        case other_comp_instr_type:
+            switch (instr.othc.func)
+            {
+                case LIT_F: case ARI_F: case SRI_F: case MUL_F: case DIV_F:
+                case CFHI_F: case CFLO_F: case SLL_F: case SRL_F:
+                case JMP_F: case CSI_F:
+                    return NULL;
+                case JREL_F:
+                    if (!in_text((long long) addr + machine_types_formOffset(instr.othc.arg)))
+                    {
+                        return "relative jump target outside the program text";
+                    }
+                    return NULL;
+                default:
+                    return "invalid other computational function code";
+            }
+
+        case immed_instr_type:
+            switch (instr.immed.op)
+            {
+                case ADDI_O: case ANDI_O: case BORI_O: case XORI_O:
+                    return NULL;
+                case BEQ_O: case BGEZ_O: case BGTZ_O: case BLEZ_O: case BLTZ_O: case BNE_O:
+                    if (!in_text((long long) addr + machine_types_formOffset(instr.immed.immed)))
+                    {
+                        return "branch target outside the program text";
+                    }
+                    return NULL;
+                default:
+                    return "invalid immediate instruction opcode";
+            }
+
+        case jump_instr_type:
+            switch (instr.jump.op)
+            {
+                case JMPA_O: case CALL_O:
+                    if (!in_text(machine_types_formAddress(addr, instr.jump.addr)))
+                    {
+                        return "jump or call target outside the program text";
+                    }
+                    return NULL;
+                case RTN_O:
+                    return NULL;
+                default:
+                    return "invalid jump instruction opcode";
+            }
+
+        case syscall_instr_type:
+            switch (instruction_syscall_number(instr))
+            {
+                case exit_sc: case print_str_sc: case print_char_sc: case read_char_sc:
+                case start_tracing_sc: case stop_tracing_sc:
+                    return NULL;
+                default:
+                    return "unrecognized system call code";
+            }
+
+        default:
+            return "invalid opcode";
+    }
+}
+
+// Pre-Condition: instr is a valid instruction.
+// Post-Condition: Returns true if execution never continues at the next
+// address after instr.
+static bool never_falls_through(bin_instr_t instr)
+{
+    switch (instruction_type(instr))
+    {
+        case other_comp_instr_type:
+            return instr.othc.func == JMP_F || instr.othc.func == JREL_F;
+        case jump_instr_type:
+            return instr.jump.op == JMPA_O || instr.jump.op == RTN_O;
+        case syscall_instr_type:
+            return instruction_syscall_number(instr) == exit_sc;
+        default:
+            return false;
+    }
+}
+
+bool verify_program(char* msg, size_t len)
+{
+    if (num_instrs == 0)
+    {
+        snprintf(msg, len, "Program has no instructions");
+        return false;
+    }
+
+    for (address_type i = 0; i < num_instrs; i++)
+    {
+        const char* problem = check_instr(i, vm_memory->instrs[i]);
+        if (problem != NULL)
+        {
+            snprintf(msg, len, "Instruction at address %u (%s): %s", i,
+                     instruction_assembly_form(i, vm_memory->instrs[i]), problem);
+            return false;
+        }
+    }
+
+    if (!never_falls_through(vm_memory->instrs[num_instrs - 1]))
+    {
+        snprintf(msg, len, "Execution can run past the last instruction (address %u)", num_instrs - 1);
+        return false;
+    }
+
+    if (DEBUG) printf("DEBUG: verified %u instructions\n", num_instrs);
+    return true;
+}
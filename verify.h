@@ -0,0 +1,15 @@
+#ifndef _VERIFY_H
+#define _VERIFY_H
+#include <stdbool.h>
+#include <stddef.h>
+
+// Pre-Condition: A program has been loaded into memory and msg has room
+// for len characters.
+// Post-Condition: Checks vm_memory->instrs[0..num_instrs) in one pass for
+// invalid opcodes, function and system call codes, static branch, jump
+// and call targets outside the text, and execution running past the end
+// of the text. Returns true if none were found; otherwise describes the
+// first problem in msg and returns false.
+extern bool verify_program(char* msg, size_t len);
+
+#endif
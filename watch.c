@@ -0,0 +1,197 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "watch.h"
+#include "machine.h"
+#include "instruction.h"
+#include "debugger.h"
+
+#define DEBUG 0
+
+typedef struct
+{
+    int lo;
+    int hi;
+} watch_range;
+
+static watch_range watches[MAX_WATCHPOINTS];
+static int num_watches = 0;
+static size_t page_bytes = 0;
+static int page_words = 0;
+static struct sigaction previous_action;
+static void (*previous_hook)(void) = NULL;
+
+// The store in progress: which instruction made it, which word it wrote
+// and what that word held. While one is pending, its page (and the page
+// of the trap patched in after it) are writable.
+static bool pending = false;
+static address_type store_pc;
+static bin_instr_t store_instr;
+static int store_word;
+static word_type old_value;
+static address_type trap_addr;
+static bin_instr_t trap_original;
+static int unprotected_pages[2];
+static int num_unprotected = 0;
+
+// Pre-Condition: None.
+// Post-Condition: Returns true if the word is in a watched range.
+static bool is_watched(long long word)
+{
+    for (int i = 0; i < num_watches; i++)
+    {
+        if (word >= watches[i].lo && word <= watches[i].hi) return true;
+    }
+    return false;
+}
+
+// Pre-Condition: page is a page number within memory.
+// Post-Condition: Returns true if the page holds a watched word.
+static bool page_is_watched(int page)
+{
+    for (int i = 0; i < num_watches; i++)
+    {
+        if (watches[i].lo / page_words <= page && page <= watches[i].hi / page_words) return true;
+    }
+    return false;
+}
+
+// Pre-Condition: page is a page number within memory.
+// Post-Condition: Sets the page's protection.
+static void protect_page(int page, bool writable)
+{
+    mprotect((char*) vm_memory + (size_t) page * page_bytes, page_bytes,
+             writable ? PROT_READ | PROT_WRITE : PROT_READ);
+}
+
+// Pre-Condition: page is a page number within memory.
+// Post-Condition: Makes a watched page writable until the pending store
+// is finished.
+static void unprotect_for_store(int page)
+{
+    for (int i = 0; i < num_unprotected; i++)
+    {
+        if (unprotected_pages[i] == page) return;
+    }
+    protect_page(page, true);
+    unprotected_pages[num_unprotected++] = page;
+}
+
+static void on_watch_fault(int sig, siginfo_t* info, void* uctx)
+{
+    uintptr_t base = (uintptr_t) vm_memory;
+    uintptr_t addr = (uintptr_t) info->si_addr;
+
+    if (num_watches > 0 && !pending && addr >= base && addr < base + sizeof(union mem_u)
+        && page_is_watched((addr - base) / page_bytes))
+    {
+        // The store belongs to the instruction just fetched, at PC - 1.
+        // Let it finish, and catch up with it at the next instruction by
+        // patching a trap there, the same way a breakpoint works.
+        pending = true;
+        store_pc = PC - 1;
+        store_instr = debugger_original_instr(store_pc);
+        store_word = (addr - base) / sizeof(word_type);
+        old_value = vm_memory->words[store_word];
+
+        num_unprotected = 0;
+        unprotect_for_store(store_word / page_words);
+        if (page_is_watched(PC / page_words)) unprotect_for_store(PC / page_words);
+
+        trap_addr = PC;
+        trap_original = vm_memory->instrs[PC];
+        memset(&vm_memory->instrs[PC], 0, sizeof(bin_instr_t));
+        vm_memory->instrs[PC].syscall.op = OTHC_O;
+        vm_memory->instrs[PC].syscall.func = SYS_F;
+        vm_memory->instrs[PC].syscall.code = BREAKPOINT_SC;
+        return;
+    }
+
+    // Not ours: hand the fault to whoever was installed before us.
+    if (previous_action.sa_flags & SA_SIGINFO)
+    {
+        previous_action.sa_sigaction(sig, info, uctx);
+    }
+    else if (previous_action.sa_handler != SIG_IGN && previous_action.sa_handler != SIG_DFL)
+    {
+        previous_action.sa_handler(sig);
+    }
+    else
+    {
+        signal(sig, SIG_DFL);
+    }
+}
+
+bool watch_settle(address_type addr)
+{
+    if (!pending || addr != trap_addr) return false;
+
+    vm_memory->instrs[trap_addr] = trap_original;
+
+    if (is_watched(store_word))
+    {
+        printf("Watchpoint: %u: %s wrote address %d: %d -> %d\n", store_pc,
+               instruction_assembly_form(store_pc, store_instr), store_word,
+               old_value, vm_memory->words[store_word]);
+    }
+
+    for (int i = 0; i < num_unprotected; i++)
+    {
+        protect_page(unprotected_pages[i], false);
+    }
+    num_unprotected = 0;
+    pending = false;
+    return true;
+}
+
+// Pre-Condition: A breakpoint trap executed and PC points at it.
+// Post-Condition: If it is the trap placed after a watched store, settles
+// the store. Other traps go to the debugger, if one is installed.
+static void on_watch_trap()
+{
+    if (watch_settle(PC)) return;
+
+    if (previous_hook != NULL) previous_hook();
+    else vm_fault("Breakpoint trap at PC %u with no debugger attached!", PC);
+}
+
+bool watch_add(int lo, int hi)
+{
+    if (num_watches == MAX_WATCHPOINTS) return false;
+
+    if (page_bytes == 0)
+    {
+        page_bytes = sysconf(_SC_PAGESIZE);
+        if ((uintptr_t) vm_memory % page_bytes != 0 || sizeof(union mem_u) % page_bytes != 0)
+        {
+            page_bytes = 0;
+            return false;
+        }
+        page_words = page_bytes / sizeof(word_type);
+
+        struct sigaction action;
+        memset(&action, 0, sizeof(action));
+        action.sa_sigaction = on_watch_fault;
+        action.sa_flags = SA_SIGINFO | SA_NODEFER;
+        sigemptyset(&action.sa_mask);
+        sigaction(SIGSEGV, &action, &previous_action);
+
+        previous_hook = vm_breakpoint_hook;
+        vm_breakpoint_hook = on_watch_trap;
+    }
+
+    watches[num_watches].lo = lo;
+    watches[num_watches].hi = hi;
+    num_watches++;
+
+    for (int page = lo / page_words; page <= hi / page_words; page++)
+    {
+        protect_page(page, false);
+    }
+
+    if (DEBUG) printf("DEBUG: watching %d..%d\n", lo, hi);
+    return true;
+}
@@ -0,0 +1,25 @@
+#ifndef _WATCH_H
+#define _WATCH_H
+#include <stdbool.h>
+#include "machine.h"
+
+// Most watched address ranges at once.
+#define MAX_WATCHPOINTS 32
+
+// Pre-Condition: A program has been loaded into memory, and
+// 0 <= lo <= hi < MEMORY_SIZE_IN_WORDS.
+// Post-Condition: Reports every store to vm_memory->words[lo..hi] with the
+// PC, the instruction, and the old and new values. Only the host pages
+// holding the range are write-protected; the rest of memory runs at full
+// speed. Returns false if memory is not page aligned.
+extern bool watch_add(int lo, int hi);
+
+// Pre-Condition: None.
+// Post-Condition: If the trap patched in after a watched store is at
+// addr, reports the store, puts back the word the trap replaced and
+// re-protects the pages, then returns true. Otherwise returns false. A
+// debugger with its own trap at addr calls this first, so that the two
+// never step over or restore each other's words.
+extern bool watch_settle(address_type addr);
+
+#endif